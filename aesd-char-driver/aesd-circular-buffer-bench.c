@@ -0,0 +1,168 @@
+/**
+ * @file aesd-circular-buffer-bench.c
+ * @brief Cost of adding and reading back lines in the circular buffer
+ *
+ * Compares lines the caller allocates one by one (aesd_circular_buffer_add_entry(),
+ * what the driver did before) with lines copied into buffer owned storage
+ * (aesd_circular_buffer_add_copy()). Reads go through
+ * aesd_circular_buffer_find_entry_offset_for_fpos() the way aesd_dev_read() does,
+ * once more with a copy of the lookup that walks entry[] instead of the
+ * dense size array.
+ *
+ * Usage: aesd-circular-buffer-bench [min_line] [max_line] [lines]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd-circular-buffer.h"
+
+#define READ_SIZE 4096
+#define READ_PASSES 2000
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * the lookup as it was before the dense size array
+ */
+static struct aesd_buffer_entry *find_entry_walking_entries(struct aesd_circular_buffer *buffer,
+            size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    size_t cumulative_offset = 0;
+    uint8_t idx = buffer->out_offs;
+
+    do
+    {
+        struct aesd_buffer_entry *entry = &buffer->entry[idx];
+        if (cumulative_offset + entry->size > char_offset)
+        {
+            *entry_offset_byte_rtn = char_offset - cumulative_offset;
+            return entry;
+        }
+
+        cumulative_offset += entry->size;
+        idx = (idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    } while (idx != buffer->in_offs);
+
+    return NULL;
+}
+
+/*
+ * reads the whole history READ_SIZE bytes at a time, one entry at most per read
+ * @return ns per byte
+ */
+static double read_history(struct aesd_circular_buffer *buffer, bool walk_entries)
+{
+    static char out[READ_SIZE + 2048];
+    size_t bytes = 0;
+    double start = now_ns();
+
+    for (int pass = 0; pass < READ_PASSES; pass++)
+    {
+        size_t pos = 0, offset;
+        struct aesd_buffer_entry *entry;
+
+        while ((entry = walk_entries ? find_entry_walking_entries(buffer, pos, &offset)
+                                     : aesd_circular_buffer_find_entry_offset_for_fpos(buffer, pos, &offset)))
+        {
+            size_t count = entry->size - offset < READ_SIZE ? entry->size - offset : READ_SIZE;
+            memcpy(out, entry->buffptr + offset, count);
+            pos += count;
+        }
+        bytes += pos;
+    }
+    __asm__ __volatile__("" : : "r"(out) : "memory");
+    return (now_ns() - start) / bytes;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t min_line = argc > 1 ? strtoul(argv[1], NULL, 0) : 16;
+    size_t max_line = argc > 2 ? strtoul(argv[2], NULL, 0) : 48;
+    size_t lines = argc > 3 ? strtoul(argv[3], NULL, 0) : 1000000;
+    static struct aesd_circular_buffer allocated, copied;
+    struct aesd_buffer_entry *entry;
+    uint8_t index;
+    char *data;
+    size_t *sizes;
+    double start;
+
+    if (min_line < 1 || max_line < min_line || lines < 1)
+    {
+        fprintf(stderr, "Usage: %s [min_line] [max_line] [lines]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // lines of random length, written back to back
+    data = malloc(max_line * 1024);
+    sizes = malloc(1024 * sizeof(size_t));
+    if (data == NULL || sizes == NULL)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    srand(1);
+    for (int i = 0; i < 1024; i++)
+    {
+        sizes[i] = min_line + rand() % (max_line - min_line + 1);
+        memset(data + i * max_line, 'a' + i % 26, sizes[i] - 1);
+        data[i * max_line + sizes[i] - 1] = '\n';
+    }
+
+    aesd_circular_buffer_init(&allocated);
+    start = now_ns();
+    for (size_t i = 0; i < lines; i++)
+    {
+        struct aesd_buffer_entry line;
+        char *copy = malloc(sizes[i % 1024]);
+
+        if (copy == NULL)
+        {
+            perror("malloc");
+            return EXIT_FAILURE;
+        }
+        memcpy(copy, data + (i % 1024) * max_line, sizes[i % 1024]);
+        if (allocated.full)
+        {
+            free((char *) allocated.entry[allocated.out_offs].buffptr);
+        }
+        line.buffptr = copy;
+        line.size = sizes[i % 1024];
+        aesd_circular_buffer_add_entry(&allocated, &line);
+    }
+    double allocated_add = (now_ns() - start) / lines;
+
+    aesd_circular_buffer_init(&copied);
+    start = now_ns();
+    for (size_t i = 0; i < lines; i++)
+    {
+        if (aesd_circular_buffer_add_copy(&copied, data + (i % 1024) * max_line, sizes[i % 1024]) != 0)
+        {
+            fprintf(stderr, "Error: aesd_circular_buffer_add_copy failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+    double copied_add = (now_ns() - start) / lines;
+
+    printf("history %d, lines of %zu-%zu bytes\n", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, min_line, max_line);
+    printf("malloc per line   add %6.1f ns/line   read %5.2f ns/byte (entry walk %5.2f ns/byte)\n",
+           allocated_add, read_history(&allocated, false), read_history(&allocated, true));
+    printf("buffer storage    add %6.1f ns/line   read %5.2f ns/byte (entry walk %5.2f ns/byte)\n",
+           copied_add, read_history(&copied, false), read_history(&copied, true));
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &allocated, index)
+    {
+        free((char *) entry->buffptr);
+    }
+    aesd_circular_buffer_free(&copied);
+    free(sizes);
+    free(data);
+    return EXIT_SUCCESS;
+}
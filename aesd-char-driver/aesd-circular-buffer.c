@@ -9,13 +9,27 @@
  */
 
 #ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/slab.h>
 #include <linux/string.h>
 #else
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+
+#define GFP_KERNEL 0
+#define kmalloc(size, flags) malloc(size)
+#define kfree(ptr) free(ptr)
 #endif
 
 #include "aesd-circular-buffer.h"
 
+/* smallest byte ring allocated for long entries */
+#define AESD_RING_MIN_CAPACITY 1024
+/* entries in the byte ring start as aligned as kmalloc()ed ones, copies out of them are faster */
+#define AESD_RING_ALIGN 16
+#define ring_space(size) (((size) + AESD_RING_ALIGN - 1) & ~(size_t) (AESD_RING_ALIGN - 1))
+
 /**
  * @param buffer the buffer to search for corresponding offset.  Any necessary locking must be performed by caller.
  * @param char_offset the position to search for in the buffer list, describing the zero referenced
@@ -30,29 +44,209 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
     size_t cumulative_offset = 0;
-    uint8_t idx = buffer->out_offs;
+    uint8_t idx;
 
     if (buffer == NULL || entry_offset_byte_rtn == NULL)
     {
         return NULL;
     }
 
+    // only walks the dense size array, the entry itself is touched once found
+    idx = buffer->out_offs;
     do
     {
-        struct aesd_buffer_entry *entry = &buffer->entry[idx];
-        if (cumulative_offset + entry->size > char_offset)
+        size_t size = buffer->size[idx];
+        if (cumulative_offset + size > char_offset)
         {
             *entry_offset_byte_rtn = char_offset - cumulative_offset;
-            return entry;
+            return &buffer->entry[idx];
         }
 
-        cumulative_offset += entry->size;
+        cumulative_offset += size;
         idx = (idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
     } while (idx != buffer->in_offs);
 
     return NULL;
 }
 
+/**
+ * @param buffer the buffer to search.  Any necessary locking must be performed by caller.
+ * @param time_ns the ingest time to search for, see ingest_ns in struct aesd_circular_buffer
+ * @return the zero referenced write command of the oldest entry added at or after time_ns, the number
+ *      of entries in the buffer if there is none
+ */
+uint8_t aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer, uint64_t time_ns)
+{
+    uint8_t low = 0, high;
+
+    high = buffer->full ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+                        : (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs) %
+                                  AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+    // binary search over the entries in the order they were added
+    while (low < high)
+    {
+        uint8_t mid = low + (high - low) / 2;
+        if (buffer->ingest_ns[(buffer->out_offs + mid) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED] < time_ns)
+        {
+            low = mid + 1;
+        } else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Space for size bytes at the end of the byte ring, or at its beginning if the
+ * end is taken. Entries leave the ring in the order they were added, so the
+ * free space is always between ring_end and ring_start.
+ * @return the offset of the space, or -1 when it does not fit
+ */
+static long ring_reserve(struct aesd_circular_buffer *buffer, size_t size)
+{
+    size_t offset;
+
+    size = ring_space(size);
+    if (buffer->ring_entries == 0)
+    {
+        buffer->ring_start = buffer->ring_end = 0;
+        buffer->ring_wrapped = false;
+    }
+
+    if (!buffer->ring_wrapped && buffer->ring_capacity - buffer->ring_end >= size)
+    {
+        offset = buffer->ring_end;
+    } else if (!buffer->ring_wrapped && buffer->ring_start >= size)
+    {
+        // the gap left at the end is reused once the ring unwraps
+        offset = 0;
+        buffer->ring_wrapped = true;
+    } else if (buffer->ring_wrapped && buffer->ring_start - buffer->ring_end >= size)
+    {
+        offset = buffer->ring_end;
+    } else
+    {
+        return -1;
+    }
+
+    buffer->ring_end = offset + size;
+    buffer->ring_entries++;
+    return offset;
+}
+
+/*
+ * Releases the byte ring space of the oldest entry in the ring
+ */
+static void ring_release(struct aesd_circular_buffer *buffer, size_t offset, size_t size)
+{
+    if (--buffer->ring_entries == 0)
+    {
+        buffer->ring_start = buffer->ring_end = 0;
+        buffer->ring_wrapped = false;
+        return;
+    }
+
+    if (offset < buffer->ring_start)
+    {
+        // the oldest entry is at the beginning again
+        buffer->ring_wrapped = false;
+    }
+    buffer->ring_start = offset + ring_space(size);
+}
+
+/*
+ * Moves the byte ring to a larger allocation with room for another size bytes,
+ * packing the entries at its beginning. Nothing changes if the allocation fails.
+ */
+static int ring_grow(struct aesd_circular_buffer *buffer, size_t size)
+{
+    size_t used = 0, capacity, offset = 0;
+    uint8_t idx;
+    char *ring;
+
+    for (idx = 0; idx < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; idx++)
+    {
+        if (buffer->storage[idx] == AESD_ENTRY_RING)
+        {
+            used += ring_space(buffer->size[idx]);
+        }
+    }
+
+    capacity = buffer->ring_capacity * 2;
+    if (capacity < used + ring_space(size))
+    {
+        capacity = used + ring_space(size);
+    }
+    if (capacity < AESD_RING_MIN_CAPACITY)
+    {
+        capacity = AESD_RING_MIN_CAPACITY;
+    }
+
+    ring = kmalloc(capacity, GFP_KERNEL);
+    if (ring == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    // oldest first, so the entries keep leaving the ring in order
+    idx = buffer->out_offs;
+    do
+    {
+        if (buffer->storage[idx] == AESD_ENTRY_RING)
+        {
+            memcpy(ring + offset, buffer->ring + buffer->ring_offset[idx], buffer->size[idx]);
+            buffer->ring_offset[idx] = offset;
+            buffer->entry[idx].buffptr = ring + offset;
+            offset += ring_space(buffer->size[idx]);
+        }
+        idx = (idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    } while (idx != buffer->out_offs);
+
+    kfree(buffer->ring);
+    buffer->ring = ring;
+    buffer->ring_capacity = capacity;
+    buffer->ring_start = 0;
+    buffer->ring_end = offset;
+    buffer->ring_wrapped = false;
+    return 0;
+}
+
+/*
+ * Gives up the buffer owned memory of the entry at idx
+ */
+static void release_entry(struct aesd_circular_buffer *buffer, uint8_t idx)
+{
+    if (buffer->storage[idx] == AESD_ENTRY_RING)
+    {
+        ring_release(buffer, buffer->ring_offset[idx], buffer->size[idx]);
+    }
+    buffer->storage[idx] = AESD_ENTRY_EXTERNAL;
+}
+
+/*
+ * Stores @param add_entry at buffer->in_offs and advances the offsets, the
+ * overwritten entry's memory must already be released
+ */
+static void store_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
+{
+    buffer->entry[buffer->in_offs] = *add_entry;
+    buffer->size[buffer->in_offs] = add_entry->size;
+
+    if (buffer->full)
+    {
+        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+
+    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+    if (buffer->in_offs == buffer->out_offs)
+    {
+        buffer->full = true;
+    }
+}
+
 /**
 * Adds entry @param add_entry to @param buffer in the location specified in buffer->in_offs.
 * If the buffer was already full, overwrites the oldest entry and advances buffer->out_offs to the
@@ -67,19 +261,77 @@ void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const s
         return;
     }
 
-    buffer->entry[buffer->in_offs] = *add_entry;
-
     if (buffer->full)
     {
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        release_entry(buffer, buffer->in_offs);
     }
+    store_entry(buffer, add_entry);
+}
 
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+/**
+* Adds a copy of the @param size bytes at @param data to @param buffer, like aesd_circular_buffer_add_entry().
+* The copy is owned by the buffer: entries up to AESD_INLINE_ENTRY_SIZE bytes are kept in their slot, longer
+* ones in the buffer's byte ring, which grows as needed. An overwritten entry added with
+* aesd_circular_buffer_add_entry() is still the caller's to free.
+* Any necessary locking must be handled by the caller
+* @return 0, or -ENOMEM if the byte ring could not grow, the buffer is unchanged then
+*/
+int aesd_circular_buffer_add_copy(struct aesd_circular_buffer *buffer, const char *data, size_t size)
+{
+    struct aesd_buffer_entry add_entry;
+    uint8_t idx;
 
-    if (buffer->in_offs == buffer->out_offs)
+    if (buffer == NULL || (data == NULL && size > 0))
     {
-        buffer->full = true;
+        return -EINVAL;
+    }
+
+    idx = buffer->in_offs;
+    if (size <= AESD_INLINE_ENTRY_SIZE)
+    {
+        if (buffer->full)
+        {
+            release_entry(buffer, idx);
+        }
+        memcpy(buffer->inline_data[idx], data, size);
+        buffer->storage[idx] = AESD_ENTRY_INLINE;
+        add_entry.buffptr = buffer->inline_data[idx];
+    } else
+    {
+        // the overwritten entry makes room first, it is restored if the ring cannot grow
+        uint8_t evicted_storage = buffer->storage[idx];
+        size_t ring_start = buffer->ring_start, ring_end = buffer->ring_end;
+        bool ring_wrapped = buffer->ring_wrapped;
+        uint8_t ring_entries = buffer->ring_entries;
+        long offset;
+
+        if (buffer->full)
+        {
+            release_entry(buffer, idx);
+        }
+        offset = ring_reserve(buffer, size);
+        if (offset < 0)
+        {
+            if (ring_grow(buffer, size) != 0)
+            {
+                buffer->storage[idx] = evicted_storage;
+                buffer->ring_start = ring_start;
+                buffer->ring_end = ring_end;
+                buffer->ring_wrapped = ring_wrapped;
+                buffer->ring_entries = ring_entries;
+                return -ENOMEM;
+            }
+            offset = ring_reserve(buffer, size);
+        }
+        memcpy(buffer->ring + offset, data, size);
+        buffer->storage[idx] = AESD_ENTRY_RING;
+        buffer->ring_offset[idx] = offset;
+        add_entry.buffptr = buffer->ring + offset;
     }
+
+    add_entry.size = size;
+    store_entry(buffer, &add_entry);
+    return 0;
 }
 
 /**
@@ -89,3 +341,13 @@ void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
 }
+
+/**
+* Frees the memory the buffer owns for entries added with aesd_circular_buffer_add_copy() and
+* empties @param buffer. Entries added with aesd_circular_buffer_add_entry() are the caller's to free.
+*/
+void aesd_circular_buffer_free(struct aesd_circular_buffer *buffer)
+{
+    kfree(buffer->ring);
+    aesd_circular_buffer_init(buffer);
+}
@@ -16,7 +16,13 @@
 #include <stdbool.h>
 #endif
 
+/*
+ * The assignment tests expect 10, larger histories (up to 255, the offsets are
+ * uint8_t) can be built with HISTORY=n, e.g. together with compressed storage
+ */
+#ifndef AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+#endif
 
 struct aesd_buffer_entry
 {
@@ -30,6 +36,20 @@ struct aesd_buffer_entry
     size_t size;
 };
 
+/*
+ * Entries added with aesd_circular_buffer_add_copy() are copied into memory
+ * owned by the buffer: up to AESD_INLINE_ENTRY_SIZE bytes into the entry's
+ * own slot, longer ones into a byte ring shared by all entries.
+ */
+#define AESD_INLINE_ENTRY_SIZE 48
+
+enum aesd_entry_storage
+{
+    AESD_ENTRY_EXTERNAL = 0, // buffptr is managed by the caller, aesd_circular_buffer_add_entry()
+    AESD_ENTRY_INLINE,       // buffptr points into inline_data[] of the entry's slot
+    AESD_ENTRY_RING,         // buffptr points into ring at ring_offset[] of the entry's slot
+};
+
 struct aesd_circular_buffer
 {
     /**
@@ -49,15 +69,55 @@ struct aesd_circular_buffer
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Dense copy of entry[].size, the only thing looking up a position touches
+     */
+    size_t size[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * When each entry was added, in ns of the monotonic clock. Set by the
+     * caller after adding an entry, never decreasing from out_offs on.
+     */
+    uint64_t ingest_ns[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * enum aesd_entry_storage of each entry
+     */
+    uint8_t storage[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * Offset in ring of each AESD_ENTRY_RING entry
+     */
+    size_t ring_offset[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * Data of entries longer than AESD_INLINE_ENTRY_SIZE, kept contiguous and in
+     * the order they were added. ring_start is the oldest entry, ring_end is
+     * where the next one goes, ring_wrapped is set while newer entries
+     * continue from the beginning of ring.
+     */
+    char *ring;
+    size_t ring_capacity;
+    size_t ring_start;
+    size_t ring_end;
+    bool ring_wrapped;
+    uint8_t ring_entries;
+    /**
+     * Data of entries up to AESD_INLINE_ENTRY_SIZE bytes, the buffer must not be
+     * copied once entries point in here
+     */
+    char inline_data[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED][AESD_INLINE_ENTRY_SIZE] __attribute__((aligned(64)));
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern uint8_t aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer, uint64_t time_ns);
+
 extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern int aesd_circular_buffer_add_copy(struct aesd_circular_buffer *buffer, const char *data, size_t size);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern void aesd_circular_buffer_free(struct aesd_circular_buffer *buffer);
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
@@ -0,0 +1,250 @@
+/**
+ * @file aesd-ring-bench.c
+ * @brief Throughput of handing aesd_buffer_entry structs between threads
+ *
+ * Compares the circular buffer behind a pthread mutex with the lock-free
+ * rings in aesd-ring.c. Producers push numbered entries, one consumer pops
+ * them and checks that every producer's entries arrive complete and in order.
+ *
+ * Usage: aesd-ring-bench [-m mutex|spsc|mpsc] [-p producers] [-b batch] [-n entries_per_producer]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aesd-ring.h"
+
+#define MAX_PRODUCERS 64
+#define MAX_BATCH 64
+
+enum mode
+{
+    MODE_MUTEX,
+    MODE_SPSC,
+    MODE_MPSC,
+};
+
+static const char *const mode_names[] = {"mutex", "spsc", "mpsc"};
+
+static struct
+{
+    enum mode mode;
+    int producers;
+    size_t batch;
+    size_t entries;
+
+    pthread_mutex_t lock;
+    struct aesd_circular_buffer buffer;
+    struct aesd_spsc_ring spsc;
+    struct aesd_mpsc_ring mpsc;
+} bench;
+
+/*
+ * The circular buffer has no way to take entries out, the consumer advances
+ * out_offs itself like a reader that frees what it has read
+ */
+static size_t mutex_push_batch(const struct aesd_buffer_entry *entries, size_t count)
+{
+    size_t pushed = 0;
+
+    pthread_mutex_lock(&bench.lock);
+    while (pushed < count && !bench.buffer.full)
+    {
+        aesd_circular_buffer_add_entry(&bench.buffer, &entries[pushed++]);
+    }
+    pthread_mutex_unlock(&bench.lock);
+    return pushed;
+}
+
+static size_t mutex_pop_batch(struct aesd_buffer_entry *entries, size_t count)
+{
+    size_t popped = 0;
+
+    pthread_mutex_lock(&bench.lock);
+    while (popped < count && (bench.buffer.full || bench.buffer.in_offs != bench.buffer.out_offs))
+    {
+        entries[popped++] = bench.buffer.entry[bench.buffer.out_offs];
+        bench.buffer.out_offs = (bench.buffer.out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        bench.buffer.full = false;
+    }
+    pthread_mutex_unlock(&bench.lock);
+    return popped;
+}
+
+static size_t push_batch(const struct aesd_buffer_entry *entries, size_t count)
+{
+    switch (bench.mode)
+    {
+        case MODE_SPSC:
+            return aesd_spsc_ring_push_batch(&bench.spsc, entries, count);
+        case MODE_MPSC:
+            return aesd_mpsc_ring_push_batch(&bench.mpsc, entries, count);
+        default:
+            return mutex_push_batch(entries, count);
+    }
+}
+
+static size_t pop_batch(struct aesd_buffer_entry *entries, size_t count)
+{
+    switch (bench.mode)
+    {
+        case MODE_SPSC:
+            return aesd_spsc_ring_pop_batch(&bench.spsc, entries, count);
+        case MODE_MPSC:
+            return aesd_mpsc_ring_pop_batch(&bench.mpsc, entries, count);
+        default:
+            return mutex_pop_batch(entries, count);
+    }
+}
+
+/*
+ * entry i of producer p is {.buffptr = p, .size = i + 1}
+ */
+static void *producer_thread(void *arg)
+{
+    struct aesd_buffer_entry entries[MAX_BATCH];
+    size_t next = 0;
+
+    while (next < bench.entries)
+    {
+        size_t count = bench.entries - next < bench.batch ? bench.entries - next : bench.batch;
+        for (size_t i = 0; i < count; i++)
+        {
+            entries[i].buffptr = arg;
+            entries[i].size = next + i + 1;
+        }
+
+        size_t pushed = 0;
+        while (pushed < count)
+        {
+            size_t n = push_batch(entries + pushed, count - pushed);
+            if (n == 0)
+            {
+                sched_yield();
+            }
+            pushed += n;
+        }
+        next += count;
+    }
+    return NULL;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-m mutex|spsc|mpsc] [-p producers] [-b batch] [-n entries_per_producer]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t producers[MAX_PRODUCERS];
+    size_t last[MAX_PRODUCERS] = {0};
+    struct aesd_buffer_entry entries[MAX_BATCH];
+    int opt;
+
+    bench.mode = MODE_SPSC;
+    bench.producers = 1;
+    bench.batch = 1;
+    bench.entries = 10000000;
+    while ((opt = getopt(argc, argv, "m:p:b:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                if (strcmp(optarg, "mutex") == 0)
+                {
+                    bench.mode = MODE_MUTEX;
+                } else if (strcmp(optarg, "spsc") == 0)
+                {
+                    bench.mode = MODE_SPSC;
+                } else if (strcmp(optarg, "mpsc") == 0)
+                {
+                    bench.mode = MODE_MPSC;
+                } else
+                {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                bench.producers = atoi(optarg);
+                break;
+            case 'b':
+                bench.batch = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                bench.entries = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (bench.producers < 1 || bench.producers > MAX_PRODUCERS || (bench.mode == MODE_SPSC && bench.producers != 1) ||
+        bench.batch < 1 || bench.batch > MAX_BATCH || bench.entries < 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_init(&bench.lock, NULL);
+    aesd_circular_buffer_init(&bench.buffer);
+    aesd_spsc_ring_init(&bench.spsc);
+    aesd_mpsc_ring_init(&bench.mpsc);
+
+    double start = now_s();
+    for (int p = 0; p < bench.producers; p++)
+    {
+        // the producer index doubles as the entry's buffptr
+        if (pthread_create(&producers[p], NULL, producer_thread, (void *) (size_t) p) != 0)
+        {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t remaining = bench.entries * bench.producers;
+    while (remaining > 0)
+    {
+        size_t n = pop_batch(entries, bench.batch);
+        if (n == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t p = (size_t) entries[i].buffptr;
+            if (p >= (size_t) bench.producers || entries[i].size != last[p] + 1)
+            {
+                fprintf(stderr, "Error: producer %zu entry %zu arrived after %zu\n", p, entries[i].size,
+                        p < (size_t) bench.producers ? last[p] : 0);
+                return EXIT_FAILURE;
+            }
+            last[p] = entries[i].size;
+        }
+        remaining -= n;
+    }
+    double elapsed = now_s() - start;
+
+    for (int p = 0; p < bench.producers; p++)
+    {
+        pthread_join(producers[p], NULL);
+    }
+
+    size_t capacity = bench.mode == MODE_MUTEX ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : AESD_RING_ENTRIES;
+    printf("%-5s %2d producers, batch %2zu, %3zu entries: %7.2f M entries/s\n", mode_names[bench.mode],
+           bench.producers, bench.batch, capacity, bench.entries * bench.producers / elapsed / 1e6);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file aesd-ring.c
+ * @brief Lock-free single and multiple producer rings of aesd_buffer_entry
+ *
+ * Positions only ever grow, the slot of a position is position & (AESD_RING_ENTRIES - 1)
+ * and head - tail is the number of entries in the ring.
+ */
+
+#include <string.h>
+
+#include "aesd-ring.h"
+
+#define AESD_RING_MASK (AESD_RING_ENTRIES - 1)
+
+/**
+* Initializes the ring described by @param ring to an empty struct
+*/
+void aesd_spsc_ring_init(struct aesd_spsc_ring *ring)
+{
+    memset(ring, 0, sizeof(struct aesd_spsc_ring));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+/**
+* Copies up to @param count entries from @param entries into @param ring and publishes them at once.
+* Must only be called from the producer thread.
+* Any memory referenced by the entries passes to the consumer, its lifetime is managed by the caller.
+* @return the number of entries pushed, less than count when the ring is full
+*/
+size_t aesd_spsc_ring_push_batch(struct aesd_spsc_ring *ring, const struct aesd_buffer_entry *entries,
+            size_t count)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t space = AESD_RING_ENTRIES - (head - ring->tail_cache);
+
+    if (space < count)
+    {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        space = AESD_RING_ENTRIES - (head - ring->tail_cache);
+    }
+    if (count > space)
+    {
+        count = space;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ring->entry[(head + i) & AESD_RING_MASK] = entries[i];
+    }
+    if (count > 0)
+    {
+        atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    }
+    return count;
+}
+
+/**
+* Moves up to @param count of the oldest entries of @param ring to @param entries.
+* Must only be called from the consumer thread.
+* @return the number of entries popped, 0 when the ring is empty
+*/
+size_t aesd_spsc_ring_pop_batch(struct aesd_spsc_ring *ring, struct aesd_buffer_entry *entries,
+            size_t count)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t available = ring->head_cache - tail;
+
+    if (available < count)
+    {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        available = ring->head_cache - tail;
+    }
+    if (count > available)
+    {
+        count = available;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        entries[i] = ring->entry[(tail + i) & AESD_RING_MASK];
+    }
+    if (count > 0)
+    {
+        atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    }
+    return count;
+}
+
+/**
+* Initializes the ring described by @param ring to an empty struct
+*/
+void aesd_mpsc_ring_init(struct aesd_mpsc_ring *ring)
+{
+    memset(ring, 0, sizeof(struct aesd_mpsc_ring));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    for (size_t i = 0; i < AESD_RING_ENTRIES; i++)
+    {
+        atomic_init(&ring->slot[i].sequence, 0);
+    }
+}
+
+/**
+* Claims up to @param count consecutive positions in @param ring with a single compare and swap,
+* then copies @param entries into them and publishes each slot.
+* Safe to call from any number of producer threads.
+* @return the number of entries pushed, less than count when the ring is full
+*/
+size_t aesd_mpsc_ring_push_batch(struct aesd_mpsc_ring *ring, const struct aesd_buffer_entry *entries,
+            size_t count)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t claimed;
+
+    for (;;)
+    {
+        size_t used = head - atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (used > AESD_RING_ENTRIES)
+        {
+            // head is stale, the consumer is already past it
+            head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            continue;
+        }
+        claimed = count < AESD_RING_ENTRIES - used ? count : AESD_RING_ENTRIES - used;
+        if (claimed == 0)
+        {
+            return 0;
+        }
+        if (atomic_compare_exchange_weak_explicit(&ring->head, &head, head + claimed, memory_order_relaxed,
+                                                  memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < claimed; i++)
+    {
+        struct aesd_mpsc_slot *slot = &ring->slot[(head + i) & AESD_RING_MASK];
+        slot->entry = entries[i];
+        atomic_store_explicit(&slot->sequence, head + i + 1, memory_order_release);
+    }
+    return claimed;
+}
+
+/**
+* Moves up to @param count of the oldest published entries of @param ring to @param entries and
+* releases their slots to the producers at once.
+* Must only be called from the consumer thread.
+* @return the number of entries popped, 0 when the ring is empty or the oldest claimed slot is not
+* published yet
+*/
+size_t aesd_mpsc_ring_pop_batch(struct aesd_mpsc_ring *ring, struct aesd_buffer_entry *entries,
+            size_t count)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t popped = 0;
+
+    while (popped < count)
+    {
+        struct aesd_mpsc_slot *slot = &ring->slot[(tail + popped) & AESD_RING_MASK];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != tail + popped + 1)
+        {
+            break;
+        }
+        entries[popped++] = slot->entry;
+    }
+    if (popped > 0)
+    {
+        atomic_store_explicit(&ring->tail, tail + popped, memory_order_release);
+    }
+    return popped;
+}
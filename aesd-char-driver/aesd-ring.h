@@ -0,0 +1,132 @@
+/*
+ * aesd-ring.h
+ *
+ * Lock-free user space rings of struct aesd_buffer_entry, companions to
+ * aesd-circular-buffer.h for callers that would otherwise wrap the circular
+ * buffer in a mutex to hand entries from one thread to another.
+ */
+
+#ifndef AESD_RING_H
+#define AESD_RING_H
+
+#ifdef __KERNEL__
+#error "aesd-ring.h uses C11 atomics and is only available in user space"
+#endif
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "aesd-circular-buffer.h"
+
+/*
+ * Entries per ring, must be a power of two. Unlike the circular buffer a ring
+ * never overwrites entries the consumer has not taken yet, pushing into a full
+ * ring fails and the caller decides whether to retry or drop.
+ */
+#ifndef AESD_RING_ENTRIES
+#define AESD_RING_ENTRIES 256
+#endif
+
+#if AESD_RING_ENTRIES & (AESD_RING_ENTRIES - 1)
+#error "AESD_RING_ENTRIES must be a power of two"
+#endif
+
+#define AESD_RING_CACHELINE 64
+
+/**
+ * Single producer, single consumer ring. Push and pop are wait-free: each
+ * index is written by one side only and read by the other, each side keeps a
+ * cached copy of the other's index so the shared cache line is only read
+ * when the cached copy says the ring looks full (or empty).
+ */
+struct aesd_spsc_ring
+{
+    /**
+     * Next position the producer writes, only written by the producer
+     */
+    _Alignas(AESD_RING_CACHELINE) atomic_size_t head;
+    /**
+     * The producer's last view of tail
+     */
+    size_t tail_cache;
+    /**
+     * Next position the consumer reads, only written by the consumer
+     */
+    _Alignas(AESD_RING_CACHELINE) atomic_size_t tail;
+    /**
+     * The consumer's last view of head
+     */
+    size_t head_cache;
+    _Alignas(AESD_RING_CACHELINE) struct aesd_buffer_entry entry[AESD_RING_ENTRIES];
+};
+
+struct aesd_mpsc_slot
+{
+    /**
+     * position + 1 once the entry for position is published
+     */
+    atomic_size_t sequence;
+    struct aesd_buffer_entry entry;
+};
+
+/**
+ * Multiple producer, single consumer ring. Producers claim positions with a
+ * compare and swap on head, a batch claims all of its positions at once, and
+ * publish each slot by storing its sequence. The consumer takes published
+ * slots in order and releases them by advancing tail.
+ *
+ * Push is lock-free. A producer that is preempted between claiming and
+ * publishing holds back the consumer at that slot until it resumes, the
+ * consumer sees the ring as empty meanwhile.
+ */
+struct aesd_mpsc_ring
+{
+    /**
+     * Next position to claim, advanced by producers
+     */
+    _Alignas(AESD_RING_CACHELINE) atomic_size_t head;
+    /**
+     * Next position the consumer reads, only written by the consumer
+     */
+    _Alignas(AESD_RING_CACHELINE) atomic_size_t tail;
+    _Alignas(AESD_RING_CACHELINE) struct aesd_mpsc_slot slot[AESD_RING_ENTRIES];
+};
+
+extern void aesd_spsc_ring_init(struct aesd_spsc_ring *ring);
+
+extern size_t aesd_spsc_ring_push_batch(struct aesd_spsc_ring *ring, const struct aesd_buffer_entry *entries,
+            size_t count);
+
+extern size_t aesd_spsc_ring_pop_batch(struct aesd_spsc_ring *ring, struct aesd_buffer_entry *entries,
+            size_t count);
+
+extern void aesd_mpsc_ring_init(struct aesd_mpsc_ring *ring);
+
+extern size_t aesd_mpsc_ring_push_batch(struct aesd_mpsc_ring *ring, const struct aesd_buffer_entry *entries,
+            size_t count);
+
+extern size_t aesd_mpsc_ring_pop_batch(struct aesd_mpsc_ring *ring, struct aesd_buffer_entry *entries,
+            size_t count);
+
+static inline bool aesd_spsc_ring_push(struct aesd_spsc_ring *ring, const struct aesd_buffer_entry *entry)
+{
+    return aesd_spsc_ring_push_batch(ring, entry, 1) == 1;
+}
+
+static inline bool aesd_spsc_ring_pop(struct aesd_spsc_ring *ring, struct aesd_buffer_entry *entry)
+{
+    return aesd_spsc_ring_pop_batch(ring, entry, 1) == 1;
+}
+
+static inline bool aesd_mpsc_ring_push(struct aesd_mpsc_ring *ring, const struct aesd_buffer_entry *entry)
+{
+    return aesd_mpsc_ring_push_batch(ring, entry, 1) == 1;
+}
+
+static inline bool aesd_mpsc_ring_pop(struct aesd_mpsc_ring *ring, struct aesd_buffer_entry *entry)
+{
+    return aesd_mpsc_ring_pop_batch(ring, entry, 1) == 1;
+}
+
+#endif /* AESD_RING_H */
@@ -33,14 +33,52 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * lseek() carried over ioctl, for front ends that cannot forward lseek to the driver.
+ * CUSE (character device in user space) always reads at the position it tracks
+ * itself and treats lseek as a no-op, so the aesdchar-cuse daemon keeps the file
+ * position per open file and updates it through this command instead.
+ */
+struct aesd_llseek {
+    /**
+     * The offset to seek to, relative to whence. Replaced with the resulting position.
+     */
+    int64_t offset;
+    /**
+     * SEEK_SET, SEEK_CUR or SEEK_END
+     */
+    int32_t whence;
+    uint32_t reserved;
+};
+
+/**
+ * Positions the file at the oldest write ingested at or after a point in time,
+ * to replay what was written since then
+ */
+struct aesd_seektime {
+    /**
+     * ns of CLOCK_MONOTONIC (ktime_get_ns() in the kernel)
+     */
+    uint64_t time_ns;
+    /**
+     * Replaced with the zero referenced write command found, the number of
+     * writes in the history if all of them are older (the file is then at
+     * the end)
+     */
+    uint32_t write_cmd;
+    uint32_t reserved;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+#define AESDCHAR_IOCLLSEEK _IOWR(AESD_IOC_MAGIC, 2, struct aesd_llseek)
+#define AESDCHAR_IOCSEEKTIME _IOWR(AESD_IOC_MAGIC, 3, struct aesd_seektime)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 3
 
 #endif /* AESD_IOCTL_H */
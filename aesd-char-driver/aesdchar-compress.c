@@ -0,0 +1,220 @@
+/**
+ * @file aesdchar-compress.c
+ * @brief Compressed history storage for the AESD char driver
+ *
+ * Instead of one allocation per entry, entries are appended to an open block
+ * of about AESD_BLOCK_SIZE bytes. Once full the block is sealed and LZ4
+ * compressed as a whole, which is what makes short and repetitive log lines
+ * compress at all. A block is freed when the last entry pointing into it is
+ * evicted. Reads decompress the whole block into a small LRU cache, so reading
+ * the history in order decompresses each block once.
+ *
+ * @author flemingpatel
+ * @date 2026-10-19
+ *
+ */
+
+#include "aesdchar.h"
+
+int aesd_packed_init(struct aesd_dev *dev)
+{
+    memset(&dev->packed, 0, sizeof(dev->packed));
+
+    dev->packed.wrkmem = kmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+    if (!dev->packed.wrkmem)
+        return -ENOMEM;
+    return 0;
+}
+
+void aesd_packed_cleanup(struct aesd_dev *dev)
+{
+    uint8_t slot;
+
+    // every block is referenced by at least one entry
+    for (slot = 0; slot < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; slot++)
+        aesd_packed_evict(dev, slot);
+
+    kfree(dev->packed.wrkmem);
+    dev->packed.wrkmem = NULL;
+}
+
+static struct aesd_block *aesd_block_alloc(size_t capacity)
+{
+    struct aesd_block *block = kmalloc(sizeof(*block), GFP_KERNEL);
+    if (!block)
+        return NULL;
+
+    memset(block, 0, sizeof(*block));
+    block->data = kmalloc(capacity, GFP_KERNEL);
+    if (!block->data)
+    {
+        kfree(block);
+        return NULL;
+    }
+    return block;
+}
+
+/**
+ * compress a full block, it is left raw if that does not save anything or
+ * runs out of memory
+ */
+static void aesd_block_seal(struct aesd_dev *dev, struct aesd_block *block)
+{
+    struct aesd_packed_store *store = &dev->packed;
+    int bound = LZ4_compressBound(block->raw_size);
+    char *scratch = kmalloc(bound, GFP_KERNEL);
+    char *packed = NULL;
+    int packed_size = 0;
+
+    if (scratch)
+        packed_size = aesd_lz4_compress(block->data, scratch, block->raw_size, bound, store->wrkmem);
+
+    // copy to an exact size allocation, the bound is larger than the input
+    if (packed_size > 0 && packed_size < block->raw_size)
+        packed = kmalloc(packed_size, GFP_KERNEL);
+
+    if (packed)
+    {
+        memcpy(packed, scratch, packed_size);
+        kfree(block->data);
+        block->data = packed;
+        block->stored_size = packed_size;
+        block->compressed = true;
+    } else
+    {
+        block->stored_size = block->raw_size;
+    }
+    kfree(scratch);
+
+    store->raw_bytes += block->raw_size;
+    store->stored_bytes += block->stored_size;
+    store->open = NULL;
+}
+
+/**
+ * store the entry @param data of @param size bytes for circular buffer slot
+ * @param slot, replacing the entry it held before
+ * @return 0 on success, -ENOMEM with the previous entry left in place
+ */
+int aesd_packed_add(struct aesd_dev *dev, uint8_t slot, const char *data, size_t size)
+{
+    struct aesd_packed_store *store = &dev->packed;
+    struct aesd_block *block = store->open;
+
+    // allocate first so a failure does not lose the entry being replaced
+    if (!block || block->raw_size + size > AESD_BLOCK_SIZE)
+    {
+        block = aesd_block_alloc(max((size_t) AESD_BLOCK_SIZE, size));
+        if (!block)
+            return -ENOMEM;
+    }
+
+    // the new entry's reference, taken before the evict: the entry being
+    // replaced may hold the last one to the open block (HISTORY=1)
+    block->refs++;
+    aesd_packed_evict(dev, slot);
+
+    if (block != store->open)
+    {
+        if (store->open)
+            aesd_block_seal(dev, store->open);
+        store->open = block;
+    }
+
+    memcpy(block->data + block->raw_size, data, size);
+    store->refs[slot].block = block;
+    store->refs[slot].offset = block->raw_size;
+    block->raw_size += size;
+    block->stored_size = block->raw_size;
+    return 0;
+}
+
+void aesd_packed_evict(struct aesd_dev *dev, uint8_t slot)
+{
+    struct aesd_packed_store *store = &dev->packed;
+    struct aesd_block *block = store->refs[slot].block;
+    int i;
+
+    if (!block)
+        return;
+
+    store->refs[slot].block = NULL;
+    if (--block->refs)
+        return;
+
+    for (i = 0; i < AESD_BLOCK_CACHE_SIZE; i++)
+    {
+        if (store->cache[i].block == block)
+        {
+            kfree(store->cache[i].raw);
+            store->cache[i].raw = NULL;
+            store->cache[i].block = NULL;
+        }
+    }
+
+    if (block == store->open)
+    {
+        store->open = NULL;
+    } else
+    {
+        store->raw_bytes -= block->raw_size;
+        store->stored_bytes -= block->stored_size;
+    }
+    kfree(block->data);
+    kfree(block);
+}
+
+/**
+ * @return the raw data of the entry in circular buffer slot @param slot,
+ * valid until the next call with dev->lock held, NULL on failure
+ */
+const char *aesd_packed_entry(struct aesd_dev *dev, uint8_t slot)
+{
+    struct aesd_packed_store *store = &dev->packed;
+    struct aesd_block_ref *ref = &store->refs[slot];
+    struct aesd_block *block = ref->block;
+    struct aesd_block_cache_slot *victim = &store->cache[0];
+    uint64_t start;
+    char *raw;
+    int i;
+
+    if (!block)
+        return NULL;
+
+    if (!block->compressed)
+        return block->data + ref->offset;
+
+    for (i = 0; i < AESD_BLOCK_CACHE_SIZE; i++)
+    {
+        struct aesd_block_cache_slot *cached = &store->cache[i];
+
+        if (cached->block == block)
+        {
+            cached->last_used = ++store->tick;
+            aesd_stat_add(dev, block_cache_hits, 1);
+            return cached->raw + ref->offset;
+        }
+        if (cached->last_used < victim->last_used)
+            victim = cached;
+    }
+
+    start = ktime_get_ns();
+    raw = kmalloc(block->raw_size, GFP_KERNEL);
+    if (!raw)
+        return NULL;
+
+    if (LZ4_decompress_safe(block->data, raw, block->stored_size, block->raw_size) != block->raw_size)
+    {
+        kfree(raw);
+        return NULL;
+    }
+
+    kfree(victim->raw);
+    victim->block = block;
+    victim->raw = raw;
+    victim->last_used = ++store->tick;
+
+    aesd_stat_add(dev, block_decompressions, 1);
+    aesd_stat_add(dev, decompress_ns, ktime_get_ns() - start);
+    return raw + ref->offset;
+}
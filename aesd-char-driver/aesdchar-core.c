@@ -0,0 +1,570 @@
+/**
+ * @file aesdchar-core.c
+ * @brief Device logic of the AESD char driver, shared by the kernel module
+ * (main.c) and the CUSE daemon (aesdchar-cuse.c)
+ *
+ * Everything here only depends on the small kernel API subset that
+ * aesdchar.h provides in user space, so the same read/write/llseek/ioctl
+ * paths can be profiled with regular user space tools.
+ *
+ * @author flemingpatel
+ * @date 2026-10-19
+ *
+ */
+
+#include "aesd_ioctl.h"
+#include "aesdchar.h"
+
+/**
+ * @param compress keep the history in LZ4 compressed blocks, see aesdchar-compress.c
+ * @return 0 on success, -ENOMEM, or -EINVAL for compress without COMPRESS=y
+ */
+int aesd_dev_init(struct aesd_dev *dev, bool compress)
+{
+    int result;
+
+    memset(dev, 0, sizeof(struct aesd_dev));
+
+    dev->stats = alloc_percpu(struct aesd_stats);
+    if (!dev->stats)
+        return -ENOMEM;
+
+    dev->compress = compress;
+    if (compress && (result = aesd_packed_init(dev)))
+    {
+        free_percpu(dev->stats);
+        return result;
+    }
+
+    mutex_init(&dev->lock);
+    aesd_circular_buffer_init(&dev->buffer);
+    dev->partial_buffer = NULL;
+    dev->partial_size = 0;
+    return 0;
+}
+
+void aesd_dev_cleanup(struct aesd_dev *dev)
+{
+    mutex_lock(&dev->lock);
+
+    // free all entries in the circular buffer
+    if (dev->compress)
+    {
+        aesd_packed_cleanup(dev);
+    } else
+    {
+        aesd_circular_buffer_free(&dev->buffer);
+    }
+
+    // free a partial line left by a closed writer
+    if (dev->partial_buffer)
+        kfree(dev->partial_buffer);
+
+    mutex_unlock(&dev->lock);
+    free_percpu(dev->stats);
+}
+
+/**
+ * mutex_lock_interruptible() that accounts the time spent waiting for the lock
+ */
+static int aesd_dev_lock(struct aesd_dev *dev)
+{
+    uint64_t start;
+
+    // uncontended case does not pay for reading the clock
+    if (mutex_trylock(&dev->lock))
+        return 0;
+
+    start = ktime_get_ns();
+    if (mutex_lock_interruptible(&dev->lock))
+        return -ERESTARTSYS;
+
+    aesd_stat_add(dev, lock_contended, 1);
+    aesd_stat_add(dev, lock_wait_ns, ktime_get_ns() - start);
+    return 0;
+}
+
+ssize_t aesd_dev_read(struct aesd_dev *dev, char __user *buf, size_t count, loff_t *f_pos)
+{
+    ssize_t retval = 0;
+    struct aesd_buffer_entry *entry;
+    const char *data;
+    size_t offset_in_entry;
+    size_t bytes_to_copy;
+
+    PDEBUG("read %zu bytes with offset %lld", count, (long long) *f_pos);
+
+    if (aesd_dev_lock(dev))
+        return -ERESTARTSYS;
+
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &offset_in_entry);
+    if (!entry)
+    {
+        // no data available
+        retval = 0;
+        goto out;
+    }
+
+    data = entry->buffptr;
+    if (dev->compress)
+    {
+        data = aesd_packed_entry(dev, entry - dev->buffer.entry);
+        if (!data)
+        {
+            retval = -ENOMEM;
+            goto out;
+        }
+    }
+
+    bytes_to_copy = min(count, entry->size - offset_in_entry);
+    if (copy_to_user(buf, data + offset_in_entry, bytes_to_copy))
+    {
+        retval = -EFAULT;
+        goto out;
+    }
+
+    *f_pos += bytes_to_copy;
+    retval = bytes_to_copy;
+
+out:
+    mutex_unlock(&dev->lock);
+
+    if (retval >= 0)
+    {
+        aesd_stat_add(dev, reads, 1);
+        aesd_stat_add(dev, bytes_read, retval);
+    }
+    trace_aesdchar_read(*f_pos, count, retval);
+    return retval;
+}
+
+/**
+ * Adds one complete line to the history, must be called with dev->lock held
+ * @param ingest_ns when the line was added, read with the lock held so the
+ *      history stays in time order
+ */
+static int aesd_dev_commit(struct aesd_dev *dev, const char *line, size_t size, uint64_t ingest_ns)
+{
+    uint8_t slot = dev->buffer.in_offs;
+    bool evicting = dev->buffer.full;
+    size_t evicted_size = dev->buffer.size[dev->buffer.out_offs];
+    int ret;
+
+    if (dev->compress)
+    {
+        // the packed store copies the data and replaces the evicted entry
+        struct aesd_buffer_entry entry;
+
+        ret = aesd_packed_add(dev, dev->buffer.in_offs, line, size);
+        if (ret)
+            return ret;
+        entry.buffptr = (const char *) &dev->packed.refs[dev->buffer.in_offs];
+        entry.size = size;
+        aesd_circular_buffer_add_entry(&dev->buffer, &entry);
+    } else
+    {
+        // short lines are kept inline in the buffer, longer ones in its byte ring
+        ret = aesd_circular_buffer_add_copy(&dev->buffer, line, size);
+        if (ret)
+            return ret;
+    }
+    dev->buffer.ingest_ns[slot] = ingest_ns;
+
+    if (evicting)
+    {
+        aesd_stat_add(dev, evictions, 1);
+        aesd_stat_add(dev, evicted_bytes, evicted_size);
+        trace_aesdchar_evict(evicted_size);
+    }
+    return 0;
+}
+
+/**
+ * Sets the unterminated line of @param writer to its current one followed by
+ * the @param size bytes at @param data
+ */
+static int aesd_writer_append(struct aesd_dev *dev, struct aesd_writer *writer, const char *data, size_t size)
+{
+    if (writer->partial_size + size > writer->partial_capacity)
+    {
+        size_t capacity = max(writer->partial_capacity * 2, writer->partial_size + size);
+        char *grown = krealloc(writer->partial_buffer, capacity, GFP_KERNEL);
+
+        if (!grown)
+            return -ENOMEM;
+        writer->partial_buffer = grown;
+        writer->partial_capacity = capacity;
+    }
+
+    memcpy(writer->partial_buffer + writer->partial_size, data, size);
+    writer->partial_size += size;
+    aesd_stat_add(dev, partial_bytes, size);
+    return 0;
+}
+
+void aesd_writer_init(struct aesd_writer *writer)
+{
+    memset(writer, 0, sizeof(*writer));
+    mutex_init(&writer->lock);
+}
+
+/**
+ * Called when the file is closed. An unterminated line is left to the device,
+ * the next writer starting a line continues it, as if there was only one
+ * partial line per device.
+ */
+void aesd_writer_release(struct aesd_dev *dev, struct aesd_writer *writer)
+{
+    if (writer->partial_size > 0)
+    {
+        mutex_lock(&dev->lock);
+        if (!dev->partial_buffer)
+        {
+            dev->partial_buffer = writer->partial_buffer;
+            dev->partial_size = writer->partial_size;
+            writer->partial_buffer = NULL;
+        } else
+        {
+            char *grown = krealloc(dev->partial_buffer, dev->partial_size + writer->partial_size, GFP_KERNEL);
+
+            if (grown)
+            {
+                memcpy(grown + dev->partial_size, writer->partial_buffer, writer->partial_size);
+                dev->partial_buffer = grown;
+                dev->partial_size += writer->partial_size;
+            } else
+            {
+                aesd_stat_add(dev, partial_bytes, -writer->partial_size);
+            }
+        }
+        mutex_unlock(&dev->lock);
+    }
+
+    kfree(writer->partial_buffer);
+    writer->partial_buffer = NULL;
+    writer->partial_size = writer->partial_capacity = 0;
+}
+
+/*
+ * Takes over the unterminated line a closed writer left to the device
+ */
+static void aesd_writer_adopt(struct aesd_dev *dev, struct aesd_writer *writer)
+{
+    mutex_lock(&dev->lock);
+    if (dev->partial_buffer)
+    {
+        kfree(writer->partial_buffer);
+        writer->partial_buffer = dev->partial_buffer;
+        writer->partial_size = writer->partial_capacity = dev->partial_size;
+        dev->partial_buffer = NULL;
+        dev->partial_size = 0;
+    }
+    mutex_unlock(&dev->lock);
+}
+
+/**
+ * Writes are assembled into lines in @param writer, the per open file state,
+ * without the device lock. It is only taken once per write to add the complete
+ * lines, so writers on different files neither wait for each other's copies
+ * nor mix their unterminated lines.
+ * @return count, or less if a line could not be added after earlier ones were
+ */
+ssize_t aesd_dev_write(struct aesd_dev *dev, struct aesd_writer *writer, const char __user *buf, size_t count)
+{
+    ssize_t retval = count;
+    char *kbuf = NULL;
+    char *assembled = NULL;
+    const char *line;
+    char *newline_ptr;
+    size_t line_size;
+    size_t processed;
+    uint64_t ingest_ns;
+    int ret;
+
+    PDEBUG("write %zu bytes", count);
+
+    if (count == 0)
+        return 0;
+
+    if (mutex_lock_interruptible(&writer->lock))
+        return -ERESTARTSYS;
+
+    if (writer->partial_size == 0 && READ_ONCE(dev->partial_size) > 0)
+        aesd_writer_adopt(dev, writer);
+
+    kbuf = kmalloc(count, GFP_KERNEL);
+    if (!kbuf)
+    {
+        retval = -ENOMEM;
+        goto out_unlock;
+    }
+
+    if (copy_from_user(kbuf, buf, count))
+    {
+        retval = -EFAULT;
+        goto out_free;
+    }
+
+    newline_ptr = memchr(kbuf, '\n', count);
+    if (!newline_ptr)
+    {
+        // no newline; the whole write continues the partial line
+        ret = aesd_writer_append(dev, writer, kbuf, count);
+        if (ret)
+            retval = ret;
+        goto out_free;
+    }
+
+    // the first line continues the partial line, put it together first
+    line = kbuf;
+    line_size = newline_ptr - kbuf + 1;
+    if (writer->partial_size > 0)
+    {
+        assembled = kmalloc(writer->partial_size + line_size, GFP_KERNEL);
+        if (!assembled)
+        {
+            retval = -ENOMEM;
+            goto out_free;
+        }
+        memcpy(assembled, writer->partial_buffer, writer->partial_size);
+        memcpy(assembled + writer->partial_size, kbuf, line_size);
+        line = assembled;
+    }
+
+    if (aesd_dev_lock(dev))
+    {
+        retval = -ERESTARTSYS;
+        goto out_free;
+    }
+
+    // all lines of one write share the time it was added
+    ingest_ns = ktime_get_ns();
+    ret = aesd_dev_commit(dev, line, writer->partial_size + line_size, ingest_ns);
+    if (ret)
+    {
+        // the partial line is kept, nothing of this write was used
+        mutex_unlock(&dev->lock);
+        retval = ret;
+        goto out_free;
+    }
+    aesd_stat_add(dev, partial_bytes, -writer->partial_size);
+    writer->partial_size = 0;
+    processed = line_size;
+
+    // the remaining complete lines go straight from the copy of the write
+    while ((newline_ptr = memchr(kbuf + processed, '\n', count - processed)))
+    {
+        line_size = newline_ptr - (kbuf + processed) + 1;
+        ret = aesd_dev_commit(dev, kbuf + processed, line_size, ingest_ns);
+        if (ret)
+            break;
+        processed += line_size;
+    }
+    mutex_unlock(&dev->lock);
+
+    if (ret)
+    {
+        // short write, the caller retries from the line that failed
+        retval = processed;
+        goto out_free;
+    }
+
+    if (processed < count)
+    {
+        ret = aesd_writer_append(dev, writer, kbuf + processed, count - processed);
+        if (ret)
+            retval = processed;
+    }
+
+out_free:
+    kfree(assembled);
+    kfree(kbuf);
+out_unlock:
+    trace_aesdchar_write(count, writer->partial_size);
+    mutex_unlock(&writer->lock);
+
+    if (retval >= 0)
+    {
+        aesd_stat_add(dev, writes, 1);
+        aesd_stat_add(dev, bytes_written, retval);
+    }
+    return retval;
+}
+
+loff_t aesd_dev_llseek(struct aesd_dev *dev, loff_t f_pos, loff_t offset, int whence)
+{
+    loff_t new_pos;
+    struct aesd_buffer_entry *entry;
+    loff_t total_size = 0;
+    uint8_t i;
+
+    PDEBUG("llseek");
+
+    if (aesd_dev_lock(dev))
+        return -ERESTARTSYS;
+
+    // calculate total size of data in the cb
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->buffer, i)
+    {
+        total_size += entry->size;
+    }
+
+    switch (whence)
+    {
+        case SEEK_SET:
+            new_pos = offset;
+            break;
+        case SEEK_CUR:
+            new_pos = f_pos + offset;
+            break;
+        case SEEK_END:
+            new_pos = total_size + offset;
+            break;
+        default:
+            mutex_unlock(&dev->lock);
+            return -EINVAL;
+    }
+
+    if (new_pos < 0 || new_pos > total_size)
+    {
+        mutex_unlock(&dev->lock);
+        return -EINVAL;
+    }
+
+    mutex_unlock(&dev->lock);
+    return new_pos;
+}
+
+static long aesd_dev_seekto(struct aesd_dev *dev, const struct aesd_seekto *seekto, loff_t *f_pos)
+{
+    loff_t new_pos = 0;
+    int i;
+    struct aesd_buffer_entry *entry;
+    int count = 0;
+    int ret = 0;
+
+    if (aesd_dev_lock(dev))
+        return -ERESTARTSYS;
+
+    // calculate the new position based on write_cmd and write_cmd_offset
+    if (seekto->write_cmd >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    // calculate new_pos by iterating through the circular buffer
+    i = dev->buffer.out_offs;
+    new_pos = 0;
+
+    do
+    {
+        entry = &dev->buffer.entry[i];
+        if (entry->buffptr == NULL)
+            break;
+
+        if (count == seekto->write_cmd)
+        {
+            if (seekto->write_cmd_offset >= entry->size)
+            {
+                ret = -EINVAL;
+                goto out;
+            }
+            new_pos += seekto->write_cmd_offset;
+            break;
+        }
+
+        new_pos += entry->size;
+        i = (i + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        count++;
+    } while (i != dev->buffer.out_offs);
+
+    if (count != seekto->write_cmd)
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    *f_pos = new_pos;
+
+out:
+    mutex_unlock(&dev->lock);
+    return ret;
+}
+
+static long aesd_dev_seektime(struct aesd_dev *dev, struct aesd_seektime *seektime, loff_t *f_pos)
+{
+    loff_t new_pos = 0;
+    uint8_t write_cmd, i;
+
+    if (aesd_dev_lock(dev))
+        return -ERESTARTSYS;
+
+    // entries are added in time order, no need to walk all of them
+    write_cmd = aesd_circular_buffer_find_entry_for_time(&dev->buffer, seektime->time_ns);
+    for (i = 0; i < write_cmd; i++)
+        new_pos += dev->buffer.size[(dev->buffer.out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+
+    mutex_unlock(&dev->lock);
+
+    seektime->write_cmd = write_cmd;
+    *f_pos = new_pos;
+    return 0;
+}
+
+/**
+ * @param arg points to the ioctl argument, already copied into the caller's
+ *      address space. Results are written back to it for _IOR commands.
+ */
+long aesd_dev_ioctl(struct aesd_dev *dev, unsigned int cmd, void *arg, loff_t *f_pos)
+{
+    PDEBUG("ioctl");
+
+    switch (cmd)
+    {
+        case AESDCHAR_IOCSEEKTO:
+            return aesd_dev_seekto(dev, arg, f_pos);
+
+        case AESDCHAR_IOCLLSEEK:
+        {
+            struct aesd_llseek *llseek = arg;
+            loff_t new_pos = aesd_dev_llseek(dev, *f_pos, llseek->offset, llseek->whence);
+            if (new_pos < 0)
+                return new_pos;
+
+            *f_pos = new_pos;
+            llseek->offset = new_pos;
+            return 0;
+        }
+
+        case AESDCHAR_IOCSEEKTIME:
+            return aesd_dev_seektime(dev, arg, f_pos);
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+void aesd_dev_stats(struct aesd_dev *dev, struct aesd_stats *sum)
+{
+    int cpu;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu)
+    {
+        struct aesd_stats *stats = per_cpu_ptr(dev->stats, cpu);
+
+        sum->reads += stats->reads;
+        sum->writes += stats->writes;
+        sum->bytes_read += stats->bytes_read;
+        sum->bytes_written += stats->bytes_written;
+        sum->evictions += stats->evictions;
+        sum->evicted_bytes += stats->evicted_bytes;
+        sum->lock_contended += stats->lock_contended;
+        sum->lock_wait_ns += stats->lock_wait_ns;
+        sum->block_cache_hits += stats->block_cache_hits;
+        sum->block_decompressions += stats->block_decompressions;
+        sum->decompress_ns += stats->decompress_ns;
+        sum->partial_bytes += stats->partial_bytes;
+    }
+}
@@ -0,0 +1,192 @@
+/**
+ * @file aesdchar-cuse.c
+ * @brief AESD char driver as a CUSE (character device in user space) daemon
+ *
+ * Exposes the same device logic as the kernel module (aesdchar-core.c) on
+ * /dev/aesdchar through libfuse3, so the driver can be run, debugged and
+ * profiled without loading a module.
+ *
+ * CUSE always reads at offset 0 and does not forward lseek(), so the file
+ * position is kept per open file here. Clients that need to seek use the
+ * AESDCHAR_IOCLLSEEK ioctl, which works the same on the kernel module.
+ *
+ * @author flemingpatel
+ * @date 2026-10-19
+ *
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include <cuse_lowlevel.h>
+#include <fuse_opt.h>
+
+#include "aesd_ioctl.h"
+#include "aesdchar.h"
+
+static struct aesd_dev aesd_device;
+
+/**
+ * per open file state, stored in fuse_file_info::fh
+ */
+struct aesd_cuse_file
+{
+    loff_t f_pos;
+    struct aesd_writer writer;
+};
+
+static struct aesd_cuse_file *cuse_file(struct fuse_file_info *fi)
+{
+    return (struct aesd_cuse_file *) (uintptr_t) fi->fh;
+}
+
+static void aesd_cuse_open(fuse_req_t req, struct fuse_file_info *fi)
+{
+    struct aesd_cuse_file *file;
+    PDEBUG("open");
+
+    file = calloc(1, sizeof(*file));
+    if (!file)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    aesd_writer_init(&file->writer);
+
+    fi->fh = (uintptr_t) file;
+    fi->direct_io = 1;
+    fi->nonseekable = 1;
+    fuse_reply_open(req, fi);
+}
+
+static void aesd_cuse_release(fuse_req_t req, struct fuse_file_info *fi)
+{
+    PDEBUG("release");
+    aesd_writer_release(&aesd_device, &cuse_file(fi)->writer);
+    free(cuse_file(fi));
+    fuse_reply_err(req, 0);
+}
+
+static void aesd_cuse_read(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    struct aesd_cuse_file *file = cuse_file(fi);
+    ssize_t retval;
+    char *buf;
+
+    // off is always 0 for CUSE, read from our own position instead
+    buf = malloc(size ? size : 1);
+    if (!buf)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    retval = aesd_dev_read(&aesd_device, buf, size, &file->f_pos);
+    if (retval < 0)
+        fuse_reply_err(req, -retval);
+    else
+        fuse_reply_buf(req, buf, retval);
+    free(buf);
+}
+
+static void aesd_cuse_write(fuse_req_t req, const char *buf, size_t size, off_t off,
+                            struct fuse_file_info *fi)
+{
+    ssize_t retval = aesd_dev_write(&aesd_device, &cuse_file(fi)->writer, buf, size);
+
+    if (retval < 0)
+        fuse_reply_err(req, -retval);
+    else
+        fuse_reply_write(req, retval);
+}
+
+static void aesd_cuse_ioctl(fuse_req_t req, int cmd, void *arg, struct fuse_file_info *fi,
+                            unsigned int flags, const void *in_buf, size_t in_bufsz, size_t out_bufsz)
+{
+    union {
+        struct aesd_seekto seekto;
+        struct aesd_llseek llseek;
+        struct aesd_seektime seektime;
+    } karg;
+    long ret;
+
+    if (flags & FUSE_IOCTL_COMPAT)
+    {
+        fuse_reply_err(req, ENOSYS);
+        return;
+    }
+
+    // the kernel already copied in _IOC_SIZE(cmd) bytes for our _IOWR commands
+    if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC || _IOC_NR(cmd) > AESDCHAR_IOC_MAXNR ||
+        _IOC_SIZE(cmd) > sizeof(karg) || in_bufsz < _IOC_SIZE(cmd))
+    {
+        fuse_reply_err(req, ENOTTY);
+        return;
+    }
+    memcpy(&karg, in_buf, _IOC_SIZE(cmd));
+
+    ret = aesd_dev_ioctl(&aesd_device, cmd, &karg, &cuse_file(fi)->f_pos);
+    if (ret < 0)
+    {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+
+    fuse_reply_ioctl(req, ret, &karg, out_bufsz < _IOC_SIZE(cmd) ? out_bufsz : _IOC_SIZE(cmd));
+}
+
+static const struct cuse_lowlevel_ops aesd_cuse_ops = {
+        .open = aesd_cuse_open,
+        .release = aesd_cuse_release,
+        .read = aesd_cuse_read,
+        .write = aesd_cuse_write,
+        .ioctl = aesd_cuse_ioctl,
+};
+
+int main(int argc, char **argv)
+{
+    const char *dev_info_argv[] = {"DEVNAME=aesdchar"};
+    struct cuse_info ci;
+    struct aesd_stats stats;
+    bool compress = false;
+    int result;
+
+    memset(&ci, 0, sizeof(ci));
+    ci.dev_info_argc = 1;
+    ci.dev_info_argv = dev_info_argv;
+
+    // --compress is ours, everything else is passed on to libfuse
+    if (argc > 1 && strcmp(argv[1], "--compress") == 0)
+    {
+        compress = true;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    result = aesd_dev_init(&aesd_device, compress);
+    if (result)
+    {
+        fprintf(stderr, "aesdchar: %s\n",
+                result == -EINVAL ? "--compress needs a build with COMPRESS=y" : "out of memory");
+        return 1;
+    }
+
+    // parses the usual fuse options, -f to stay in the foreground, -s single threaded
+    result = cuse_lowlevel_main(argc, argv, &ci, &aesd_cuse_ops, NULL);
+
+    aesd_dev_stats(&aesd_device, &stats);
+    fprintf(stderr, "aesdchar: reads %llu (%llu bytes) writes %llu (%llu bytes) evictions %llu "
+                    "lock_contended %llu lock_wait_ns %llu\n",
+            (unsigned long long) stats.reads, (unsigned long long) stats.bytes_read,
+            (unsigned long long) stats.writes, (unsigned long long) stats.bytes_written,
+            (unsigned long long) stats.evictions, (unsigned long long) stats.lock_contended,
+            (unsigned long long) stats.lock_wait_ns);
+    if (compress)
+        fprintf(stderr, "aesdchar: packed %zu bytes into %zu, %llu block decompressions taking %llu ns, "
+                        "%llu block cache hits\n",
+                aesd_device.packed.raw_bytes, aesd_device.packed.stored_bytes,
+                (unsigned long long) stats.block_decompressions, (unsigned long long) stats.decompress_ns,
+                (unsigned long long) stats.block_cache_hits);
+    aesd_dev_cleanup(&aesd_device);
+    return result;
+}
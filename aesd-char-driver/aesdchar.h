@@ -8,7 +8,7 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug, or build with DEBUG=y
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -25,6 +25,7 @@
 
 #include "aesd-circular-buffer.h"
 
+#ifdef __KERNEL__
 #include <linux/slab.h>
 #include <linux/cdev.h>
 #include <linux/fs.h>// file_operations
@@ -32,7 +33,181 @@
 #include <linux/module.h>
 #include <linux/printk.h>
 #include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include "aesdchar_trace.h"
 
+#ifdef AESDCHAR_COMPRESS
+#include <linux/lz4.h>
+#define aesd_lz4_compress(src, dst, size, capacity, wrkmem) \
+    LZ4_compress_default(src, dst, size, capacity, wrkmem)
+#endif
+#else
+/*
+ * Just enough of the kernel API for aesdchar-core.c to build in user space,
+ * where it backs the CUSE (character device in user space) daemon
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define __user
+#define __percpu
+#define GFP_KERNEL 0
+#define ERESTARTSYS EINTR
+
+#define kmalloc(size, flags) malloc(size)
+#define krealloc(ptr, size, flags) realloc(ptr, size)
+#define kfree(ptr) free((void *) (ptr))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+#ifdef AESDCHAR_COMPRESS
+#include <lz4.h>
+/* liblz4 allocates its own work area, the kernel's LZ4 takes one from the caller */
+#define LZ4_MEM_COMPRESS 1
+#define aesd_lz4_compress(src, dst, size, capacity, wrkmem) \
+    LZ4_compress_default(src, dst, size, capacity)
+#endif
+
+/* a single set of counters, updated atomically by the daemon's threads */
+#define alloc_percpu(type) ((type *) calloc(1, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) (ptr)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_add(pcp, val) __atomic_fetch_add(&(pcp), (val), __ATOMIC_RELAXED)
+
+/* tracepoints only exist in the kernel module */
+#define trace_aesdchar_read(pos, count, ret) do { } while (0)
+#define trace_aesdchar_write(count, partial_size) do { } while (0)
+#define trace_aesdchar_evict(size) do { } while (0)
+
+static inline uint64_t ktime_get_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct mutex
+{
+    pthread_mutex_t lock;
+};
+
+static inline void mutex_init(struct mutex *mutex)
+{
+    pthread_mutex_init(&mutex->lock, NULL);
+}
+
+static inline void mutex_lock(struct mutex *mutex)
+{
+    pthread_mutex_lock(&mutex->lock);
+}
+
+static inline int mutex_trylock(struct mutex *mutex)
+{
+    return pthread_mutex_trylock(&mutex->lock) == 0;
+}
+
+static inline int mutex_lock_interruptible(struct mutex *mutex)
+{
+    return pthread_mutex_lock(&mutex->lock);
+}
+
+static inline void mutex_unlock(struct mutex *mutex)
+{
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+/* the CUSE front end hands us buffers that already live in our address space */
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+#endif
+
+
+/**
+ * Device statistics, kept per CPU so the hot paths never share a cache line.
+ * Summed up by aesd_dev_stats() when read through debugfs.
+ */
+struct aesd_stats
+{
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t evictions;
+    uint64_t evicted_bytes;
+    uint64_t lock_contended; /* lock acquisitions that had to wait */
+    uint64_t lock_wait_ns;   /* total time spent waiting for the lock */
+    uint64_t block_cache_hits;    /* reads served by the hot-block cache */
+    uint64_t block_decompressions;
+    uint64_t decompress_ns;       /* total time spent decompressing blocks */
+    uint64_t partial_bytes;       /* unterminated line bytes held, over all writers */
+};
+
+#define aesd_stat_add(dev, field, val) this_cpu_add((dev)->stats->field, (val))
+
+/* Entries are packed into blocks of about this size before they are compressed */
+#define AESD_BLOCK_SIZE 4096
+/* Number of decompressed blocks kept around for reads */
+#define AESD_BLOCK_CACHE_SIZE 2
+
+/**
+ * Consecutive history entries, stored raw while the block is being filled and
+ * LZ4 compressed once it is sealed
+ */
+struct aesd_block
+{
+    char *data;
+    size_t raw_size;    /* bytes of entry data in the block */
+    size_t stored_size; /* bytes held in data, raw_size unless compressed */
+    bool compressed;
+    unsigned int refs;  /* circular buffer entries pointing into the block */
+};
+
+struct aesd_block_ref
+{
+    struct aesd_block *block;
+    size_t offset;
+};
+
+struct aesd_block_cache_slot
+{
+    struct aesd_block *block;
+    char *raw;
+    uint64_t last_used;
+};
+
+/**
+ * Compressed history storage, see aesdchar-compress.c. In this mode the
+ * circular buffer entries keep their sizes, but buffptr only marks the slot
+ * as used, the data is found through refs[] at the same index.
+ */
+struct aesd_packed_store
+{
+    struct aesd_block *open;
+    struct aesd_block_ref refs[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_block_cache_slot cache[AESD_BLOCK_CACHE_SIZE];
+    uint64_t tick;
+    void *wrkmem;
+    size_t raw_bytes;    /* entry data held in sealed blocks */
+    size_t stored_bytes; /* memory used by sealed blocks */
+};
 
 struct aesd_dev
 {
@@ -41,11 +216,81 @@ struct aesd_dev
      */
     struct aesd_circular_buffer buffer;
     struct mutex lock;
+    /* unterminated line of a writer that closed its file, see aesd_writer_release() */
     char *partial_buffer;
     size_t partial_size;
+    struct aesd_stats __percpu *stats;
+    bool compress;
+    struct aesd_packed_store packed;
 
+#ifdef __KERNEL__
     struct cdev cdev;     /* Char device structure      */
+#endif
 };
 
+/**
+ * Per open file state of a writer, the line it is putting together from
+ * writes without a newline. Only complete lines are added to the device.
+ */
+struct aesd_writer
+{
+    struct mutex lock; /* writes through the same file are still serialized */
+    char *partial_buffer;
+    size_t partial_size;
+    size_t partial_capacity;
+};
+
+/*
+ * Device logic shared by the kernel module (main.c) and the CUSE daemon
+ * (aesdchar-cuse.c), see aesdchar-core.c. The front ends own the file position
+ * and pass it in, since CUSE cannot keep it in a struct file.
+ */
+int aesd_dev_init(struct aesd_dev *dev, bool compress);
+void aesd_dev_cleanup(struct aesd_dev *dev);
+ssize_t aesd_dev_read(struct aesd_dev *dev, char __user *buf, size_t count, loff_t *f_pos);
+ssize_t aesd_dev_write(struct aesd_dev *dev, struct aesd_writer *writer, const char __user *buf, size_t count);
+void aesd_writer_init(struct aesd_writer *writer);
+void aesd_writer_release(struct aesd_dev *dev, struct aesd_writer *writer);
+loff_t aesd_dev_llseek(struct aesd_dev *dev, loff_t f_pos, loff_t offset, int whence);
+long aesd_dev_ioctl(struct aesd_dev *dev, unsigned int cmd, void *arg, loff_t *f_pos);
+void aesd_dev_stats(struct aesd_dev *dev, struct aesd_stats *sum);
+
+/*
+ * Compressed history storage, only used when the device was initialized
+ * with compress set. Adding, evicting and reading entries must be done with
+ * dev->lock held. Built with COMPRESS=y only, so that the driver does not
+ * depend on LZ4 unless asked to, otherwise compress is rejected with -EINVAL.
+ */
+#ifdef AESDCHAR_COMPRESS
+int aesd_packed_init(struct aesd_dev *dev);
+void aesd_packed_cleanup(struct aesd_dev *dev);
+int aesd_packed_add(struct aesd_dev *dev, uint8_t slot, const char *data, size_t size);
+void aesd_packed_evict(struct aesd_dev *dev, uint8_t slot);
+const char *aesd_packed_entry(struct aesd_dev *dev, uint8_t slot);
+#else
+static inline int aesd_packed_init(struct aesd_dev *dev)
+{
+    return -EINVAL;
+}
+
+static inline void aesd_packed_cleanup(struct aesd_dev *dev)
+{
+}
+
+static inline int aesd_packed_add(struct aesd_dev *dev, uint8_t slot, const char *data, size_t size)
+{
+    return -EINVAL;
+}
+
+static inline void aesd_packed_evict(struct aesd_dev *dev, uint8_t slot)
+{
+}
+
+static inline const char *aesd_packed_entry(struct aesd_dev *dev, uint8_t slot)
+{
+    return NULL;
+}
+#endif
+
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
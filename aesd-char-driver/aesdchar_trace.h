@@ -0,0 +1,68 @@
+/*
+ * aesdchar_trace.h
+ *
+ *  Tracepoints of the AESD char driver, usable with perf and ftrace, e.g.
+ *  perf record -e 'aesdchar:*' or /sys/kernel/tracing/events/aesdchar
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: flemingpatel
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(aesdchar_read,
+    TP_PROTO(loff_t pos, size_t count, ssize_t ret),
+    TP_ARGS(pos, count, ret),
+    TP_STRUCT__entry(
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->ret = ret;
+    ),
+    TP_printk("pos=%lld count=%zu ret=%zd", __entry->pos, __entry->count, __entry->ret)
+);
+
+TRACE_EVENT(aesdchar_write,
+    TP_PROTO(size_t count, size_t partial_size),
+    TP_ARGS(count, partial_size),
+    TP_STRUCT__entry(
+        __field(size_t, count)
+        __field(size_t, partial_size)
+    ),
+    TP_fast_assign(
+        __entry->count = count;
+        __entry->partial_size = partial_size;
+    ),
+    TP_printk("count=%zu partial_size=%zu", __entry->count, __entry->partial_size)
+);
+
+TRACE_EVENT(aesdchar_evict,
+    TP_PROTO(size_t size),
+    TP_ARGS(size),
+    TP_STRUCT__entry(
+        __field(size_t, size)
+    ),
+    TP_fast_assign(
+        __entry->size = size;
+    ),
+    TP_printk("size=%zu", __entry->size)
+);
+
+#endif /* AESD_CHAR_DRIVER_AESDCHAR_TRACE_H_ */
+
+/* This part must be outside the header guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesdchar_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,72 @@
+#include "systemcalls.h"
+#include <time.h>
+
+/*
+ * Cost of running a command from a parent with a large resident set:
+ * fork() + execv() against posix_spawn(), one at a time and as a batch.
+ *
+ * Usage: systemcalls-bench [resident_mb] [commands]
+ */
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    size_t resident_mb = argc > 1 ? strtoul(argv[1], NULL, 0) : 1024;
+    int count = argc > 2 ? atoi(argv[2]) : 200;
+    char *command[] = {"/bin/true", NULL};
+    double start;
+    int i;
+
+    if (count < 1) {
+        fprintf(stderr, "Error: need at least one command\n");
+        return EXIT_FAILURE;
+    }
+
+    // touch every page so the page tables are populated
+    char *ballast = malloc(resident_mb << 20);
+    if (ballast == NULL) {
+        perror("Error: malloc");
+        return EXIT_FAILURE;
+    }
+    memset(ballast, 1, resident_mb << 20);
+
+    printf("%zu MB resident, %d x %s\n", resident_mb, count, command[0]);
+
+    start = now_ms();
+    for (i = 0; i < count; i++) {
+        if (!fork_execute_command_fork(command, NULL)) {
+            return EXIT_FAILURE;
+        }
+    }
+    printf("fork + execv         %8.1f us per command\n", (now_ms() - start) * 1e3 / count);
+
+    start = now_ms();
+    for (i = 0; i < count; i++) {
+        if (!fork_execute_command(command, NULL)) {
+            return EXIT_FAILURE;
+        }
+    }
+    printf("posix_spawn          %8.1f us per command\n", (now_ms() - start) * 1e3 / count);
+
+    struct exec_command *commands = calloc(count, sizeof(struct exec_command));
+    if (commands == NULL) {
+        perror("Error: calloc");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < count; i++) {
+        commands[i].command = command;
+    }
+    start = now_ms();
+    if (!do_exec_batch(commands, count)) {
+        return EXIT_FAILURE;
+    }
+    printf("do_exec_batch        %8.1f us per command\n", (now_ms() - start) * 1e3 / count);
+
+    free(commands);
+    free(ballast);
+    return EXIT_SUCCESS;
+}
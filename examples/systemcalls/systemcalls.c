@@ -1,4 +1,8 @@
 #include "systemcalls.h"
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+extern char **environ;
 
 
 /**
@@ -43,17 +47,14 @@ bool do_system(const char *cmd) {
 /**
 * @param *command[] - defines the command and its arguments
 * @param outputfile - outputfile to redirect stdout and stderr
-* @return true if the command @param *command[] were executed successfully
-*   using the execv() call, false if an error occurred, either in invocation of the
-*   fork, waitpid, or execv() command, or if a non-zero return value was returned
-*   by the command issued in @param arguments with the specified arguments.
+* @return pid of the child running @param *command[], -1 if fork failed.
+*   The child exits with EXIT_FAILURE if the redirect or execv() fails.
 */
-
-bool fork_execute_command(char *command[], const char *outputfile) {
+static pid_t start_command_fork(char *command[], const char *outputfile) {
     pid_t pid = fork();
     if (pid < 0) {
         perror("Error: fork");
-        return false;
+        return -1;
     } else if (pid == 0) {
         // child process
         // decoupling fd close from parent process
@@ -75,28 +76,99 @@ bool fork_execute_command(char *command[], const char *outputfile) {
         // if we see this, execv must have failed
         perror("Error: execv");
         _exit(EXIT_FAILURE);
-    } else {
-        // parent process
-        int status;
-        while (waitpid(pid, &status, 0) == -1) {
-            if (errno != EINTR) {
-                perror("Error: waitpid");
-                return false;
-            }
+    }
+    return pid;
+}
+
+/**
+* Like start_command_fork(), but with posix_spawn(), which glibc implements
+* with vfork semantics: the child shares the parent's memory until it calls
+* execv(), so the page tables of a large parent are never copied.
+* @return pid of the child, -1 if the command could not be started
+*/
+static pid_t start_command(char *command[], const char *outputfile) {
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int ret;
+
+    ret = posix_spawn_file_actions_init(&actions);
+    if (ret == 0 && outputfile && outputfile[0] != '\0') {
+        ret = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, outputfile,
+                                               O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (ret == 0) {
+            ret = posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
         }
-        if (WIFEXITED(status)) {
-            int exit_status = WEXITSTATUS(status);
-            if (exit_status == 0) {
-                return true;
-            } else {
-                fprintf(stderr, "Error: Command '%s' failed with exit status %d\n", command[0], exit_status);
-                return false;
-            }
+    }
+    if (ret == 0) {
+        ret = posix_spawn(&pid, command[0], &actions, NULL, command, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (ret == ENOSYS || ret == EINVAL) {
+        // a C library that cannot spawn, or cannot spawn this
+        return start_command_fork(command, outputfile);
+    }
+    if (ret != 0) {
+        // redirect and execv() failures are reported here instead of by an exit status
+        fprintf(stderr, "Error: posix_spawn '%s': %s\n", command[0], strerror(ret));
+        return -1;
+    }
+    return pid;
+}
+
+/**
+* @param status - wait status of the child that ran @param *command[]
+* @return true if the command exited with status 0
+*/
+static bool command_succeeded(char *command[], int status) {
+    if (WIFEXITED(status)) {
+        int exit_status = WEXITSTATUS(status);
+        if (exit_status == 0) {
+            return true;
         } else {
-            fprintf(stderr, "Error: child process terminated unexpectedly\n");
+            fprintf(stderr, "Error: Command '%s' failed with exit status %d\n", command[0], exit_status);
+            return false;
+        }
+    } else {
+        fprintf(stderr, "Error: child process terminated unexpectedly\n");
+        return false;
+    }
+}
+
+static bool wait_command(char *command[], pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            perror("Error: waitpid");
             return false;
         }
     }
+    return command_succeeded(command, status);
+}
+
+/**
+* @param *command[] - defines the command and its arguments
+* @param outputfile - outputfile to redirect stdout and stderr
+* @return true if the command @param *command[] were executed successfully
+*   using the execv() call, false if an error occurred, either in invocation of the
+*   posix_spawn/fork, waitpid, or execv() command, or if a non-zero return value was returned
+*   by the command issued in @param arguments with the specified arguments.
+*/
+
+bool fork_execute_command(char *command[], const char *outputfile) {
+    pid_t pid = start_command(command, outputfile);
+    if (pid < 0) {
+        return false;
+    }
+    return wait_command(command, pid);
+}
+
+bool fork_execute_command_fork(char *command[], const char *outputfile) {
+    pid_t pid = start_command_fork(command, outputfile);
+    if (pid < 0) {
+        return false;
+    }
+    return wait_command(command, pid);
 }
 
 /**
@@ -165,3 +237,109 @@ bool do_exec_redirect(const char *outputfile, int count, ...) {
     va_end(args);
     return fork_execute_command(command, outputfile);
 }
+
+/**
+* Run all @param count commands of @param commands concurrently, at most
+*   EXEC_BATCH_MAX_RUNNING at a time. Children are reaped by a single
+*   epoll loop over their pidfds, so whichever exits first is reaped first,
+*   and the caller's other children are never reaped by accident.
+* @return true if every command succeeded, each command's result is in its
+*   succeeded field
+*/
+bool do_exec_batch(struct exec_command *commands, int count) {
+    struct epoll_event events[EXEC_BATCH_MAX_RUNNING];
+    pid_t pids[EXEC_BATCH_MAX_RUNNING];
+    int pidfds[EXEC_BATCH_MAX_RUNNING];
+    int owner[EXEC_BATCH_MAX_RUNNING]; // index of the command running in each slot
+    int running = 0, next = 0, i;
+    bool all_succeeded = true;
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("Error: epoll_create1");
+    }
+
+    for (i = 0; i < EXEC_BATCH_MAX_RUNNING; i++) {
+        pids[i] = -1;
+    }
+
+    while (next < count || running > 0) {
+        // fill the free slots
+        for (i = 0; i < EXEC_BATCH_MAX_RUNNING && next < count; i++) {
+            if (pids[i] != -1) {
+                continue;
+            }
+            struct exec_command *cmd = &commands[next];
+            cmd->succeeded = false;
+            pids[i] = start_command(cmd->command, cmd->outputfile);
+            if (pids[i] < 0) {
+                pids[i] = -1;
+                all_succeeded = false;
+                next++;
+                i--; // try the next command in this slot
+                continue;
+            }
+            owner[i] = next++;
+            running++;
+
+            pidfds[i] = epfd < 0 ? -1 : syscall(SYS_pidfd_open, pids[i], 0);
+            if (pidfds[i] >= 0) {
+                struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
+                if (epoll_ctl(epfd, EPOLL_CTL_ADD, pidfds[i], &ev) < 0) {
+                    close(pidfds[i]);
+                    pidfds[i] = -1;
+                }
+            }
+        }
+
+        // kernels without pidfds (before 5.3): wait for the slots in order
+        int ready = 0;
+        for (i = 0; i < EXEC_BATCH_MAX_RUNNING; i++) {
+            if (pids[i] != -1 && pidfds[i] < 0) {
+                events[ready++].data.u32 = i;
+                break;
+            }
+        }
+        if (ready == 0 && running > 0) {
+            ready = epoll_wait(epfd, events, EXEC_BATCH_MAX_RUNNING, -1);
+            if (ready < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("Error: epoll_wait");
+                break;
+            }
+        }
+
+        // a readable pidfd means the child exited, waitpid() does not block
+        for (int e = 0; e < ready; e++) {
+            int slot = events[e].data.u32;
+            struct exec_command *cmd = &commands[owner[slot]];
+
+            cmd->succeeded = wait_command(cmd->command, pids[slot]);
+            all_succeeded = all_succeeded && cmd->succeeded;
+            if (pidfds[slot] >= 0) {
+                // epoll only forgets a descriptor once every copy of it is closed
+                epoll_ctl(epfd, EPOLL_CTL_DEL, pidfds[slot], NULL);
+                close(pidfds[slot]);
+            }
+            pids[slot] = -1;
+            running--;
+        }
+    }
+
+    // only reached early when epoll_wait() failed, do not leave zombies behind
+    for (i = 0; i < EXEC_BATCH_MAX_RUNNING; i++) {
+        if (pids[i] != -1) {
+            commands[owner[i]].succeeded = wait_command(commands[owner[i]].command, pids[i]);
+            all_succeeded = false;
+            if (pidfds[i] >= 0) {
+                close(pidfds[i]);
+            }
+        }
+    }
+    if (epfd >= 0) {
+        close(epfd);
+    }
+    return all_succeeded && next == count;
+}
@@ -8,12 +8,30 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <spawn.h>
 
 bool do_system(const char *command);
 
 // helper
 bool fork_execute_command(char *command[], const char *outputfile);
 
+// fork() + execv() version of fork_execute_command(), its fallback
+bool fork_execute_command_fork(char *command[], const char *outputfile);
+
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/**
+ * One command of do_exec_batch()
+ */
+struct exec_command {
+    char **command;         // full path of the command followed by its arguments, NULL terminated
+    const char *outputfile; // stdout and stderr are redirected here unless NULL
+    bool succeeded;         // set by do_exec_batch()
+};
+
+// commands of a batch running at the same time
+#define EXEC_BATCH_MAX_RUNNING 64
+
+bool do_exec_batch(struct exec_command *commands, int count);
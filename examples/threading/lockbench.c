@@ -0,0 +1,325 @@
+#include "locks.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Lock contention benchmark: N threads repeatedly take one lock, hold it for
+ * hold_ns, release it and work outside of it for work_ns. Reports acquisitions
+ * per second and the latency of each acquisition (from asking for the lock to
+ * holding it) as percentiles.
+ *
+ * Usage: lockbench [-l lock,...|all] [-t threads,...] [-H hold_ns] [-W work_ns]
+ *                  [-d duration_ms] [-r read_percent]
+ */
+
+#define ERROR_LOG(msg, ...) fprintf(stderr, "lockbench ERROR: " msg "\n" , ##__VA_ARGS__)
+
+#define MAX_THREADS 256
+#define MAX_RUNS 16
+
+// log-linear histogram: 2^SUB_BITS linear buckets per power of two
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HIST_BUCKETS (64 * SUB_BUCKETS)
+
+struct histogram
+{
+    uint64_t count[HIST_BUCKETS];
+    uint64_t max;
+};
+
+struct worker
+{
+    pthread_t thread;
+    uint64_t acquisitions;
+    uint64_t exclusive;
+    unsigned int seed;
+    struct histogram latency;
+} __attribute__((aligned(64)));
+
+static struct
+{
+    struct bench_lock lock;
+    // only written while the lock is held exclusively, checks mutual exclusion
+    uint64_t counter __attribute__((aligned(64)));
+    uint64_t hold_ns;
+    uint64_t work_ns;
+    int read_percent;
+    pthread_barrier_t start;
+    atomic_bool stop __attribute__((aligned(64)));
+} bench;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void spin_for(uint64_t ns)
+{
+    if (ns == 0) {
+        return;
+    }
+    uint64_t end = now_ns() + ns;
+    while (now_ns() < end) {
+        cpu_relax();
+    }
+}
+
+static inline unsigned int bucket_of(uint64_t value)
+{
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+    unsigned int msb = 63 - __builtin_clzll(value);
+    unsigned int sub = (value >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (msb - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+// upper bound of the values counted in a bucket
+static uint64_t bucket_limit(unsigned int bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned int msb = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << (msb - SUB_BITS)) - 1;
+}
+
+static inline void histogram_add(struct histogram *histogram, uint64_t value)
+{
+    histogram->count[bucket_of(value)]++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+static uint64_t histogram_percentile(const struct histogram *histogram, uint64_t total, double percentile)
+{
+    uint64_t rank = (uint64_t) (total * percentile / 100.0);
+    uint64_t seen = 0;
+
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += histogram->count[i];
+        if (seen > rank) {
+            uint64_t limit = bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void *worker_thread(void *arg)
+{
+    struct worker *worker = arg;
+
+    pthread_barrier_wait(&bench.start);
+    while (!atomic_load_explicit(&bench.stop, memory_order_relaxed)) {
+        bool shared = bench.read_percent > 0 && (int) (rand_r(&worker->seed) % 100) < bench.read_percent;
+
+        uint64_t start = now_ns();
+        bench_lock_acquire(&bench.lock, shared);
+        histogram_add(&worker->latency, now_ns() - start);
+
+        if (shared) {
+            __asm__ __volatile__("" : : "r"(bench.counter));
+        } else {
+            bench.counter++;
+            worker->exclusive++;
+        }
+        spin_for(bench.hold_ns);
+        bench_lock_release(&bench.lock);
+
+        worker->acquisitions++;
+        spin_for(bench.work_ns);
+    }
+    return NULL;
+}
+
+static int run(enum lock_type type, int nthreads, uint64_t duration_ms)
+{
+    struct worker *workers;
+    struct histogram total;
+    uint64_t acquisitions = 0, exclusive = 0;
+    int started, ret = -1;
+
+    workers = aligned_alloc(64, nthreads * sizeof(struct worker));
+    if (workers == NULL) {
+        ERROR_LOG("Failed to allocate memory for %d workers", nthreads);
+        return -1;
+    }
+    memset(workers, 0, nthreads * sizeof(struct worker));
+    memset(&total, 0, sizeof(total));
+
+    if (!bench_lock_init(&bench.lock, type)) {
+        ERROR_LOG("Failed to initialize %s lock", lock_names[type]);
+        free(workers);
+        return -1;
+    }
+    bench.counter = 0;
+    atomic_store(&bench.stop, false);
+    pthread_barrier_init(&bench.start, NULL, nthreads + 1);
+
+    for (started = 0; started < nthreads; started++) {
+        workers[started].seed = started + 1;
+        if (pthread_create(&workers[started].thread, NULL, worker_thread, &workers[started]) != 0) {
+            ERROR_LOG("Failed to create thread");
+            // nobody can pass the barrier anymore, the run is lost
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&bench.start);
+    uint64_t start = now_ns();
+    struct timespec duration = {duration_ms / 1000, (duration_ms % 1000) * 1000000};
+    while (nanosleep(&duration, &duration) != 0 && errno == EINTR) {
+    }
+    atomic_store(&bench.stop, true);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    for (int i = 0; i < started; i++) {
+        acquisitions += workers[i].acquisitions;
+        exclusive += workers[i].exclusive;
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            total.count[b] += workers[i].latency.count[b];
+        }
+        if (workers[i].latency.max > total.max) {
+            total.max = workers[i].latency.max;
+        }
+    }
+
+    if (bench.counter != exclusive) {
+        ERROR_LOG("%s: %lu exclusive acquisitions but the counter is at %lu, mutual exclusion is broken",
+                  lock_names[type], (unsigned long) exclusive, (unsigned long) bench.counter);
+    } else if (acquisitions > 0) {
+        printf("%-9s %7d %10.0f %9lu %9lu %9lu %9lu %11lu\n", lock_names[type], nthreads, acquisitions / elapsed,
+               (unsigned long) histogram_percentile(&total, acquisitions, 50),
+               (unsigned long) histogram_percentile(&total, acquisitions, 90),
+               (unsigned long) histogram_percentile(&total, acquisitions, 99),
+               (unsigned long) histogram_percentile(&total, acquisitions, 99.9), (unsigned long) total.max);
+        ret = 0;
+    }
+
+    pthread_barrier_destroy(&bench.start);
+    bench_lock_destroy(&bench.lock);
+    free(workers);
+    return ret;
+}
+
+static int parse_locks(char *list, enum lock_type *types)
+{
+    int count = 0;
+
+    if (strcmp(list, "all") == 0) {
+        for (int i = 0; i < LOCK_TYPE_NR; i++) {
+            types[count++] = i;
+        }
+        return count;
+    }
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        int i;
+        for (i = 0; i < LOCK_TYPE_NR && strcmp(name, lock_names[i]) != 0; i++) {
+        }
+        if (i == LOCK_TYPE_NR || count == MAX_RUNS) {
+            ERROR_LOG("Unknown lock %s", name);
+            return -1;
+        }
+        types[count++] = i;
+    }
+    return count;
+}
+
+static int parse_threads(char *list, int *threads)
+{
+    int count = 0;
+
+    for (char *value = strtok(list, ","); value; value = strtok(NULL, ",")) {
+        int nthreads = atoi(value);
+        if (nthreads < 1 || nthreads > MAX_THREADS || count == MAX_RUNS) {
+            ERROR_LOG("Thread count must be between 1 and %d", MAX_THREADS);
+            return -1;
+        }
+        threads[count++] = nthreads;
+    }
+    return count;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-l lock,...|all] [-t threads,...] [-H hold_ns] [-W work_ns] [-d duration_ms] "
+                    "[-r read_percent]\n", name);
+    fprintf(stderr, "locks:");
+    for (int i = 0; i < LOCK_TYPE_NR; i++) {
+        fprintf(stderr, " %s", lock_names[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    char default_locks[] = "all", default_threads[] = "1,2,4,8";
+    char *lock_list = default_locks, *thread_list = default_threads;
+    enum lock_type types[MAX_RUNS];
+    int threads[MAX_RUNS];
+    uint64_t duration_ms = 1000;
+    int opt, ret = EXIT_SUCCESS;
+
+    bench.hold_ns = 100;
+    bench.work_ns = 100;
+    while ((opt = getopt(argc, argv, "l:t:H:W:d:r:")) != -1) {
+        switch (opt) {
+            case 'l':
+                lock_list = optarg;
+                break;
+            case 't':
+                thread_list = optarg;
+                break;
+            case 'H':
+                bench.hold_ns = strtoull(optarg, NULL, 0);
+                break;
+            case 'W':
+                bench.work_ns = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                duration_ms = strtoull(optarg, NULL, 0);
+                break;
+            case 'r':
+                bench.read_percent = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    int nlocks = parse_locks(lock_list, types);
+    int nruns = parse_threads(thread_list, threads);
+    if (nlocks < 0 || nruns < 0 || duration_ms == 0 || bench.read_percent < 0 || bench.read_percent > 100) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%ld cpus, hold %lu ns, work %lu ns, %d%% reads, %lu ms per run\n", sysconf(_SC_NPROCESSORS_ONLN),
+           (unsigned long) bench.hold_ns, (unsigned long) bench.work_ns, bench.read_percent,
+           (unsigned long) duration_ms);
+    printf("%-9s %7s %10s %9s %9s %9s %9s %11s\n", "lock", "threads", "acq/s", "p50_ns", "p90_ns", "p99_ns",
+           "p99.9_ns", "max_ns");
+    for (int l = 0; l < nlocks; l++) {
+        for (int t = 0; t < nruns; t++) {
+            if (run(types[l], threads[t], duration_ms) != 0) {
+                ret = EXIT_FAILURE;
+            }
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,198 @@
+#ifndef THREADING_LOCKS_H
+#define THREADING_LOCKS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/**
+ * Lock primitives compared by lockbench, all behind the same interface so a
+ * caller can be switched from one to the other by changing a lock_type.
+ */
+enum lock_type
+{
+    LOCK_MUTEX,    // pthread mutex, default attributes
+    LOCK_ADAPTIVE, // pthread mutex that spins for a while before sleeping
+    LOCK_SPIN,     // pthread spinlock, never sleeps
+    LOCK_TICKET,   // FIFO spinlock, waiters are served in arrival order
+    LOCK_FUTEX,    // three state futex mutex ("Futexes Are Tricky", Drepper)
+    LOCK_RWLOCK,   // pthread rwlock, readers share the lock
+    LOCK_TYPE_NR,
+};
+
+struct ticket_lock
+{
+    atomic_uint next;
+    atomic_uint serving;
+};
+
+struct bench_lock
+{
+    enum lock_type type;
+    union
+    {
+        pthread_mutex_t mutex;
+        pthread_spinlock_t spin;
+        struct ticket_lock ticket;
+        atomic_int futex; // 0 unlocked, 1 locked, 2 locked with waiters
+        pthread_rwlock_t rwlock;
+    };
+} __attribute__((aligned(64)));
+
+static const char *const lock_names[LOCK_TYPE_NR] = {
+        [LOCK_MUTEX] = "mutex",
+        [LOCK_ADAPTIVE] = "adaptive",
+        [LOCK_SPIN] = "spin",
+        [LOCK_TICKET] = "ticket",
+        [LOCK_FUTEX] = "futex",
+        [LOCK_RWLOCK] = "rwlock",
+};
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline long futex(atomic_int *uaddr, int op, int val)
+{
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static inline bool bench_lock_init(struct bench_lock *lock, enum lock_type type)
+{
+    pthread_mutexattr_t attr;
+
+    lock->type = type;
+    switch (type) {
+        case LOCK_MUTEX:
+            return pthread_mutex_init(&lock->mutex, NULL) == 0;
+        case LOCK_ADAPTIVE:
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+            bool ok = pthread_mutex_init(&lock->mutex, &attr) == 0;
+            pthread_mutexattr_destroy(&attr);
+            return ok;
+        case LOCK_SPIN:
+            return pthread_spin_init(&lock->spin, PTHREAD_PROCESS_PRIVATE) == 0;
+        case LOCK_TICKET:
+            atomic_init(&lock->ticket.next, 0);
+            atomic_init(&lock->ticket.serving, 0);
+            return true;
+        case LOCK_FUTEX:
+            atomic_init(&lock->futex, 0);
+            return true;
+        case LOCK_RWLOCK:
+            return pthread_rwlock_init(&lock->rwlock, NULL) == 0;
+        default:
+            return false;
+    }
+}
+
+static inline void bench_lock_destroy(struct bench_lock *lock)
+{
+    switch (lock->type) {
+        case LOCK_MUTEX:
+        case LOCK_ADAPTIVE:
+            pthread_mutex_destroy(&lock->mutex);
+            break;
+        case LOCK_SPIN:
+            pthread_spin_destroy(&lock->spin);
+            break;
+        case LOCK_RWLOCK:
+            pthread_rwlock_destroy(&lock->rwlock);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @param shared take the lock for reading, only different from an exclusive
+ *      acquisition for LOCK_RWLOCK
+ */
+static inline void bench_lock_acquire(struct bench_lock *lock, bool shared)
+{
+    switch (lock->type) {
+        case LOCK_MUTEX:
+        case LOCK_ADAPTIVE:
+            pthread_mutex_lock(&lock->mutex);
+            break;
+        case LOCK_SPIN:
+            pthread_spin_lock(&lock->spin);
+            break;
+        case LOCK_TICKET: {
+            unsigned int ticket = atomic_fetch_add_explicit(&lock->ticket.next, 1, memory_order_relaxed);
+            while (atomic_load_explicit(&lock->ticket.serving, memory_order_acquire) != ticket) {
+                cpu_relax();
+            }
+            break;
+        }
+        case LOCK_FUTEX: {
+            int c = 0;
+            if (atomic_compare_exchange_strong_explicit(&lock->futex, &c, 1, memory_order_acquire,
+                                                        memory_order_relaxed)) {
+                break;
+            }
+            // mark the lock contended, then sleep until it is released
+            if (c != 2) {
+                c = atomic_exchange_explicit(&lock->futex, 2, memory_order_acquire);
+            }
+            while (c != 0) {
+                futex(&lock->futex, FUTEX_WAIT_PRIVATE, 2);
+                c = atomic_exchange_explicit(&lock->futex, 2, memory_order_acquire);
+            }
+            break;
+        }
+        case LOCK_RWLOCK:
+            if (shared) {
+                pthread_rwlock_rdlock(&lock->rwlock);
+            } else {
+                pthread_rwlock_wrlock(&lock->rwlock);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static inline void bench_lock_release(struct bench_lock *lock)
+{
+    switch (lock->type) {
+        case LOCK_MUTEX:
+        case LOCK_ADAPTIVE:
+            pthread_mutex_unlock(&lock->mutex);
+            break;
+        case LOCK_SPIN:
+            pthread_spin_unlock(&lock->spin);
+            break;
+        case LOCK_TICKET:
+            // only the holder writes serving
+            atomic_store_explicit(&lock->ticket.serving,
+                                  atomic_load_explicit(&lock->ticket.serving, memory_order_relaxed) + 1,
+                                  memory_order_release);
+            break;
+        case LOCK_FUTEX:
+            // wake one waiter only if there may be one
+            if (atomic_fetch_sub_explicit(&lock->futex, 1, memory_order_release) != 1) {
+                atomic_store_explicit(&lock->futex, 0, memory_order_release);
+                futex(&lock->futex, FUTEX_WAKE_PRIVATE, 1);
+            }
+            break;
+        case LOCK_RWLOCK:
+            pthread_rwlock_unlock(&lock->rwlock);
+            break;
+        default:
+            break;
+    }
+}
+
+#endif // THREADING_LOCKS_H
@@ -0,0 +1,67 @@
+#!/bin/bash
+# Benchmark of the native finder against finder.sh
+# Usage: finder-bench.sh [numdirs] [filesperdir] [linesperfile] [searchstr]
+
+set -e
+set -u
+
+NUMDIRS=${1:-100}
+FILESPERDIR=${2:-100}
+LINESPERFILE=${3:-100}
+SEARCHSTR=${4:-AELD_IS_FUN}
+BENCHDIR=/tmp/aeld-bench
+RUNS=3
+
+cd "$(dirname "$0")"
+if [ ! -x ./finder ]
+then
+	echo "build the native finder first: make finder"
+	exit 1
+fi
+
+echo "Creating ${NUMDIRS} directories of ${FILESPERDIR} files of ${LINESPERFILE} lines in ${BENCHDIR}"
+rm -rf "${BENCHDIR}"
+for d in $(seq 1 "$NUMDIRS")
+do
+	mkdir -p "${BENCHDIR}/dir$d/sub"
+	# every 10th line matches
+	awk -v n="$LINESPERFILE" -v s="$SEARCHSTR" \
+		'BEGIN { for (i = 1; i <= n; i++) print (i % 10 == 0 ? "line " i " " s : "line " i " nothing to see") }' \
+		> "${BENCHDIR}/dir$d/sub/file0"
+	for f in $(seq 1 $((FILESPERDIR - 1)))
+	do
+		cp "${BENCHDIR}/dir$d/sub/file0" "${BENCHDIR}/dir$d/sub/file$f"
+	done
+done
+
+# run <label> <command...>: print the best wall time of $RUNS runs and the output
+run()
+{
+	label=$1
+	shift
+	best=
+	for i in $(seq 1 $RUNS)
+	do
+		start=$(date +%s%N)
+		output=$("$@")
+		elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+		if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]
+		then
+			best=$elapsed
+		fi
+	done
+	printf "%-20s %6d ms  %s\n" "$label" "$best" "$output"
+}
+
+run "finder.sh" ./finder.sh "${BENCHDIR}" "${SEARCHSTR}"
+run "finder -j 1" ./finder -j 1 "${BENCHDIR}" "${SEARCHSTR}"
+run "finder -j $(nproc)" ./finder "${BENCHDIR}" "${SEARCHSTR}"
+
+if [ "$(./finder.sh "${BENCHDIR}" "${SEARCHSTR}")" != "$(./finder "${BENCHDIR}" "${SEARCHSTR}")" ]
+then
+	echo "failed: finder and finder.sh disagree"
+	rm -rf "${BENCHDIR}"
+	exit 1
+fi
+
+rm -rf "${BENCHDIR}"
@@ -52,13 +52,21 @@ fi
 #make clean
 #make
 
-for i in $( seq 1 $NUMFILES)
-do
+#for i in $( seq 1 $NUMFILES)
+#do
 #	./writer.sh "$WRITEDIR/${username}$i.txt" "$WRITESTR"
-	./writer "$WRITEDIR/${username}$i.txt" "$WRITESTR"
-done
+#done
 
-OUTPUTSTRING=$(./finder.sh "$WRITEDIR" "$WRITESTR")
+# a single writer process creates all the files
+./writer -d "$WRITEDIR" -n "$NUMFILES" -t "${username}%d.txt" "$WRITESTR"
+
+# the native finder is much faster on large directories, finder.sh needs no build
+if [ -x ./finder ]
+then
+	OUTPUTSTRING=$(./finder "$WRITEDIR" "$WRITESTR")
+else
+	OUTPUTSTRING=$(./finder.sh "$WRITEDIR" "$WRITESTR")
+fi
 
 # remove temporary directories
 rm -rf /tmp/aeld-data
@@ -0,0 +1,605 @@
+/*
+ * finder: native replacement for finder.sh
+ *
+ * Counts the regular files below <filesdir> and the lines of those files that
+ * match <searchstr>, with the same results as
+ *     find <filesdir> -type f | wc -l
+ *     grep -r <searchstr> <filesdir> | wc -l
+ *
+ * The tree is walked by a pool of threads. Every thread keeps its pending
+ * directories and files in its own deque, takes work from the back of it and
+ * steals from the front of the others' deques when it runs dry, so one deep
+ * directory does not leave the other threads idle. Directories are read with
+ * getdents64() relative to their parent's descriptor, files are searched with
+ * memmem() in a read() buffer or, when they are large, in an mmap() of the
+ * whole file.
+ *
+ * Like grep, <searchstr> is a basic regular expression. Patterns without any
+ * regular expression syntax, the common case, never reach the regex engine.
+ * A file containing a NUL byte is binary, grep (3.5 and later) only reports
+ * that it matches on stderr, which finder.sh discards, so its lines never count.
+ */
+
+/* memmem is a GNU extension */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+#define SUCCESS 0
+#define FAILURE 1
+
+#define MAX_THREADS 64
+#define DIRENT_BUF_SIZE 32768
+/* files up to this size are read(), larger ones are mmap()ed */
+#define READ_BUF_SIZE 65536
+
+
+/* getdents64() record, glibc only provides the syscall number */
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* open directory shared by the tasks of its entries */
+struct dir_ref
+{
+    int fd;
+    atomic_uint refs;
+};
+
+struct task
+{
+    struct dir_ref *parent;
+    bool is_dir;
+    char name[];
+};
+
+/* per thread double ended queue, the owner works at the back, thieves at the front */
+struct deque
+{
+    pthread_mutex_t lock;
+    struct task **tasks;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+};
+
+struct worker
+{
+    pthread_t thread;
+    int id;
+    struct deque deque;
+    char *read_buf;
+    char *dirent_buf;
+    regex_t regex;
+    uint64_t files;
+    uint64_t matches;
+    bool failed;
+};
+
+static struct
+{
+    struct worker *workers;
+    int nthreads;
+    const char *pattern;
+    size_t pattern_len;
+    bool use_regex;
+    /* queued plus running tasks, the walk is done when it drops to zero */
+    atomic_size_t pending;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    atomic_int idle;
+} pool = {
+    .idle_lock = PTHREAD_MUTEX_INITIALIZER,
+    .idle_cond = PTHREAD_COND_INITIALIZER,
+};
+
+
+static void dir_ref_put(struct dir_ref *dir)
+{
+    if (dir && atomic_fetch_sub_explicit(&dir->refs, 1, memory_order_acq_rel) == 1)
+    {
+        close(dir->fd);
+        free(dir);
+    }
+}
+
+static void task_free(struct task *task)
+{
+    dir_ref_put(task->parent);
+    free(task);
+}
+
+static int deque_push(struct deque *deque, struct task *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->capacity)
+    {
+        /* reclaim the space stolen from the front before growing */
+        size_t used = deque->tail - deque->head;
+        if (deque->head > deque->capacity / 2)
+        {
+            memmove(deque->tasks, deque->tasks + deque->head, used * sizeof(*deque->tasks));
+        } else
+        {
+            size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+            struct task **tasks = malloc(capacity * sizeof(*tasks));
+            if (tasks == NULL)
+            {
+                pthread_mutex_unlock(&deque->lock);
+                return -1;
+            }
+            memcpy(tasks, deque->tasks + deque->head, used * sizeof(*tasks));
+            free(deque->tasks);
+            deque->tasks = tasks;
+            deque->capacity = capacity;
+        }
+        deque->head = 0;
+        deque->tail = used;
+    }
+    deque->tasks[deque->tail++] = task;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+static struct task *deque_pop_back(struct deque *deque)
+{
+    struct task *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head)
+    {
+        task = deque->tasks[--deque->tail];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+static struct task *deque_steal(struct deque *deque)
+{
+    struct task *task = NULL;
+    /* never wait for a busy victim, try the next one instead */
+    if (pthread_mutex_trylock(&deque->lock) != 0)
+    {
+        return NULL;
+    }
+    if (deque->tail > deque->head)
+    {
+        task = deque->tasks[deque->head++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+static void submit(struct worker *self, struct task *task)
+{
+    atomic_fetch_add_explicit(&pool.pending, 1, memory_order_relaxed);
+    if (deque_push(&self->deque, task) < 0)
+    {
+        printf("finder: out of memory\n");
+        self->failed = true;
+        task_free(task);
+        atomic_fetch_sub_explicit(&pool.pending, 1, memory_order_relaxed);
+        return;
+    }
+
+    /* unlocked check, a missed wakeup is caught by the idle timeout */
+    if (atomic_load_explicit(&pool.idle, memory_order_relaxed) > 0)
+    {
+        pthread_mutex_lock(&pool.idle_lock);
+        pthread_cond_signal(&pool.idle_cond);
+        pthread_mutex_unlock(&pool.idle_lock);
+    }
+}
+
+static struct task *task_new(struct dir_ref *parent, const char *name, size_t name_len, bool is_dir)
+{
+    struct task *task = malloc(sizeof(*task) + name_len + 1);
+    if (task == NULL)
+    {
+        return NULL;
+    }
+    if (parent)
+    {
+        atomic_fetch_add_explicit(&parent->refs, 1, memory_order_relaxed);
+    }
+    task->parent = parent;
+    task->is_dir = is_dir;
+    memcpy(task->name, name, name_len);
+    task->name[name_len] = '\0';
+    return task;
+}
+
+/*
+ * count the lines of data[0, size) matching the pattern, the last line does not
+ * need to end with a newline
+ */
+static uint64_t count_matching_lines(struct worker *self, const char *data, size_t size)
+{
+    const char *end = data + size;
+    const char *line = data;
+    uint64_t matches = 0;
+
+    if (!pool.use_regex)
+    {
+        while (line < end)
+        {
+            const char *hit = memmem(line, end - line, pool.pattern, pool.pattern_len);
+            if (hit == NULL)
+            {
+                break;
+            }
+            /* the pattern cannot span lines, so the hit is in the line it starts in */
+            matches++;
+            const char *newline = memchr(hit + pool.pattern_len, '\n', end - hit - pool.pattern_len);
+            line = newline ? newline + 1 : end;
+        }
+        return matches;
+    }
+
+    while (line < end)
+    {
+        const char *newline = memchr(line, '\n', end - line);
+        const char *line_end = newline ? newline : end;
+        regmatch_t range = {.rm_so = 0, .rm_eo = line_end - line};
+
+        if (regexec(&self->regex, line, 1, &range, REG_STARTEND) == 0)
+        {
+            matches++;
+        }
+        line = line_end + 1;
+    }
+    return matches;
+}
+
+static void search_file(struct worker *self, int dirfd, const char *name)
+{
+    int fd = openat(dirfd, name, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return; /* grep reports the error on stderr, which finder.sh discards */
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return;
+    }
+
+    const char *data = NULL;
+    size_t size = 0;
+    void *map = MAP_FAILED;
+
+    if (st.st_size <= READ_BUF_SIZE)
+    {
+        ssize_t bytes_read;
+        while (size < READ_BUF_SIZE &&
+               (bytes_read = read(fd, self->read_buf + size, READ_BUF_SIZE - size)) > 0)
+        {
+            size += bytes_read;
+        }
+        data = self->read_buf;
+    } else
+    {
+        size = st.st_size;
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            return;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        data = map;
+    }
+    close(fd);
+
+    if (memchr(data, '\0', size) == NULL)
+    {
+        self->matches += count_matching_lines(self, data, size);
+    }
+
+    if (map != MAP_FAILED)
+    {
+        munmap(map, size);
+    }
+}
+
+static void scan_dir(struct worker *self, int dirfd, const char *name)
+{
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct dir_ref *dir = malloc(sizeof(*dir));
+    if (dir == NULL)
+    {
+        close(fd);
+        self->failed = true;
+        return;
+    }
+    dir->fd = fd;
+    atomic_init(&dir->refs, 1);
+
+    for (;;)
+    {
+        long nread = syscall(SYS_getdents64, fd, self->dirent_buf, DIRENT_BUF_SIZE);
+        if (nread <= 0)
+        {
+            break;
+        }
+
+        for (long offset = 0; offset < nread;)
+        {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *) (self->dirent_buf + offset);
+            unsigned char type = entry->d_type;
+            offset += entry->d_reclen;
+
+            if (entry->d_name[0] == '.' &&
+                (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0')))
+            {
+                continue;
+            }
+
+            /* neither find -type f nor grep -r follow symbolic links */
+            if (type == DT_UNKNOWN)
+            {
+                struct stat st;
+                if (fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                {
+                    continue;
+                }
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if (type != DT_DIR && type != DT_REG)
+            {
+                continue;
+            }
+
+            if (type == DT_REG)
+            {
+                self->files++;
+            }
+            struct task *task = task_new(dir, entry->d_name, strlen(entry->d_name), type == DT_DIR);
+            if (task == NULL)
+            {
+                self->failed = true;
+                continue;
+            }
+            submit(self, task);
+        }
+    }
+
+    dir_ref_put(dir);
+}
+
+static void run_task(struct worker *self, struct task *task)
+{
+    int dirfd = task->parent->fd;
+
+    if (task->is_dir)
+    {
+        scan_dir(self, dirfd, task->name);
+    } else
+    {
+        search_file(self, dirfd, task->name);
+    }
+    task_free(task);
+    atomic_fetch_sub_explicit(&pool.pending, 1, memory_order_acq_rel);
+}
+
+static struct task *find_work(struct worker *self)
+{
+    struct task *task = deque_pop_back(&self->deque);
+    for (int i = 1; task == NULL && i < pool.nthreads; i++)
+    {
+        task = deque_steal(&pool.workers[(self->id + i) % pool.nthreads].deque);
+    }
+    return task;
+}
+
+static void *worker_thread(void *arg)
+{
+    struct worker *self = arg;
+
+    for (;;)
+    {
+        struct task *task = find_work(self);
+        if (task)
+        {
+            run_task(self, task);
+            continue;
+        }
+
+        if (atomic_load_explicit(&pool.pending, memory_order_acquire) == 0)
+        {
+            break;
+        }
+
+        /* nothing to steal right now, wait for a submit() */
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&pool.idle_lock);
+        pool.idle++;
+        pthread_cond_timedwait(&pool.idle_cond, &pool.idle_lock, &ts);
+        pool.idle--;
+        pthread_mutex_unlock(&pool.idle_lock);
+    }
+
+    /* the last worker to finish wakes up the others */
+    pthread_mutex_lock(&pool.idle_lock);
+    pthread_cond_broadcast(&pool.idle_cond);
+    pthread_mutex_unlock(&pool.idle_lock);
+    return NULL;
+}
+
+/* true if @pattern means more than its literal characters in a basic regular expression */
+static bool is_regex(const char *pattern)
+{
+    /* a newline could make a literal hit span two lines, leave it to the line by line search */
+    return strpbrk(pattern, ".[]*^$\\\n") != NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    int ret = SUCCESS;
+
+    while ((opt = getopt(argc, argv, "j:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            default:
+                printf("finder: usage: %s [-j threads] <filesdir> <searchstr>\n", argv[0]);
+                return FAILURE;
+        }
+    }
+
+    if (argc - optind != 2)
+    {
+        printf("finder: required two arguments: <filesdir> <searchstr>\n");
+        return FAILURE;
+    }
+
+    const char *filesdir = argv[optind];
+    struct stat st;
+    if (stat(filesdir, &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+        printf("finder: %s is not a directory or check if it exists\n", filesdir);
+        return FAILURE;
+    }
+
+    if (nthreads < 1)
+    {
+        nthreads = 1;
+    } else if (nthreads > MAX_THREADS)
+    {
+        nthreads = MAX_THREADS;
+    }
+
+    pool.pattern = argv[optind + 1];
+    pool.pattern_len = strlen(pool.pattern);
+    pool.use_regex = is_regex(pool.pattern);
+    pool.nthreads = nthreads;
+    pool.workers = calloc(nthreads, sizeof(struct worker));
+    if (pool.workers == NULL)
+    {
+        printf("finder: out of memory\n");
+        return FAILURE;
+    }
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        struct worker *worker = &pool.workers[i];
+        worker->id = i;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->read_buf = malloc(READ_BUF_SIZE);
+        worker->dirent_buf = malloc(DIRENT_BUF_SIZE);
+        if (worker->read_buf == NULL || worker->dirent_buf == NULL)
+        {
+            printf("finder: out of memory\n");
+            return FAILURE;
+        }
+        /* regexec() on a shared regex_t serializes on its internal lock */
+        if (pool.use_regex && regcomp(&worker->regex, pool.pattern, REG_NOSUB) != 0)
+        {
+            printf("finder: invalid search string %s\n", pool.pattern);
+            return FAILURE;
+        }
+    }
+
+    /* the top directory is followed even if it is a symbolic link, as with find and grep */
+    int fd = open(filesdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        printf("finder: %s is not a directory or check if it exists\n", filesdir);
+        return FAILURE;
+    }
+    struct dir_ref *top = malloc(sizeof(*top));
+    if (top == NULL)
+    {
+        printf("finder: out of memory\n");
+        return FAILURE;
+    }
+    top->fd = fd;
+    atomic_init(&top->refs, 1);
+    struct task *root = task_new(top, ".", 1, true);
+    dir_ref_put(top);
+    if (root == NULL)
+    {
+        printf("finder: out of memory\n");
+        return FAILURE;
+    }
+    submit(&pool.workers[0], root);
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&pool.workers[i].thread, NULL, worker_thread, &pool.workers[i]) != 0)
+        {
+            printf("finder: failed to create thread: %s\n", strerror(errno));
+            return FAILURE;
+        }
+    }
+
+    /* all of them first, a running worker may still try to steal from any deque */
+    for (int i = 0; i < nthreads; i++)
+    {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+
+    uint64_t num_files = 0, num_matches = 0;
+    for (int i = 0; i < nthreads; i++)
+    {
+        struct worker *worker = &pool.workers[i];
+        num_files += worker->files;
+        num_matches += worker->matches;
+        if (worker->failed)
+        {
+            ret = FAILURE;
+        }
+        if (pool.use_regex)
+        {
+            regfree(&worker->regex);
+        }
+        free(worker->read_buf);
+        free(worker->dirent_buf);
+        free(worker->deque.tasks);
+        pthread_mutex_destroy(&worker->deque.lock);
+    }
+    free(pool.workers);
+
+    printf("The number of files are %llu and the number of matching lines are %llu\n",
+           (unsigned long long) num_files, (unsigned long long) num_matches);
+
+    return ret;
+}
@@ -3,25 +3,382 @@
 #include <string.h>
 #include <errno.h>
 #include <syslog.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
 
 
 #define SUCCESS 0
 #define FAILURE 1
 
+#define MAX_THREADS 64
+/* files claimed by a thread at a time */
+#define BATCH_CHUNK 64
+/* batch errors logged before the rest are only counted */
+#define MAX_LOGGED_ERRORS 10
 
 
+
+/*
+ * Batch mode: one invocation writes many files, either listed in a manifest
+ * or numbered from a name template, relative to one directory descriptor.
+ * Each file costs an openat(), a single write() and a close().
+ */
+struct batch_file
+{
+    const char* path;
+    const char* content;
+    size_t length;
+};
+
+static struct
+{
+    int dirfd;
+    /* manifest mode */
+    struct batch_file* files;
+    /* template mode: <prefix><n><suffix> for n = 1..count, all with the same content */
+    const char* prefix;
+    size_t prefix_length;
+    const char* suffix;
+    const char* content;
+    size_t content_length;
+    size_t count;
+
+    atomic_size_t next;
+    atomic_size_t written;
+    atomic_size_t bytes;
+    atomic_size_t failed;
+} batch;
+
+
+static int write_file(const char* path, const char* content, size_t length)
+{
+    int fd = openat(batch.dirfd, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        goto error;
+    }
+
+    while (length > 0)
+    {
+        ssize_t bytes_written = write(fd, content, length);
+        if (bytes_written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            close(fd);
+            goto error;
+        }
+        content += bytes_written;
+        length -= bytes_written;
+    }
+
+    if (close(fd) != 0)
+    {
+        goto error;
+    }
+    return 0;
+
+error:
+    if (atomic_fetch_add(&batch.failed, 1) < MAX_LOGGED_ERRORS)
+    {
+        syslog(LOG_ERR, "Error writing file %s: %s", path, strerror(errno));
+    }
+    return -1;
+}
+
+static void* batch_thread(void* arg)
+{
+    char path[4096];
+    size_t written = 0, bytes = 0;
+
+    for (;;)
+    {
+        size_t first = atomic_fetch_add(&batch.next, BATCH_CHUNK);
+        if (first >= batch.count)
+        {
+            break;
+        }
+        size_t last = first + BATCH_CHUNK < batch.count ? first + BATCH_CHUNK : batch.count;
+
+        for (size_t i = first; i < last; i++)
+        {
+            const char* file_path = path;
+            const char* content = batch.content;
+            size_t length = batch.content_length;
+
+            if (batch.files)
+            {
+                file_path = batch.files[i].path;
+                content = batch.files[i].content;
+                length = batch.files[i].length;
+            }
+            else if (snprintf(path, sizeof(path), "%.*s%zu%s", (int) batch.prefix_length, batch.prefix, i + 1,
+                              batch.suffix) >= sizeof(path))
+            {
+                errno = ENAMETOOLONG;
+                atomic_fetch_add(&batch.failed, 1);
+                continue;
+            }
+
+            if (write_file(file_path, content, length) == 0)
+            {
+                written++;
+                bytes += length;
+            }
+        }
+    }
+
+    atomic_fetch_add(&batch.written, written);
+    atomic_fetch_add(&batch.bytes, bytes);
+    return NULL;
+}
+
+/*
+ * read the whole manifest into memory and split it into "<path>\t<content>"
+ * lines, the content is written without the line's newline
+ */
+static int load_manifest(const char* manifest_path, char** data)
+{
+    FILE* manifest = strcmp(manifest_path, "-") == 0 ? stdin : fopen(manifest_path, "r");
+    size_t size = 0, capacity = 0;
+
+    *data = NULL;
+    if (manifest == NULL)
+    {
+        syslog(LOG_ERR, "Error opening manifest %s: %s", manifest_path, strerror(errno));
+        return -1;
+    }
+
+    for (;;)
+    {
+        if (size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 65536;
+            char* grown = realloc(*data, capacity + 1);
+            if (grown == NULL)
+            {
+                syslog(LOG_ERR, "Error reading manifest %s: out of memory", manifest_path);
+                goto error;
+            }
+            *data = grown;
+        }
+        size_t bytes_read = fread(*data + size, 1, capacity - size, manifest);
+        size += bytes_read;
+        if (bytes_read == 0)
+        {
+            break;
+        }
+    }
+    if (ferror(manifest))
+    {
+        syslog(LOG_ERR, "Error reading manifest %s: %s", manifest_path, strerror(errno));
+        goto error;
+    }
+    (*data)[size] = '\0';
+
+    size_t lines = 0;
+    for (char* p = *data; (p = memchr(p, '\n', *data + size - p)) != NULL; p++)
+    {
+        lines++;
+    }
+    batch.files = malloc((lines + 1) * sizeof(struct batch_file));
+    if (batch.files == NULL)
+    {
+        syslog(LOG_ERR, "Error reading manifest %s: out of memory", manifest_path);
+        goto error;
+    }
+
+    char* line = *data;
+    while (line < *data + size)
+    {
+        char* newline = memchr(line, '\n', *data + size - line);
+        char* end = newline ? newline : *data + size;
+        char* tab = memchr(line, '\t', end - line);
+
+        *end = '\0';
+        if (end > line)
+        {
+            if (tab == NULL || tab == line)
+            {
+                syslog(LOG_ERR, "Error in manifest %s: expected <path><TAB><content> in line %zu",
+                       manifest_path, batch.count + 1);
+                goto error;
+            }
+            *tab = '\0';
+            batch.files[batch.count].path = line;
+            batch.files[batch.count].content = tab + 1;
+            batch.files[batch.count].length = end - tab - 1;
+            batch.count++;
+        }
+        line = end + 1;
+    }
+
+    if (manifest != stdin)
+    {
+        fclose(manifest);
+    }
+    return 0;
+
+error:
+    if (manifest != stdin)
+    {
+        fclose(manifest);
+    }
+    return -1;
+}
+
+static int run_batch(const char* dir, const char* manifest_path, const char* template,
+                     const char* string_to_write, int nthreads)
+{
+    char* manifest_data = NULL;
+    pthread_t threads[MAX_THREADS];
+    struct timespec start, end;
+    int started = 0;
+    int ret = FAILURE;
+
+    batch.dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (batch.dirfd < 0)
+    {
+        syslog(LOG_ERR, "Error opening directory %s: %s", dir, strerror(errno));
+        return FAILURE;
+    }
+
+    if (manifest_path)
+    {
+        if (load_manifest(manifest_path, &manifest_data) < 0)
+        {
+            goto exit;
+        }
+    }
+    else
+    {
+        const char* placeholder = strstr(template, "%d");
+        if (placeholder == NULL || strstr(placeholder + 2, "%d"))
+        {
+            syslog(LOG_ERR, "Error: template %s must contain %%d exactly once", template);
+            goto exit;
+        }
+        batch.prefix = template;
+        batch.prefix_length = placeholder - template;
+        batch.suffix = placeholder + 2;
+        batch.content = string_to_write;
+        batch.content_length = strlen(string_to_write);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (started = 0; started < nthreads; started++)
+    {
+        if (pthread_create(&threads[started], NULL, batch_thread, NULL) != 0)
+        {
+            syslog(LOG_ERR, "Error creating thread: %s", strerror(errno));
+            break;
+        }
+    }
+    if (started == 0)
+    {
+        goto exit;
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (elapsed <= 0)
+    {
+        elapsed = 1e-9;
+    }
+    syslog(LOG_INFO, "Wrote %zu files (%zu bytes) to %s in %.3f ms: %.0f files/s, %.2f MB/s, %zu failed",
+           atomic_load(&batch.written), atomic_load(&batch.bytes), dir, elapsed * 1e3,
+           atomic_load(&batch.written) / elapsed, atomic_load(&batch.bytes) / elapsed / 1e6,
+           atomic_load(&batch.failed));
+
+    if (atomic_load(&batch.failed) == 0)
+    {
+        ret = SUCCESS;
+    }
+
+exit:
+    close(batch.dirfd);
+    free(batch.files);
+    free(manifest_data);
+    return ret;
+}
+
+static void usage(const char* name)
+{
+    syslog(LOG_ERR, "Usage: %s <file_path> <string>", name);
+    syslog(LOG_ERR, "       %s [-d dir] [-j threads] -m <manifest|->", name);
+    syslog(LOG_ERR, "       %s [-d dir] [-j threads] -n <count> -t <name_template> <string>", name);
+}
+
 int main(int argc, char* argv[])
 {
     FILE* file;
     const char* file_path;
     const char* string_to_write;
+    const char* dir = ".";
+    const char* manifest_path = NULL;
+    const char* template = NULL;
+    size_t count = 0;
+    int nthreads = 1;
+    int opt;
     int ret = SUCCESS;
 
     openlog("writer", LOG_PERROR | LOG_PID, LOG_USER);
 
+    // anything but the original <file_path> <string> form is batch mode,
+    // the string may start with a '-' there
+    while ((argc != 3 || argv[1][0] == '-') && (opt = getopt(argc, argv, "d:j:m:n:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                dir = optarg;
+                break;
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            case 'm':
+                manifest_path = optarg;
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                template = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                ret = FAILURE;
+                goto exit;
+        }
+    }
+
+    if (manifest_path || template)
+    {
+        if ((manifest_path && (template || count)) || (manifest_path && argc - optind != 0) ||
+            (template && argc - optind != 1) || nthreads < 1 || nthreads > MAX_THREADS)
+        {
+            usage(argv[0]);
+            ret = FAILURE;
+            goto exit;
+        }
+        batch.count = count;
+        ret = run_batch(dir, manifest_path, template, template ? argv[optind] : NULL, nthreads);
+        goto exit;
+    }
+
     if (argc != 3)
     {
-        syslog(LOG_ERR, "Usage: %s <file_path> <string>", argv[0]);
+        usage(argv[0]);
         ret = FAILURE;
         goto exit;
     }
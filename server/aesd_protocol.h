@@ -0,0 +1,147 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+// @brief Wire format of the aesdsocket binary protocol
+//
+// A connection whose first byte is AESD_BIN_MAGIC speaks the binary protocol
+// for its whole lifetime, any other first byte selects the newline framed
+// text protocol. After the magic byte every request and every reply is a
+// struct aesd_bin_hdr followed by hdr.length bytes of payload. All integers
+// are in network byte order.
+//
+
+#ifndef AESD_PROTOCOL_H
+#define AESD_PROTOCOL_H
+
+#include <stdint.h>
+
+#define AESD_BIN_MAGIC 0xAE
+
+enum aesd_bin_type {
+    /**
+     * append the payload to the store, reply with the full store contents
+     */
+    AESD_BIN_APPEND = 1,
+    /**
+     * append the payload to the store, reply with an empty status frame
+     */
+    AESD_BIN_APPEND_NOECHO = 2,
+    /**
+     * payload is a struct aesd_bin_read, reply with that byte range of the store
+     */
+    AESD_BIN_READ = 3,
+    /**
+     * payload is a struct aesd_bin_seek, reply with the store contents from
+     * that write command/offset (same as AESDCHAR_IOCSEEKTO: in text mode)
+     */
+    AESD_BIN_SEEK = 4,
+    /**
+     * empty payload, reply with the full store contents, then follow the
+     * store: every packet appended from then on is pushed as an
+     * AESD_BIN_PUBLISH frame. The connection accepts no further requests.
+     */
+    AESD_BIN_SUBSCRIBE = 5,
+    /**
+     * server to follower only, the payload is one packet appended to the store
+     */
+    AESD_BIN_PUBLISH = 6,
+    /**
+     * payload is a struct aesd_bin_filter followed by the pattern, reply with
+     * the lines of the range that match it in one or more frames of whole
+     * lines, the last frame is empty (same as AESDCHAR_FILTER: in text mode)
+     */
+    AESD_BIN_FILTER = 7,
+    /**
+     * payload is a struct aesd_bin_seek_time, reply with the store contents
+     * from the first entry ingested at or after that time (same as
+     * AESDCHAR_IOCSEEKTIME: in text mode)
+     */
+    AESD_BIN_SEEK_TIME = 8,
+    /**
+     * payload is the name of a store, the requests after it go to that store
+     * instead of the one of the port the client connected to. Only accepted
+     * as the first request, reply with an empty status frame (same as
+     * AESDCHAR_STORE: in text mode)
+     */
+    AESD_BIN_STORE = 9,
+};
+
+enum aesd_bin_status {
+    AESD_BIN_OK = 0,
+    AESD_BIN_EINVAL = 1,// malformed request or position out of range
+    AESD_BIN_EIO = 2,   // the store could not be read or written
+};
+
+struct aesd_bin_hdr {
+    /**
+     * enum aesd_bin_type, replies carry the type of the request they answer
+     */
+    uint8_t type;
+    /**
+     * enum aesd_bin_status, always 0 in requests
+     */
+    uint8_t status;
+    uint16_t reserved;
+    /**
+     * number of payload bytes following the header, requests larger than the
+     * server packet limit (aesdsocket -p) are rejected and the connection dropped
+     */
+    uint32_t length;
+} __attribute__((packed));
+
+struct aesd_bin_read {
+    /**
+     * zero referenced byte offset into the store
+     */
+    uint64_t offset;
+    /**
+     * number of bytes to read, 0 reads to the end of the store
+     */
+    uint32_t length;
+} __attribute__((packed));
+
+struct aesd_bin_seek {
+    uint32_t write_cmd;
+    uint32_t write_cmd_offset;
+    /**
+     * number of bytes to send, 0 sends to the end of the store.
+     * Optional, requests may stop after write_cmd_offset.
+     */
+    uint32_t length;
+} __attribute__((packed));
+
+struct aesd_bin_seek_time {
+    /**
+     * ns of the server's CLOCK_MONOTONIC, negative for ns before now
+     */
+    int64_t time_ns;
+    /**
+     * number of bytes to send, 0 sends to the end of the store.
+     * Optional, requests may stop after time_ns.
+     */
+    uint32_t length;
+} __attribute__((packed));
+
+enum aesd_filter_mode {
+    AESD_FILTER_SUBSTRING = 0,// lines containing the pattern
+    AESD_FILTER_PREFIX = 1,   // lines starting with the pattern
+};
+
+struct aesd_bin_filter {
+    /**
+     * enum aesd_filter_mode
+     */
+    uint8_t mode;
+    uint8_t reserved[3];
+    /**
+     * write commands first_cmd up to but not including last_cmd are searched,
+     * last_cmd 0 searches to the end of the store
+     */
+    uint32_t first_cmd;
+    uint32_t last_cmd;
+    /**
+     * followed by the pattern, which may not contain a newline
+     */
+} __attribute__((packed));
+
+#endif// AESD_PROTOCOL_H
@@ -0,0 +1,179 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+// CPU_SET, pthread_setname_np and mremap are GNU extensions
+#define _GNU_SOURCE
+
+#include "aesd_threads.h"
+#include "log.h"
+
+#include <linux/mempolicy.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct threads_config threads = {
+        .stack_size = THREADS_STACK_SIZE};
+
+static cpu_set_t initial_cpus;// placement before the acceptor was pinned
+static atomic_uint next_worker = 0;
+
+int threads_parse_cpus(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    while (*list)
+    {
+        char *end;
+        unsigned long first = strtoul(list, &end, 10), last = first;
+        if (end == list)
+        {
+            return -1;
+        }
+        if (*end == '-')
+        {
+            list = end + 1;
+            last = strtoul(list, &end, 10);
+            if (end == list || last < first)
+            {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++)
+        {
+            CPU_SET(cpu, set);
+        }
+        if (*end == ',')
+        {
+            end++;
+        } else if (*end != '\0')
+        {
+            return -1;
+        }
+        list = end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+void threads_setup_acceptor(void)
+{
+    pthread_setname_np(pthread_self(), "aesd-accept");
+
+    sched_getaffinity(0, sizeof(initial_cpus), &initial_cpus);
+    if (CPU_COUNT(&threads.acceptor_cpus) > 0 &&
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &threads.acceptor_cpus) != 0)
+    {
+        syslog(LOG_WARNING, "failed to pin the accepting thread, continuing unpinned");
+    }
+}
+
+/**
+ * the n-th CPU of the worker set, in turn
+ */
+static int next_worker_cpu(void)
+{
+    int n = atomic_fetch_add_explicit(&next_worker, 1, memory_order_relaxed) % CPU_COUNT(&threads.worker_cpus);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &threads.worker_cpus) && n-- == 0)
+        {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+int threads_create(pthread_t *thread, enum thread_role role, const char *name, void *(*start)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    int rc;
+
+    pthread_attr_init(&attr);
+    if (threads.stack_size)
+    {
+        pthread_attr_setstacksize(&attr, threads.stack_size);
+    }
+
+    if (role == THREAD_WORKER && CPU_COUNT(&threads.worker_cpus) > 0)
+    {
+        cpu_set_t cpu;
+        CPU_ZERO(&cpu);
+        CPU_SET(next_worker_cpu(), &cpu);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu);
+    } else if (role == THREAD_WORKER && CPU_COUNT(&threads.acceptor_cpus) > 0)
+    {
+        // do not inherit the acceptor pinning
+        pthread_attr_setaffinity_np(&attr, sizeof(initial_cpus), &initial_cpus);
+    }
+
+    rc = pthread_create(thread, &attr, start, arg);
+    pthread_attr_destroy(&attr);
+    if (rc == 0)
+    {
+        pthread_setname_np(*thread, name);
+    }
+    return rc;
+}
+
+static size_t page_align(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+void *threads_buffer_alloc(size_t size)
+{
+    if (!threads.numa_local)
+    {
+        return malloc(size);
+    }
+
+    // private pages are never recycled through another thread's malloc arena,
+    // and MPOL_LOCAL places them on the node of the thread that touches them
+    // first, even if the process was started under an interleave policy
+    void *ptr = mmap(NULL, page_align(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+    {
+        return NULL;
+    }
+    syscall(SYS_mbind, ptr, page_align(size), MPOL_LOCAL, NULL, 0, 0);
+    return ptr;
+}
+
+void *threads_buffer_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    if (!threads.numa_local)
+    {
+        return realloc(ptr, new_size);
+    }
+
+    if (page_align(old_size) == page_align(new_size))
+    {
+        return ptr;
+    }
+    void *moved = mremap(ptr, page_align(old_size), page_align(new_size), MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED)
+    {
+        return NULL;
+    }
+    syscall(SYS_mbind, moved, page_align(new_size), MPOL_LOCAL, NULL, 0, 0);
+    return moved;
+}
+
+void threads_buffer_free(void *ptr, size_t size)
+{
+    if (!threads.numa_local)
+    {
+        free(ptr);
+    } else if (ptr)
+    {
+        munmap(ptr, page_align(size));
+    }
+}
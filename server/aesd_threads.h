@@ -0,0 +1,75 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_AESD_THREADS_H
+#define AESDSOCKET_AESD_THREADS_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * stack size of every thread the server creates, none of them keeps more
+ * than a few KiB on the stack
+ */
+#define THREADS_STACK_SIZE (128u << 10)
+
+/**
+ * thread placement, empty CPU sets leave placement to the scheduler
+ */
+struct threads_config {
+    /**
+     * accepting thread and the helper threads it starts (metrics, reaper, ...)
+     */
+    cpu_set_t acceptor_cpus;
+    /**
+     * connection threads, each one is pinned to a single CPU of the set in
+     * turn, its reply sender runs on the same CPU
+     */
+    cpu_set_t worker_cpus;
+    /**
+     * 0 for the C library default
+     */
+    size_t stack_size;
+    /**
+     * allocate receive buffers from pages local to the connection thread
+     */
+    bool numa_local;
+};
+
+extern struct threads_config threads;
+
+enum thread_role {
+    THREAD_WORKER,// placed on the worker CPUs
+    THREAD_HELPER,// inherits the placement of the creating thread
+};
+
+/**
+ * parse a CPU list like "0-3,6" into @param set
+ * @return 0 on success, -1 if @param list is malformed
+ */
+int threads_parse_cpus(const char *list, cpu_set_t *set);
+
+/**
+ * name the calling thread as the accepting thread and place it on the acceptor CPUs,
+ * must be called before any other thread is created
+ */
+void threads_setup_acceptor(void);
+
+/**
+ * pthread_create() with the configured stack size and placement for
+ * @param role, the thread is named after @param name for perf and top
+ */
+int threads_create(pthread_t *thread, enum thread_role role, const char *name, void *(*start)(void *), void *arg);
+
+/**
+ * buffer memory for connection threads, page backed and faulted in by the
+ * calling thread when threads.numa_local is set, plain malloc() otherwise
+ */
+void *threads_buffer_alloc(size_t size);
+void *threads_buffer_realloc(void *ptr, size_t old_size, size_t new_size);
+void threads_buffer_free(void *ptr, size_t size);
+
+#endif// AESDSOCKET_AESD_THREADS_H
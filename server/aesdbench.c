@@ -0,0 +1,334 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+// Load generator for aesdsocket: every connection pipelines binary
+// APPEND_NOECHO requests, keeping a fixed number of them in flight, and
+// records the time from sending each request to receiving its reply.
+//
+
+#include "aesd_protocol.h"
+#include "sockopts.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+struct bench_config {
+    const char *host;
+    const char *port;
+    const char *unix_path;// connect here instead of host and port
+    const char *sockopts; // -o as given, for the report
+    int connections;
+    long requests;// per connection
+    size_t size;  // payload bytes per request
+    int window;   // requests in flight per connection
+};
+
+static struct bench_config config = {
+        .host = "127.0.0.1",
+        .port = "9000",
+        .connections = 4,
+        .requests = 100000,
+        .size = 64,
+        .window = 16};
+
+struct bench_worker {
+    pthread_t thread;
+    uint64_t *latency_ns;// one per request
+    long completed;
+    int failed;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int send_all(int sock, const void *data, size_t len)
+{
+    size_t total_sent = 0;
+    while (total_sent < len)
+    {
+        ssize_t sent = send(sock, (const char *) data + total_sent, len - total_sent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return -1;
+        }
+        total_sent += sent;
+    }
+    return 0;
+}
+
+static int recv_all(int sock, void *data, size_t len)
+{
+    size_t total_received = 0;
+    while (total_received < len)
+    {
+        ssize_t received = recv(sock, (char *) data + total_received, len - total_received, 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return -1;
+        }
+        total_received += received;
+    }
+    return 0;
+}
+
+static int bench_connect_unix(void)
+{
+    struct sockaddr_un addr;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, config.unix_path, sizeof(addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    sockopts_apply_client(sock, AF_UNIX);
+    return sock;
+}
+
+static int bench_connect(void)
+{
+    struct addrinfo hints, *res, *ai;
+    int sock = -1;
+
+    if (config.unix_path != NULL)
+    {
+        return bench_connect_unix();
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(config.host, config.port, &hints, &res) != 0)
+    {
+        return -1;
+    }
+    for (ai = res; ai; ai = ai->ai_next)
+    {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock >= 0 && connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            sockopts_apply_client(sock, ai->ai_family);
+            break;
+        }
+        if (sock >= 0)
+        {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+static void *bench_thread(void *arg)
+{
+    struct bench_worker *worker = arg;
+    size_t frame_size = sizeof(struct aesd_bin_hdr) + config.size;
+    char *frame = malloc(frame_size);
+    uint64_t *sent_at = calloc(config.window, sizeof(uint64_t));
+    uint8_t magic = AESD_BIN_MAGIC;
+    long sent = 0;
+    int sock;
+
+    if (frame == NULL || sent_at == NULL || (sock = bench_connect()) < 0)
+    {
+        worker->failed = 1;
+        free(frame);
+        free(sent_at);
+        return NULL;
+    }
+
+    struct aesd_bin_hdr *hdr = (struct aesd_bin_hdr *) frame;
+    memset(frame, 'x', frame_size);
+    hdr->type = AESD_BIN_APPEND_NOECHO;
+    hdr->status = 0;
+    hdr->reserved = 0;
+    hdr->length = htonl(config.size);
+    frame[frame_size - 1] = '\n';
+
+    if (send_all(sock, &magic, 1) < 0)
+    {
+        worker->failed = 1;
+    }
+
+    // replies come back in request order, so request n is slot n % window
+    while (!worker->failed && worker->completed < config.requests)
+    {
+        while (sent < config.requests && sent - worker->completed < config.window)
+        {
+            sent_at[sent % config.window] = now_ns();
+            if (send_all(sock, frame, frame_size) < 0)
+            {
+                worker->failed = 1;
+                break;
+            }
+            sent++;
+        }
+
+        struct aesd_bin_hdr reply;
+        if (worker->failed || recv_all(sock, &reply, sizeof(reply)) < 0 || reply.status != AESD_BIN_OK)
+        {
+            worker->failed = 1;
+            break;
+        }
+        worker->latency_ns[worker->completed] = now_ns() - sent_at[worker->completed % config.window];
+        worker->completed++;
+    }
+
+    close(sock);
+    free(frame);
+    free(sent_at);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *sorted, long count, double p)
+{
+    long index = (long) (p * (count - 1));
+    return sorted[index] / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    // Nagle would hold back pipelined requests unless -o says otherwise
+    sockopts.nodelay = true;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "H:P:U:o:c:n:s:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H':
+                config.host = optarg;
+                break;
+            case 'P':
+                config.port = optarg;
+                break;
+            case 'U':
+                config.unix_path = optarg;
+                break;
+            case 'o':
+                // client side socket options, same syntax as aesdsocket -o
+                if (sockopts_parse(optarg) < 0)
+                {
+                    fprintf(stderr, "invalid socket options %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                config.sockopts = optarg;
+                break;
+            case 'c':
+                config.connections = atoi(optarg);
+                break;
+            case 'n':
+                config.requests = atol(optarg);
+                break;
+            case 's':
+                config.size = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                config.window = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-H host] [-P port] [-U unix_socket_path] [-o socket_options] [-c connections]\n"
+                        "          [-n requests_per_connection] [-s payload_bytes] [-w requests_in_flight]\n",
+                        argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (config.connections < 1 || config.requests < 1 || config.size < 1 || config.window < 1)
+    {
+        fprintf(stderr, "connections, requests, size and window must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct bench_worker *workers = calloc(config.connections, sizeof(struct bench_worker));
+    if (workers == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < config.connections; i++)
+    {
+        workers[i].latency_ns = malloc(config.requests * sizeof(uint64_t));
+        if (workers[i].latency_ns == NULL || pthread_create(&workers[i].thread, NULL, bench_thread, &workers[i]) != 0)
+        {
+            perror("aesdbench");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    long total = 0;
+    int failed = 0;
+    for (int i = 0; i < config.connections; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        total += workers[i].completed;
+        failed += workers[i].failed;
+    }
+    double elapsed_s = (now_ns() - start) / 1e9;
+
+    uint64_t *all = malloc((total ? total : 1) * sizeof(uint64_t));
+    long n = 0;
+    for (int i = 0; i < config.connections; i++)
+    {
+        memcpy(all + n, workers[i].latency_ns, workers[i].completed * sizeof(uint64_t));
+        n += workers[i].completed;
+        free(workers[i].latency_ns);
+    }
+    qsort(all, n, sizeof(uint64_t), compare_u64);
+
+    printf("%s, socket options %s, connections %d, window %d, payload %zu bytes\n", config.unix_path ? "unix" : "tcp",
+           config.sockopts ? config.sockopts : "nodelay=1", config.connections, config.window, config.size);
+    printf("requests %ld in %.3f s: %.0f req/s, %.2f MB/s\n", total, elapsed_s, total / elapsed_s,
+           total * config.size / elapsed_s / 1e6);
+    if (n > 0)
+    {
+        printf("latency us: p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n", percentile_us(all, n, 0.50),
+               percentile_us(all, n, 0.90), percentile_us(all, n, 0.99), percentile_us(all, n, 0.999),
+               all[n - 1] / 1000.0);
+    }
+    if (failed)
+    {
+        printf("%d connections failed\n", failed);
+    }
+
+    free(all);
+    free(workers);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -2,14 +2,32 @@
 // Created by Fleming on 2024-08-11.
 //
 
+// memrchr is a GNU extension
+#define _GNU_SOURCE
+
 #include "../aesd-char-driver/aesd_ioctl.h"
+#include "aesd_protocol.h"
+#include "aesd_threads.h"
+#include "conn_limits.h"
+#include "filter.h"
+#include "handoff.h"
+#include "listeners.h"
+#include "log.h"
+#include "metrics.h"
+#include "reply_queue.h"
+#include "sockopts.h"
+#include "store_sched.h"
+#include "stores.h"
+#include "subscribe.h"
 
 #include <arpa/inet.h>
+#include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,19 +36,13 @@
 #include <unistd.h>
 
 
-#if USE_AESD_CHAR_DEVICE
-#define FILE_PATH "/dev/aesdchar"
-#else
-#define FILE_PATH "/var/tmp/aesdsocketdata"
-#endif
-
 #define PID_FILE "/var/run/aesdsocket.pid"
 #define PORT 9000
 #define BUF_SIZE 1024
 #define INITIAL_BUFFER_SIZE 1024
+#define SHRINK_BUFFER_SIZE 65536
 
 volatile sig_atomic_t keep_running = 1;
-pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;// mutex for file operations
 
 
 /**
@@ -42,40 +54,138 @@ typedef struct dynamic_buffer {
     size_t capacity;
 } dynamic_buffer_t;
 
-void init_buffer(dynamic_buffer_t *buffer)
+/**
+ * @return 0 on success, -1 if memory is exhausted or the global buffer limit is reached
+ */
+int init_buffer(dynamic_buffer_t *buffer)
 {
-    buffer->data = malloc(INITIAL_BUFFER_SIZE);
     buffer->size = 0;
+    buffer->capacity = 0;
+    buffer->data = NULL;
+
+    if (limits_reserve(INITIAL_BUFFER_SIZE) < 0)
+    {
+        return -1;
+    }
+    buffer->data = threads_buffer_alloc(INITIAL_BUFFER_SIZE);
+    if (buffer->data == NULL)
+    {
+        limits_release(INITIAL_BUFFER_SIZE);
+        return -1;
+    }
     buffer->capacity = INITIAL_BUFFER_SIZE;
+    return 0;
 }
 
 void free_buffer(dynamic_buffer_t *buffer)
 {
-    free(buffer->data);
+    threads_buffer_free(buffer->data, buffer->capacity);
+    limits_release(buffer->capacity);
+    buffer->data = NULL;
     buffer->size = 0;
     buffer->capacity = 0;
 }
 
-void append_to_buffer(dynamic_buffer_t *buffer, const char *data, size_t data_size)
+/**
+ * empty the buffer, giving back the memory grown for an unusually large packet
+ */
+void reset_buffer(dynamic_buffer_t *buffer)
 {
-    while (buffer->size + data_size > buffer->capacity)
+    buffer->size = 0;
+    if (buffer->capacity > SHRINK_BUFFER_SIZE)
     {
-        buffer->capacity *= 2;
-        buffer->data = realloc(buffer->data, buffer->capacity);
+        char *data = threads_buffer_realloc(buffer->data, buffer->capacity, INITIAL_BUFFER_SIZE);
+        if (data)
+        {
+            limits_release(buffer->capacity - INITIAL_BUFFER_SIZE);
+            buffer->data = data;
+            buffer->capacity = INITIAL_BUFFER_SIZE;
+        }
     }
-    memcpy(buffer->data + buffer->size, data, data_size);
-    buffer->size += data_size;
 }
 
-int message_complete(const dynamic_buffer_t *buffer)
+/**
+ * @return LIMITS_DROP_NONE on success, LIMITS_DROP_OVERSIZE if the buffer would
+ * outgrow the per connection limit, LIMITS_DROP_MEMORY if memory is exhausted or
+ * the global buffer limit is reached
+ */
+enum limits_drop_reason append_to_buffer(dynamic_buffer_t *buffer, const char *data, size_t data_size)
 {
-    if (buffer->size > 0 && buffer->data[buffer->size - 1] == '\n')
+    size_t capacity = buffer->capacity;
+    while (buffer->size + data_size > capacity)
     {
-        return 1;
+        capacity *= 2;
     }
-    return 0;
+
+    if (capacity != buffer->capacity)
+    {
+        if (limits.max_conn_buffer && capacity > limits.max_conn_buffer)
+        {
+            return LIMITS_DROP_OVERSIZE;
+        }
+        if (limits_reserve(capacity - buffer->capacity) < 0)
+        {
+            return LIMITS_DROP_MEMORY;
+        }
+        char *grown = threads_buffer_realloc(buffer->data, buffer->capacity, capacity);
+        if (grown == NULL)
+        {
+            limits_release(capacity - buffer->capacity);
+            return LIMITS_DROP_MEMORY;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, data_size);
+    buffer->size += data_size;
+    return LIMITS_DROP_NONE;
 }
 
+/**
+ * Client connection
+ */
+typedef struct connection {
+    int sock;
+    /**
+     * the store the connection is bound to and its own descriptor of it
+     */
+    struct store *store;
+    int device_fd;
+    /**
+     * the client sent its first packet, it can no longer pick another store
+     */
+    bool store_chosen;
+    dynamic_buffer_t buffer;
+    struct reply_queue replies;
+    struct metrics_slot *slot;
+    struct conn_timer timer;
+    struct sched_flow flow;
+    struct token_bucket rate_bytes;
+    struct token_bucket rate_packets;
+    /**
+     * why the connection is being dropped, if a limit was hit
+     */
+    enum limits_drop_reason drop_reason;
+    /**
+     * set when the connection is to be passed on to a new instance
+     */
+    enum handoff_kind handoff;
+} connection_t;
+
+/**
+ * handle_client() argument, a connection accepted here or handed over by the
+ * previous instance together with the data it already received
+ */
+typedef struct client_start {
+    int sock;
+    enum handoff_kind kind;
+    struct store *store;
+    bool store_chosen;
+    char *pending;
+    size_t pending_length;
+} client_start_t;
+
 /**
  * thread list
  */
@@ -94,7 +204,7 @@ thread_list_t thread_list = {.head = NULL};
 
 void add_thread(pthread_t thread_id)
 {
-    syslog(LOG_DEBUG, "adding thread %lu", (unsigned long) thread_id);
+    LOG_DBG("adding thread %lu", (unsigned long) thread_id);
     thread_node_t *new_node = malloc(sizeof(thread_node_t));
     new_node->thread_id = thread_id;
 
@@ -123,7 +233,7 @@ void remove_thread(pthread_t thread_id)
             {
                 atomic_store(&thread_list.head, to_free->next);
             }
-            syslog(LOG_DEBUG, "removing thread %lu", (unsigned long) thread_id);
+            LOG_DBG("removing thread %lu", (unsigned long) thread_id);
             free(to_free);
             break;
         }
@@ -134,14 +244,14 @@ void remove_thread(pthread_t thread_id)
 
 void clean_up_threads()
 {
-    syslog(LOG_DEBUG, "cleaning up threads if any...");
+    LOG_DBG("cleaning up threads if any...");
     thread_node_t *current = atomic_load(&thread_list.head);
     while (current)
     {
         pthread_join(current->thread_id, NULL);
         thread_node_t *to_free = current;
         current = current->next;
-        syslog(LOG_DEBUG, "removing thread %lu", (unsigned long) to_free->thread_id);
+        LOG_DBG("removing thread %lu", (unsigned long) to_free->thread_id);
         free(to_free);
     }
 }
@@ -155,6 +265,11 @@ void handle_signal(int signal)
     }
 }
 
+void handle_wakeup(int signal)
+{
+    // only interrupts blocking calls, see HANDOFF_SIGNAL
+}
+
 void write_pid()
 {
     FILE *pid_file = fopen(PID_FILE, "w");
@@ -168,14 +283,6 @@ void write_pid()
     }
 }
 
-void remove_test_file()
-{
-    if (remove(FILE_PATH) != 0)
-    {
-        syslog(LOG_ERR, "failed to remove file %s: %m", FILE_PATH);
-    }
-}
-
 void write_timestamp()
 {
     time_t current_time;
@@ -188,25 +295,53 @@ void write_timestamp()
     // format the time string according to RFC 2822
     strftime(time_string, sizeof(time_string), "timestamp:%a, %d %b %Y %H:%M:%S %z\n", time_info);
 
-    pthread_mutex_lock(&file_lock);
+    // named stores only hold what their clients sent
+    struct store *store = stores_default();
+    pthread_mutex_lock(&store->lock);
 
-    FILE *file = fopen(FILE_PATH, "a+");
+    FILE *file = fopen(store->path, "a+");
     if (file == NULL)
     {
-        syslog(LOG_ERR, "failed to open file %s for timestamp writing: %m", FILE_PATH);
-        pthread_mutex_unlock(&file_lock);
+        syslog(LOG_ERR, "failed to open file %s for timestamp writing: %m", store->path);
+        pthread_mutex_unlock(&store->lock);
         return;
     }
 
     if (fwrite(time_string, 1, strlen(time_string), file) != strlen(time_string))
     {
-        syslog(LOG_ERR, "failed to write timestamp to file %s: %m", FILE_PATH);
+        syslog(LOG_ERR, "failed to write timestamp to file %s: %m", store->path);
+    }
+#if !(USE_AESD_CHAR_DEVICE)
+    else if (store_index_append(&store->index, time_string, strlen(time_string)) < 0 ||
+             store_times_stamp(&store->times, store->index.count, metrics_now_ns()) < 0)
+    {
+        syslog(LOG_ERR, "failed to index timestamp");
+    }
+#endif
+    else
+    {
+        subscribe_publish(&store->followers, time_string, strlen(time_string));
     }
 
     fflush(file);// ensure data is written to disk
     fclose(file);
 
-    pthread_mutex_unlock(&file_lock);
+    pthread_mutex_unlock(&store->lock);
+}
+
+/**
+ * save the sidecars of every store, a crash loses at most the entries of the
+ * last interval from them
+ */
+void save_stores()
+{
+    for (int i = 0; i < stores_count(); i++)
+    {
+        struct store *store = stores_get(i);
+        pthread_mutex_lock(&store->lock);
+        stores_save(store);
+        pthread_mutex_unlock(&store->lock);
+    }
 }
 
 pthread_cond_t timer_cond = PTHREAD_COND_INITIALIZER;
@@ -234,6 +369,7 @@ void *timestamp_thread(void *arg)
         {
             // timeout occurred, write the timestamp
             write_timestamp();
+            save_stores();
         } else if (rc == 0)
         {
             // condition was signaled, check if we should exit
@@ -250,305 +386,1454 @@ void *timestamp_thread(void *arg)
     return NULL;
 }
 
-void *handle_client(void *arg)
+/**
+ * receive exactly @param len bytes unless the peer closes the connection
+ * @param handoff_point nothing was received of the current packet yet, the
+ *      connection can be handed over instead: returns -1 with errno EINTR
+ * @return number of bytes received (less than @param len on EOF), -1 on error
+ */
+ssize_t recv_exact(connection_t *conn, void *data, size_t len, bool handoff_point)
 {
-    int client_sock = (intptr_t) arg;
-    dynamic_buffer_t buffer;
-    init_buffer(&buffer);
-
-    char recv_buffer[BUF_SIZE];
-    ssize_t bytes_received;
-
-    pthread_t self_id = pthread_self();
-
-    // open the device file at the start of the client session
-    pthread_mutex_lock(&file_lock);
-    int device_fd = open(FILE_PATH, O_RDWR);
-    if (device_fd == -1)
-    {
-        syslog(LOG_ERR, "failed to open %s: %m", FILE_PATH);
-        pthread_mutex_unlock(&file_lock);
-        goto error_cleanup;
-    }
-    pthread_mutex_unlock(&file_lock);
-
-    while ((bytes_received = recv(client_sock, recv_buffer, BUF_SIZE, 0)) > 0)
+    size_t total_received = 0;
+    while (total_received < len)
     {
-        // check for the special IOCTL command format
-        if (strncmp(recv_buffer, "AESDCHAR_IOCSEEKTO:", 19) == 0)
+        ssize_t bytes_received = recv(conn->sock, (char *) data + total_received, len - total_received, 0);
+        if (bytes_received == 0)
         {
-            unsigned int write_cmd, write_cmd_offset;
-            if (sscanf(recv_buffer + 19, "%u,%u", &write_cmd, &write_cmd_offset) == 2)
-            {
-                struct aesd_seekto seekto = {
-                        .write_cmd = write_cmd,
-                        .write_cmd_offset = write_cmd_offset};
-
-                pthread_mutex_lock(&file_lock);
-
-                // send ioctl to the driver using the same file descriptor
-                if (ioctl(device_fd, AESDCHAR_IOCSEEKTO, &seekto) == -1)
-                {
-                    syslog(LOG_ERR, "ioctl failed: %m");
-                    pthread_mutex_unlock(&file_lock);
-                    goto error_cleanup;
-                }
-
-                // read from the new seek position in the device and send to client
-                char file_buffer[BUF_SIZE];
-                ssize_t bytes_read;
-                while ((bytes_read = read(device_fd, file_buffer, sizeof(file_buffer))) > 0)
-                {
-                    ssize_t total_sent = 0;
-                    while (total_sent < bytes_read)
-                    {
-                        ssize_t bytes_sent = send(client_sock, file_buffer + total_sent, bytes_read - total_sent, 0);
-                        if (bytes_sent < 0)
-                        {
-                            syslog(LOG_ERR, "send failed: %m");
-                            pthread_mutex_unlock(&file_lock);
-                            goto error_cleanup;
-                        }
-                        total_sent += bytes_sent;
-                    }
-                }
-
-                pthread_mutex_unlock(&file_lock);
-                continue;// proceed to next iteration without writing the command to the device
-            } else
-            {
-                syslog(LOG_ERR, "invalid IOCTL command format received");
-                goto error_cleanup;
-            }
+            break;
         }
-
-        // append the received data to the dynamic buffer
-        append_to_buffer(&buffer, recv_buffer, bytes_received);
-
-        // check if the message is complete
-        if (message_complete(&buffer))
+        if (bytes_received < 0)
         {
-            pthread_mutex_lock(&file_lock);
-
-            // seek to the end of the file before writing
-            lseek(device_fd, 0, SEEK_END);
-
-            // write the buffer content to the device
-            ssize_t bytes_written = write(device_fd, buffer.data, buffer.size);
-            if (bytes_written != buffer.size)
-            {
-                syslog(LOG_ERR, "failed to write data to device %s: %m", FILE_PATH);
-                pthread_mutex_unlock(&file_lock);
-                goto error_cleanup;
-            }
-
-            // seek to the beginning of the file before reading
-            lseek(device_fd, 0, SEEK_SET);
-
-            // read the entire device content and send it to the client
-            char file_buffer[BUF_SIZE];
-            ssize_t bytes_read;
-            while ((bytes_read = read(device_fd, file_buffer, sizeof(file_buffer))) > 0)
+            if (errno == EINTR && !(handoff_point && total_received == 0 && handoff_pending()))
             {
-                ssize_t total_sent = 0;
-                while (total_sent < bytes_read)
-                {
-                    ssize_t bytes_sent = send(client_sock, file_buffer + total_sent, bytes_read - total_sent, 0);
-                    if (bytes_sent < 0)
-                    {
-                        syslog(LOG_ERR, "send failed: %m");
-                        pthread_mutex_unlock(&file_lock);
-                        goto error_cleanup;
-                    }
-                    total_sent += bytes_sent;
-                }
+                continue;
             }
-
-            // after reading, seek back to the end for future writes
-            lseek(device_fd, 0, SEEK_END);
-
-            pthread_mutex_unlock(&file_lock);
-
-            // reset the buffer after processing
-            buffer.size = 0;
+            return -1;
         }
+        total_received += bytes_received;
+        // a request is in progress until it has been executed
+        limits_touch(&conn->timer, 1);
     }
+    metrics_add(&conn->slot->bytes_in, total_received);
+    return total_received;
+}
+
+#if USE_AESD_CHAR_DEVICE
+/**
+ * lseek() through the driver's AESDCHAR_IOCLLSEEK ioctl, which also works when
+ * /dev/aesdchar is served by the CUSE daemon that cannot forward lseek()
+ * @return the new position, -1 on failure
+ */
+off_t device_lseek(int device_fd, off_t offset, int whence)
+{
+    struct aesd_llseek llseek = {
+            .offset = offset,
+            .whence = whence};
 
-    if (bytes_received == 0)
+    if (ioctl(device_fd, AESDCHAR_IOCLLSEEK, &llseek) == -1)
     {
-        syslog(LOG_INFO, "Client %d disconnected gracefully", client_sock);
-    } else if (bytes_received < 0)
+        LOG_RL(LOG_ERR, "llseek ioctl failed: %m");
+        return -1;
+    }
+    return llseek.offset;
+}
+#endif
+
+/**
+ * append @param len bytes of @param data to the store
+ * must be called with store->lock held
+ * @return the new size of the store, -1 on failure
+ */
+off_t store_append(struct store *store, int device_fd, const char *data, size_t len)
+{
+#if USE_AESD_CHAR_DEVICE
+    // seek to the end of the file before writing
+    device_lseek(device_fd, 0, SEEK_END);
+#endif
+
+    if (write(device_fd, data, len) != len)
     {
-        syslog(LOG_ERR, "recv failed: %m");
+        syslog(LOG_ERR, "failed to write data to device %s: %m", store->path);
+        return -1;
     }
 
-    // clean up resources
-    free_buffer(&buffer);
-    pthread_mutex_lock(&file_lock);
-    close(device_fd);
-    pthread_mutex_unlock(&file_lock);
-    close(client_sock);
-    return NULL;
+    // followers get the packet as soon as it is committed
+    subscribe_publish(&store->followers, data, len);
 
-error_cleanup:
-    free_buffer(&buffer);
-    pthread_mutex_lock(&file_lock);
-    if (device_fd != -1)
-        close(device_fd);
-    pthread_mutex_unlock(&file_lock);
-    close(client_sock);
-    remove_thread(self_id);
-    return NULL;
+#if USE_AESD_CHAR_DEVICE
+    return device_lseek(device_fd, 0, SEEK_END);
+#else
+    // the file is opened with O_APPEND and its size is tracked by the index,
+    // the clock is read under the store lock so ingest times never go backwards
+    if (store_index_append(&store->index, data, len) < 0 ||
+        store_times_stamp(&store->times, store->index.count, metrics_now_ns()) < 0)
+    {
+        syslog(LOG_ERR, "failed to index data written to %s", store->path);
+        return -1;
+    }
+    return store->index.size;
+#endif
 }
 
+/**
+ * must be called with store->lock held
+ * @return the current size of the store
+ */
+off_t store_size(struct store *store, int device_fd)
+{
+#if USE_AESD_CHAR_DEVICE
+    return device_lseek(device_fd, 0, SEEK_END);
+#else
+    return store->index.size;
+#endif
+}
 
-int main(int argc, char *argv[])
+/**
+ * position @param device_fd at write command @param write_cmd, offset @param write_cmd_offset
+ * must be called with store->lock held
+ * @return the new position, -1 on failure
+ */
+off_t store_seek(struct store *store, int device_fd, uint32_t write_cmd, uint32_t write_cmd_offset)
 {
-    int daemonize = 0;
+#if !(USE_AESD_CHAR_DEVICE)
+    // served from the entry index, only the entries after the closest checkpoint are read
+    return store_index_lookup(&store->index, device_fd, write_cmd, write_cmd_offset);
+#else
+    // the driver is authoritative, other processes may write to the device too
+    struct aesd_seekto seekto = {
+            .write_cmd = write_cmd,
+            .write_cmd_offset = write_cmd_offset};
 
-    int opt;
-    while ((opt = getopt(argc, argv, "d")) != -1)
+    // send ioctl to the driver using the same file descriptor
+    if (ioctl(device_fd, AESDCHAR_IOCSEEKTO, &seekto) == -1)
     {
-        switch (opt)
-        {
-            case 'd':
-                daemonize = 1;
-                break;
-            default:
-                fprintf(stderr, "Usage: %s [-d]\n", argv[0]);
-                exit(EXIT_FAILURE);
-        }
+        LOG_RL(LOG_ERR, "ioctl failed: %m");
+        return -1;
     }
+    return device_lseek(device_fd, 0, SEEK_CUR);
+#endif
+}
 
-    // initialize syslog for logging
-    openlog("aesdsocket", LOG_PID | LOG_CONS, LOG_USER);
-
-    // set up SIGINT handler
-    struct sigaction sa;
-    sa.sa_handler = handle_signal;
-    sa.sa_flags = 0;
-    sigemptyset(&sa.sa_mask);
+/**
+ * position @param device_fd at the first entry ingested at or after @param time_ns,
+ * in ns of CLOCK_MONOTONIC or, if negative, ns before now
+ * must be called with store->lock held
+ * @return the new position, the end of the store if every entry is older, -1 on failure
+ */
+off_t store_seek_time(struct store *store, int device_fd, int64_t time_ns)
+{
+    uint64_t now_ns = metrics_now_ns();
 
-    if (sigaction(SIGINT, &sa, NULL) == -1)
+    if (time_ns < 0)
     {
-        syslog(LOG_ERR, "error: cannot handle SIGINT: %m");
-        return EXIT_FAILURE;
+        time_ns = (uint64_t) -time_ns < now_ns ? (int64_t) (now_ns + time_ns) : 0;
     }
 
-    if (sigaction(SIGTERM, &sa, NULL) == -1)
+#if !(USE_AESD_CHAR_DEVICE)
+    // binary search over the stamps, then the entry index finds the entry
+    int64_t entry = store_times_find(&store->times, time_ns);
+    if (entry < 0)
     {
-        syslog(LOG_ERR, "error: cannot handle SIGTERM: %m");
-        return EXIT_FAILURE;
+        LOG_RL(LOG_ERR, "failed to read ingest times from %s: %m", store->times_path);
+        return -1;
     }
-
-    // daemonize if the -d flag was set
-    if (daemonize)
+    if ((uint64_t) entry >= store->index.count)
     {
-        syslog(LOG_INFO, "starting sever in demon mode");
-        pid_t pid = fork();
-        if (pid < 0)
-        {
-            syslog(LOG_ERR, "failed to fork process for daemon mode: %m");
-            return EXIT_FAILURE;
-        }
-        if (pid > 0)
-        {
-            // parent process exits
-            exit(EXIT_SUCCESS);
-        }
-
-        // child process continues (daemon)
-        // create a new session and set the process group
-        if (setsid() < 0)
-        {
-            syslog(LOG_ERR, "failed to create new session: %m");
-            return EXIT_FAILURE;
-        }
-
-        // change the working directory to the root
-        if (chdir("/") < 0)
-        {
-            syslog(LOG_ERR, "failed to change directory to root: %m");
-            return EXIT_FAILURE;
-        }
-
-        // redirect standard file descriptors to /dev/null
-        close(STDIN_FILENO);
-        close(STDOUT_FILENO);
-        close(STDERR_FILENO);
-
-        int null_fd = open("/dev/null", O_RDWR);
-        dup2(null_fd, STDIN_FILENO);
-        dup2(null_fd, STDOUT_FILENO);
-        dup2(null_fd, STDERR_FILENO);
-
-        syslog(LOG_INFO, "effective UID: %d", geteuid());
-        write_pid();
+        return store->index.size;
     }
+    return store_index_lookup(&store->index, device_fd, entry, 0);
+#else
+    struct aesd_seektime seektime = {.time_ns = time_ns};
 
-#if !(USE_AESD_CHAR_DEVICE)
-    pthread_t timestamp_tid;
-    if (pthread_create(&timestamp_tid, NULL, timestamp_thread, NULL) != 0)
+    if (ioctl(device_fd, AESDCHAR_IOCSEEKTIME, &seektime) == -1)
     {
-        syslog(LOG_ERR, "failed to create timestamp thread: %m");
-        return EXIT_FAILURE;
+        LOG_RL(LOG_ERR, "ioctl failed: %m");
+        return -1;
     }
-    add_thread(timestamp_tid);
+    return device_lseek(device_fd, 0, SEEK_CUR);
 #endif
+}
 
-    int server_sock;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0)
+/**
+ * end of the window of @param length bytes (0 for unbounded) starting at @param start
+ * must be called with store->lock held
+ */
+off_t seek_window_end(struct store *store, int device_fd, off_t start, uint32_t length)
+{
+    off_t end = store_size(store, device_fd);
+    if (length != 0 && length < end - start)
     {
-        syslog(LOG_ERR, "socket creation failed: %m");
-        exit(EXIT_FAILURE);
+        end = start + length;
     }
+    return end;
+}
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(PORT);
-
-    if (bind(server_sock, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0)
+/**
+ * store range of write commands [@param first_cmd, @param last_cmd), where
+ * @param last_cmd 0 is the end of the store
+ * must be called with store->lock held
+ * @return 0 on success, -1 if either write command does not exist
+ */
+int filter_range(struct store *store, int device_fd, uint32_t first_cmd, uint32_t last_cmd, off_t *start, off_t *end)
+{
+    *end = last_cmd == 0 ? store_size(store, device_fd) : store_seek(store, device_fd, last_cmd, 0);
+    // an empty store has no write command 0 to seek to
+    *start = first_cmd == 0 ? 0 : store_seek(store, device_fd, first_cmd, 0);
+    if (*start < 0 || *end < 0 || (last_cmd != 0 && last_cmd <= first_cmd))
     {
-        syslog(LOG_ERR, "bind failed: %m");
-        close(server_sock);
-        exit(EXIT_FAILURE);
+        return -1;
     }
+    return 0;
+}
 
-    if (listen(server_sock, 10) < 0)
+/**
+ * build a reply carrying the store range [@param start, @param end)
+ * must be called with store->lock held
+ * @return the reply, NULL on allocation failure
+ */
+struct reply *store_reply(int device_fd, off_t start, off_t end, uint64_t start_ns)
+{
+    struct reply *reply = reply_new(start_ns);
+    if (reply == NULL)
     {
-        syslog(LOG_ERR, "listen failed: %m");
-        close(server_sock);
-        exit(EXIT_FAILURE);
+        return NULL;
     }
+    reply->length = end > start ? end - start : 0;
 
-    syslog(LOG_INFO, "server listening on port %d", PORT);
-
-    while (keep_running)
+#if USE_AESD_CHAR_DEVICE
+    // the device evicts old entries, offsets are only stable while the lock is held
+    size_t copied = 0;
+    reply->data = malloc(reply->length + 1);
+    if (reply->data == NULL)
     {
-        int client_sock = accept(server_sock, (struct sockaddr *) &client_addr, &client_addr_len);
-        if (client_sock < 0)
+        reply_free(reply);
+        return NULL;
+    }
+    if (device_lseek(device_fd, start, SEEK_SET) < 0)
+    {
+        reply->length = 0;
+    }
+    while (copied < reply->length)
+    {
+        ssize_t bytes_read = read(device_fd, reply->data + copied, reply->length - copied);
+        if (bytes_read <= 0)
         {
-            if (keep_running)
+            break;
+        }
+        copied += bytes_read;
+    }
+    reply->length = copied;
+#else
+    // the file is append only, the range can be sent after the lock is dropped
+    reply->store_fd = device_fd;
+    reply->offset = start;
+#endif
+    return reply;
+}
+
+/**
+ * build a binary protocol reply for the store range [@param start, @param end)
+ * must be called with store->lock held
+ */
+struct reply *bin_reply(int device_fd, uint8_t type, uint8_t status, off_t start, off_t end, uint64_t start_ns)
+{
+    struct reply *reply = status == AESD_BIN_OK ? store_reply(device_fd, start, end, start_ns) : reply_new(start_ns);
+    if (reply)
+    {
+        reply->has_hdr = true;
+        reply->hdr.type = type;
+        reply->hdr.status = status;
+        reply->hdr.length = htonl(reply->length);
+    }
+    return reply;
+}
+
+/**
+ * execute one binary request whose payload is in @param payload
+ * must be called with store->lock held
+ * @return the reply to queue, NULL on allocation failure
+ */
+struct reply *do_bin_request(struct store *store, int device_fd, uint8_t type, const dynamic_buffer_t *payload, uint64_t start_ns)
+{
+    off_t start, end;
+
+    switch (type)
+    {
+        case AESD_BIN_APPEND:
+        case AESD_BIN_APPEND_NOECHO:
+            end = store_append(store, device_fd, payload->data, payload->size);
+            if (end < 0)
+            {
+                return bin_reply(device_fd, type, AESD_BIN_EIO, 0, 0, start_ns);
+            }
+            return bin_reply(device_fd, type, AESD_BIN_OK, 0, type == AESD_BIN_APPEND ? end : 0, start_ns);
+
+        case AESD_BIN_READ:
+        {
+            struct aesd_bin_read req;
+            if (payload->size != sizeof(req))
+            {
+                return bin_reply(device_fd, type, AESD_BIN_EINVAL, 0, 0, start_ns);
+            }
+            memcpy(&req, payload->data, sizeof(req));
+            end = store_size(store, device_fd);
+            // compared before it is converted, an offset of 2^63 or more would turn negative in an off_t
+            if (end < 0 || be64toh(req.offset) > (uint64_t) end)
+            {
+                return bin_reply(device_fd, type, AESD_BIN_EINVAL, 0, 0, start_ns);
+            }
+            start = be64toh(req.offset);
+            if (ntohl(req.length) != 0 && ntohl(req.length) < end - start)
+            {
+                end = start + ntohl(req.length);
+            }
+            return bin_reply(device_fd, type, AESD_BIN_OK, start, end, start_ns);
+        }
+
+        case AESD_BIN_SEEK:
+        {
+            struct aesd_bin_seek req = {0};
+            // the trailing length is optional
+            if (payload->size != sizeof(req) && payload->size != offsetof(struct aesd_bin_seek, length))
+            {
+                return bin_reply(device_fd, type, AESD_BIN_EINVAL, 0, 0, start_ns);
+            }
+            memcpy(&req, payload->data, payload->size);
+            start = store_seek(store, device_fd, ntohl(req.write_cmd), ntohl(req.write_cmd_offset));
+            if (start < 0)
+            {
+                return bin_reply(device_fd, type, AESD_BIN_EINVAL, 0, 0, start_ns);
+            }
+            end = seek_window_end(store, device_fd, start, ntohl(req.length));
+            return bin_reply(device_fd, type, AESD_BIN_OK, start, end, start_ns);
+        }
+
+        case AESD_BIN_FILTER:
+        {
+            struct aesd_bin_filter req;
+            struct filter *filter;
+            struct reply *reply;
+            if (payload->size < sizeof(req))
+            {
+                return bin_reply(device_fd, type, AESD_BIN_EINVAL, 0, 0, start_ns);
+            }
+            memcpy(&req, payload->data, sizeof(req));
+            if (filter_range(store, device_fd, ntohl(req.first_cmd), ntohl(req.last_cmd), &start, &end) < 0 ||
+                (filter = filter_new(req.mode, payload->data + sizeof(req), payload->size - sizeof(req))) == NULL)
+            {
+                return bin_reply(device_fd, type, AESD_BIN_EINVAL, 0, 0, start_ns);
+            }
+            reply = bin_reply(device_fd, type, AESD_BIN_OK, start, end, start_ns);
+            if (reply == NULL)
+            {
+                free(filter);
+                return NULL;
+            }
+            reply->filter = filter;
+            return reply;
+        }
+
+        case AESD_BIN_SEEK_TIME:
+        {
+            struct aesd_bin_seek_time req = {0};
+            // the trailing length is optional
+            if (payload->size != sizeof(req) && payload->size != offsetof(struct aesd_bin_seek_time, length))
+            {
+                return bin_reply(device_fd, type, AESD_BIN_EINVAL, 0, 0, start_ns);
+            }
+            memcpy(&req, payload->data, payload->size);
+            start = store_seek_time(store, device_fd, (int64_t) be64toh(req.time_ns));
+            if (start < 0)
+            {
+                return bin_reply(device_fd, type, AESD_BIN_EIO, 0, 0, start_ns);
+            }
+            end = seek_window_end(store, device_fd, start, ntohl(req.length));
+            return bin_reply(device_fd, type, AESD_BIN_OK, start, end, start_ns);
+        }
+
+        default:
+            return bin_reply(device_fd, type, AESD_BIN_EINVAL, 0, 0, start_ns);
+    }
+}
+
+/**
+ * turn the connection into a follower of the store: queue a snapshot of the
+ * whole store, then every packet appended after it, until the client
+ * disconnects. Anything the client sends from now on is ignored.
+ * @param binary frame the snapshot and the packets with binary protocol headers
+ * @return 0 when the client disconnected, -1 on error
+ */
+int follow_store(connection_t *conn, bool binary)
+{
+    struct subscriber follower;
+    char discard[BUF_SIZE];
+
+    uint64_t start_ns = metrics_now_ns();
+    metrics_lock(&conn->store->lock, conn->slot);
+    off_t end = store_size(conn->store, conn->device_fd);
+    struct reply *snapshot = NULL;
+    if (end >= 0)
+    {
+        snapshot = binary ? bin_reply(conn->device_fd, AESD_BIN_SUBSCRIBE, AESD_BIN_OK, 0, end, start_ns)
+                          : store_reply(conn->device_fd, 0, end, start_ns);
+    }
+    // queued under the lock, so no published packet can overtake it
+    if (snapshot == NULL || reply_queue_try_push(&conn->replies, snapshot, true) < 0 ||
+        subscribe_add(&conn->store->followers, &follower, &conn->replies, conn->sock, binary) < 0)
+    {
+        pthread_mutex_unlock(&conn->store->lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&conn->store->lock);
+
+    limits_touch(&conn->timer, 0);
+    atomic_store_explicit(&conn->timer.idle_exempt, true, memory_order_relaxed);
+
+    for (;;)
+    {
+        ssize_t bytes_received = recv(conn->sock, discard, sizeof(discard), 0);
+        if (bytes_received < 0 && errno == EINTR)
+        {
+            // followers are not handed over, they subscribe again to the new instance
+            if (handoff_pending())
+            {
+                break;
+            }
+            continue;
+        }
+        if (bytes_received <= 0)
+        {
+            break;
+        }
+        metrics_add(&conn->slot->bytes_in, bytes_received);
+    }
+
+    subscribe_remove(&conn->store->followers, &follower);
+    LOG_DBG("follower %d disconnected", conn->sock);
+    return 0;
+}
+
+/**
+ * @return whether clients may send requests of @param type, AESD_BIN_PUBLISH
+ *      only goes from the server to followers
+ */
+bool bin_request_type(uint8_t type)
+{
+    return type >= AESD_BIN_APPEND && type <= AESD_BIN_STORE && type != AESD_BIN_PUBLISH;
+}
+
+/**
+ * wait for the turn of @param conn to commit @param cost bytes of requests to
+ * its store, then take the store lock
+ */
+void store_enter(connection_t *conn, size_t cost)
+{
+    metrics_add(&conn->slot->sched_wait_ns, sched_enter(&conn->store->sched, &conn->flow, cost));
+    metrics_lock(&conn->store->lock, conn->slot);
+}
+
+void store_exit(connection_t *conn)
+{
+    pthread_mutex_unlock(&conn->store->lock);
+    sched_exit(&conn->store->sched);
+}
+
+/**
+ * open the store @param store for @param conn
+ * @return 0 on success, -1 on failure
+ */
+int open_store(connection_t *conn, struct store *store)
+{
+    metrics_lock(&store->lock, conn->slot);
+#if USE_AESD_CHAR_DEVICE
+    conn->device_fd = open(store->path, O_RDWR);
+#else
+    conn->device_fd = open(store->path, O_RDWR | O_APPEND);
+#endif
+    pthread_mutex_unlock(&store->lock);
+    if (conn->device_fd == -1)
+    {
+        syslog(LOG_ERR, "failed to open %s: %m", store->path);
+        return -1;
+    }
+    conn->store = store;
+    return 0;
+}
+
+/**
+ * bind @param conn to the store named by the @param len bytes of @param name
+ * instead of the one of its listener, only before its first packet
+ * @return 0 on success, -1 if there is no such store or it is too late
+ */
+int choose_store(connection_t *conn, const char *name, size_t len)
+{
+    struct store *store = stores_find(name, len), *previous = conn->store;
+    int device_fd = conn->device_fd;
+
+    if (store == NULL || conn->store_chosen)
+    {
+        LOG_RL(LOG_ERR, "client %d cannot switch to store %.*s", conn->sock, (int) len, name);
+        return -1;
+    }
+    conn->store_chosen = true;
+    if (store == conn->store)
+    {
+        return 0;
+    }
+    if (open_store(conn, store) < 0)
+    {
+        conn->device_fd = device_fd;
+        return -1;
+    }
+    pthread_mutex_lock(&previous->lock);
+    close(device_fd);
+    pthread_mutex_unlock(&previous->lock);
+    return 0;
+}
+
+/**
+ * charge the requests just served to the rate limits of @param conn and stop
+ * receiving until it is within them again, TCP flow control then holds the
+ * client back
+ */
+void throttle_client(connection_t *conn, size_t bytes, size_t packets)
+{
+    uint64_t now = metrics_now_ns();
+    uint64_t pause = limits_rate_charge(&conn->rate_bytes, limits.rate_bytes, bytes, now);
+    uint64_t packets_pause = limits_rate_charge(&conn->rate_packets, limits.rate_packets, packets, now);
+
+    if (packets_pause > pause)
+    {
+        pause = packets_pause;
+    }
+    if (pause == 0)
+    {
+        return;
+    }
+
+    // the client is not the one being slow, restart its timers after the pause
+    limits_touch(&conn->timer, 0);
+    limits_rate_pause(pause);
+    limits_touch(&conn->timer, 0);
+    metrics_add(&conn->slot->throttled_ns, metrics_now_ns() - now);
+}
+
+/**
+ * serve a connection that negotiated the binary protocol, parsing requests
+ * and queueing their replies on the connection reply queue
+ * @param negotiated the negotiation byte was consumed by the previous instance
+ * @return 0 when the client disconnected or is to be handed over, -1 on error
+ */
+int serve_binary_client(connection_t *conn, bool negotiated)
+{
+    char recv_buffer[BUF_SIZE];
+    struct aesd_bin_hdr hdr;
+    uint8_t magic;
+
+    // consume the negotiation byte
+    if (!negotiated && recv_exact(conn, &magic, 1, false) != 1)
+    {
+        return -1;
+    }
+    limits_touch(&conn->timer, 0);
+
+    for (;;)
+    {
+        if (handoff_pending())
+        {
+            conn->handoff = HANDOFF_CLIENT_BINARY;
+            return 0;
+        }
+
+        ssize_t bytes_received = recv_exact(conn, &hdr, sizeof(hdr), true);
+        if (bytes_received == 0)
+        {
+            return 0;
+        }
+        if (bytes_received < 0 && errno == EINTR)
+        {
+            conn->handoff = HANDOFF_CLIENT_BINARY;
+            return 0;
+        }
+        if (bytes_received != sizeof(hdr))
+        {
+            LOG_RL(LOG_ERR, "recv failed: %m");
+            return -1;
+        }
+
+        uint32_t length = ntohl(hdr.length);
+        if ((limits.max_packet && length > limits.max_packet) || !bin_request_type(hdr.type))
+        {
+            LOG_RL(LOG_ERR, "invalid binary request type %d length %u", hdr.type, length);
+            if (bin_request_type(hdr.type))
+            {
+                conn->drop_reason = LIMITS_DROP_OVERSIZE;
+            }
+            struct reply *reply = reply_new(metrics_now_ns());
+            if (reply)
+            {
+                reply->has_hdr = true;
+                reply->hdr.type = hdr.type;
+                reply->hdr.status = AESD_BIN_EINVAL;
+                reply_queue_push(&conn->replies, reply);
+            }
+            return -1;
+        }
+
+        reset_buffer(&conn->buffer);
+        while (conn->buffer.size < length)
+        {
+            size_t chunk = length - conn->buffer.size < BUF_SIZE ? length - conn->buffer.size : BUF_SIZE;
+            if (recv_exact(conn, recv_buffer, chunk, false) != chunk)
+            {
+                LOG_RL(LOG_ERR, "client closed connection mid request");
+                return -1;
+            }
+            conn->drop_reason = append_to_buffer(&conn->buffer, recv_buffer, chunk);
+            if (conn->drop_reason != LIMITS_DROP_NONE)
+            {
+                return -1;
+            }
+        }
+
+        if (hdr.type == AESD_BIN_STORE)
+        {
+            struct reply *reply = reply_new(metrics_now_ns());
+            if (reply == NULL)
+            {
+                return -1;
+            }
+            reply->has_hdr = true;
+            reply->hdr.type = hdr.type;
+            reply->hdr.status =
+                    choose_store(conn, conn->buffer.data, conn->buffer.size) < 0 ? AESD_BIN_EINVAL : AESD_BIN_OK;
+            if (reply_queue_push(&conn->replies, reply) < 0)
+            {
+                return -1;
+            }
+            limits_touch(&conn->timer, 0);
+            continue;
+        }
+        conn->store_chosen = true;
+
+        if (hdr.type == AESD_BIN_SUBSCRIBE)
+        {
+            return follow_store(conn, true);
+        }
+
+        uint64_t start_ns = metrics_now_ns();
+        if (hdr.type == AESD_BIN_APPEND || hdr.type == AESD_BIN_APPEND_NOECHO)
+        {
+            metrics_add(&conn->slot->packets, 1);
+        }
+
+        store_enter(conn, sizeof(hdr) + length);
+        struct reply *reply = do_bin_request(conn->store, conn->device_fd, hdr.type, &conn->buffer, start_ns);
+        store_exit(conn);
+        limits_touch(&conn->timer, 0);
+
+        // queue outside the lock, pushing blocks while the client is slow to read
+        if (reply == NULL || reply_queue_push(&conn->replies, reply) < 0)
+        {
+            return -1;
+        }
+        throttle_client(conn, sizeof(hdr) + length, 1);
+    }
+}
+
+/**
+ * append every complete line in the connection buffer to the store and queue
+ * one reply per line, a trailing partial line is kept in the buffer
+ * @return 0 to keep serving the connection, -1 to drop it after the replies
+ *      of the lines before the failing one, 1 if the client subscribed
+ *      (SUBSCRIBE_TEXT_COMMAND) after the lines before it
+ */
+int process_text_lines(connection_t *conn)
+{
+    dynamic_buffer_t *buffer = &conn->buffer;
+    struct reply *head = NULL, **tail = &head;
+    size_t consumed = 0, lines = 0;
+    int rc = 0;
+
+    char *newline = memchr(buffer->data, '\n', buffer->size);
+    if (newline == NULL)
+    {
+        return 0;
+    }
+
+    // the first line may pick the store everything after it goes to
+    if (!conn->store_chosen)
+    {
+        size_t line_len = newline - buffer->data + 1;
+        if (line_len > strlen(STORE_TEXT_COMMAND) &&
+            memcmp(buffer->data, STORE_TEXT_COMMAND, strlen(STORE_TEXT_COMMAND)) == 0)
+        {
+            if (choose_store(conn, buffer->data + strlen(STORE_TEXT_COMMAND),
+                             line_len - strlen(STORE_TEXT_COMMAND) - 1) < 0)
+            {
+                return -1;
+            }
+            memmove(buffer->data, buffer->data + line_len, buffer->size - line_len);
+            buffer->size -= line_len;
+            newline = memchr(buffer->data, '\n', buffer->size);
+            if (newline == NULL)
+            {
+                return 0;
+            }
+        }
+        conn->store_chosen = true;
+    }
+
+    uint64_t start_ns = metrics_now_ns();
+    char *last_newline = memrchr(newline, '\n', buffer->size - (newline - buffer->data));
+
+    // all complete lines received so far are committed in one turn
+    store_enter(conn, last_newline - buffer->data + 1);
+    while (newline != NULL)
+    {
+        char *line = buffer->data + consumed;
+        size_t line_len = newline - line + 1;
+        struct reply *reply = NULL;
+        struct filter *filter = NULL;
+        off_t start = 0, end;
+
+        consumed += line_len;
+        lines++;
+
+        if (limits.max_packet && line_len > limits.max_packet)
+        {
+            conn->drop_reason = LIMITS_DROP_OVERSIZE;
+            rc = -1;
+            break;
+        }
+
+        if (line_len == strlen(SUBSCRIBE_TEXT_COMMAND) && memcmp(line, SUBSCRIBE_TEXT_COMMAND, line_len) == 0)
+        {
+            rc = 1;
+            break;
+        }
+        if (line_len > strlen(STORE_TEXT_COMMAND) && memcmp(line, STORE_TEXT_COMMAND, strlen(STORE_TEXT_COMMAND)) == 0)
+        {
+            // the lines before it are in their store and still get their replies
+            LOG_RL(LOG_ERR, "store selected after the first packet");
+            rc = -1;
+            break;
+        }
+
+        // check for the special IOCTL command format
+        if (line_len > 19 && strncmp(line, "AESDCHAR_IOCSEEKTO:", 19) == 0)
+        {
+            // AESDCHAR_IOCSEEKTO:X,Y sends from the position to the end, X,Y,N only N bytes
+            unsigned int write_cmd, write_cmd_offset, length = 0;
+            if (sscanf(line + 19, "%u,%u,%u", &write_cmd, &write_cmd_offset, &length) < 2)
+            {
+                LOG_RL(LOG_ERR, "invalid IOCTL command format received");
+                rc = -1;
+                break;
+            }
+            start = store_seek(conn->store, conn->device_fd, write_cmd, write_cmd_offset);
+            end = start < 0 ? -1 : seek_window_end(conn->store, conn->device_fd, start, length);
+        } else if (line_len > 21 && strncmp(line, "AESDCHAR_IOCSEEKTIME:", 21) == 0)
+        {
+            // AESDCHAR_IOCSEEKTIME:T sends what was ingested since T, -T for T ns ago, T,N only N bytes
+            long long time_ns;
+            unsigned int length = 0;
+            if (sscanf(line + 21, "%lld,%u", &time_ns, &length) < 1)
+            {
+                LOG_RL(LOG_ERR, "invalid IOCTL command format received");
+                rc = -1;
+                break;
+            }
+            start = store_seek_time(conn->store, conn->device_fd, time_ns);
+            end = start < 0 ? -1 : seek_window_end(conn->store, conn->device_fd, start, length);
+        } else if (line_len > strlen(FILTER_TEXT_COMMAND) && memcmp(line, FILTER_TEXT_COMMAND, strlen(FILTER_TEXT_COMMAND)) == 0)
+        {
+            // AESDCHAR_FILTER[^][@X,Y]:pattern sends only the matching lines
+            uint32_t first_cmd, last_cmd;
+            filter = filter_parse_command(line, line_len, &first_cmd, &last_cmd);
+            if (filter == NULL || filter_range(conn->store, conn->device_fd, first_cmd, last_cmd, &start, &end) < 0)
+            {
+                LOG_RL(LOG_ERR, "invalid filter command received");
+                free(filter);
+                rc = -1;
+                break;
+            }
+        } else
+        {
+            metrics_add(&conn->slot->packets, 1);
+            end = store_append(conn->store, conn->device_fd, line, line_len);
+        }
+
+        if (end < 0 || (reply = store_reply(conn->device_fd, start, end, start_ns)) == NULL)
+        {
+            free(filter);
+            rc = -1;
+            break;
+        }
+        reply->filter = filter;
+        *tail = reply;
+        tail = &reply->next;
+
+        newline = memchr(buffer->data + consumed, '\n', buffer->size - consumed);
+    }
+    store_exit(conn);
+
+    // queue outside the lock, pushing blocks while the client is slow to read.
+    // The lines before a failing one are in the store, their replies are
+    // still delivered before the connection is dropped.
+    while (head)
+    {
+        struct reply *next = head->next;
+        if (reply_queue_push(&conn->replies, head) < 0)
+        {
+            rc = -1;
+        }
+        head = next;
+    }
+    if (rc >= 0)
+    {
+        throttle_client(conn, consumed, lines);
+    }
+
+    // keep the partial line for the next recv()
+    if (consumed == buffer->size)
+    {
+        reset_buffer(buffer);
+    } else
+    {
+        memmove(buffer->data, buffer->data + consumed, buffer->size - consumed);
+        buffer->size -= consumed;
+    }
+    return rc;
+}
+
+void *handle_client(void *arg)
+{
+    client_start_t start = *(client_start_t *) arg;
+    connection_t conn = {
+            .sock = start.sock,
+            .store = start.store,
+            .device_fd = -1,
+            .store_chosen = start.store_chosen,
+            .drop_reason = LIMITS_DROP_NONE};
+
+    free(arg);
+
+    char recv_buffer[BUF_SIZE];
+    ssize_t bytes_received = 0;
+    int replies_started = 0;
+    int rc = 0;
+
+    pthread_t self_id = pthread_self();
+
+    limits_register(&conn.timer, conn.sock);
+
+    sched_flow_init(&conn.flow);
+    conn.slot = metrics_slot_acquire(conn.sock);
+    if (conn.slot == NULL || init_buffer(&conn.buffer) < 0 ||
+        (start.pending_length > 0 &&
+         append_to_buffer(&conn.buffer, start.pending, start.pending_length) != LIMITS_DROP_NONE))
+    {
+        syslog(LOG_ERR, "failed to allocate client %d resources", conn.sock);
+        conn.drop_reason = LIMITS_DROP_MEMORY;
+        free(start.pending);
+        goto error_cleanup;
+    }
+    free(start.pending);
+
+    // open the store of the listener at the start of the client session
+    if (open_store(&conn, conn.store) < 0)
+    {
+        goto error_cleanup;
+    }
+
+    // replies are sent by a separate thread so the client can pipeline requests
+    if (reply_queue_start(&conn.replies, conn.sock, conn.slot) < 0)
+    {
+        syslog(LOG_ERR, "failed to create sender thread: %m");
+        goto error_cleanup;
+    }
+    replies_started = 1;
+
+    // the first byte selects the protocol spoken on this connection, unless
+    // the previous instance already knew it
+    uint8_t first_byte;
+    if (start.kind == HANDOFF_CLIENT_BINARY)
+    {
+        rc = serve_binary_client(&conn, true);
+    } else if (start.kind != HANDOFF_CLIENT_TEXT && recv(conn.sock, &first_byte, 1, MSG_PEEK) == 1 &&
+               first_byte == AESD_BIN_MAGIC)
+    {
+        rc = serve_binary_client(&conn, false);
+    } else
+    {
+        for (;;)
+        {
+            // a partial line is handed over along with the connection
+            if (handoff_pending())
+            {
+                conn.handoff = HANDOFF_CLIENT_TEXT;
+                break;
+            }
+            bytes_received = recv(conn.sock, recv_buffer, BUF_SIZE, 0);
+            if (bytes_received < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytes_received <= 0)
+            {
+                break;
+            }
+            metrics_add(&conn.slot->bytes_in, bytes_received);
+
+            // append the received data to the dynamic buffer
+            conn.drop_reason = append_to_buffer(&conn.buffer, recv_buffer, bytes_received);
+            if (conn.drop_reason != LIMITS_DROP_NONE || (rc = process_text_lines(&conn)) < 0)
+            {
+                rc = -1;
+                break;
+            }
+            if (rc > 0)
+            {
+                rc = follow_store(&conn, false);
+                break;
+            }
+
+            // whatever is left is the start of the next packet
+            if (limits.max_packet && conn.buffer.size > limits.max_packet)
+            {
+                conn.drop_reason = LIMITS_DROP_OVERSIZE;
+                rc = -1;
+                break;
+            }
+            limits_touch(&conn.timer, conn.buffer.size > 0);
+        }
+
+        if (conn.handoff)
+        {
+            LOG_DBG("Client %d handed over", conn.sock);
+        } else if (bytes_received == 0)
+        {
+            LOG_DBG("Client %d disconnected gracefully", conn.sock);
+        } else if (bytes_received < 0)
+        {
+            LOG_RL(LOG_ERR, "recv failed: %m");
+        }
+    }
+
+    // replies already queued are delivered before the socket is closed
+    reply_queue_finish(&conn.replies);
+    replies_started = 0;
+    if (rc < 0)
+    {
+        goto error_cleanup;
+    }
+
+    // the new instance continues the connection where we stopped
+    if (conn.handoff && !conn.replies.failed)
+    {
+        handoff_send_client(conn.sock, conn.handoff, conn.store_chosen ? conn.store->name : NULL, conn.buffer.data,
+                            conn.buffer.size);
+    }
+
+    // clean up resources
+    limits_unregister(&conn.timer);
+    if (conn.timer.expired != LIMITS_DROP_NONE)
+    {
+        LOG_RL(LOG_INFO, "client %d dropped: %s", conn.sock, limits_drop_name(conn.timer.expired));
+        limits_count_drop(conn.timer.expired);
+    }
+    free_buffer(&conn.buffer);
+    pthread_mutex_lock(&conn.store->lock);
+    close(conn.device_fd);
+    pthread_mutex_unlock(&conn.store->lock);
+    close(conn.sock);
+    sched_flow_destroy(&conn.flow);
+    metrics_slot_release(conn.slot);
+    return NULL;
+
+error_cleanup:
+    if (replies_started)
+    {
+        reply_queue_finish(&conn.replies);
+    }
+    limits_unregister(&conn.timer);
+    if (conn.drop_reason != LIMITS_DROP_NONE)
+    {
+        LOG_RL(LOG_INFO, "client %d dropped: %s", conn.sock, limits_drop_name(conn.drop_reason));
+        limits_count_drop(conn.drop_reason);
+    }
+    free_buffer(&conn.buffer);
+    pthread_mutex_lock(&conn.store->lock);
+    if (conn.device_fd != -1)
+        close(conn.device_fd);
+    pthread_mutex_unlock(&conn.store->lock);
+    close(conn.sock);
+    sched_flow_destroy(&conn.flow);
+    metrics_slot_release(conn.slot);
+    remove_thread(self_id);
+    return NULL;
+}
+
+
+/**
+ * serve @param sock on a new connection thread
+ * @param kind how the connection was handed over, HANDOFF_CLIENT_NEW if it was just accepted
+ * @param store the store of its listener, or the one it picked before it was handed over
+ * @param pending malloc()ed data the previous instance already received, taken over
+ * @return 0 on success, -1 if the thread could not be started
+ */
+int start_client(int sock, enum handoff_kind kind, struct store *store, bool store_chosen, char *pending,
+                 size_t pending_length)
+{
+    client_start_t *start = malloc(sizeof(client_start_t));
+    if (start == NULL)
+    {
+        free(pending);
+        return -1;
+    }
+    start->sock = sock;
+    start->kind = kind;
+    start->store = store;
+    start->store_chosen = store_chosen;
+    start->pending = pending;
+    start->pending_length = pending_length;
+
+    char name[16];
+    snprintf(name, sizeof(name), "aesd-conn-%d", sock);
+
+    pthread_t thread_id;
+    if (threads_create(&thread_id, THREAD_WORKER, name, handle_client, start) != 0)
+    {
+        syslog(LOG_ERR, "thread creation failed: %m");
+        free(pending);
+        free(start);
+        return -1;
+    }
+
+    add_thread(thread_id);
+    return 0;
+}
+
+/**
+ * adopted connections, waiting for the previous instance to finish
+ */
+typedef struct adopted_client {
+    int sock;
+    enum handoff_kind kind;
+    char store[STORE_NAME_MAX];// empty if it did not pick a store yet
+    char *pending;
+    size_t pending_length;
+    struct adopted_client *next;
+} adopted_client_t;
+
+/**
+ * take over the listening sockets and the connections of the running instance
+ * @return the number of listening sockets taken over, -1 if there is nothing to take over
+ */
+int take_over(adopted_client_t **adopted)
+{
+    int listen_count = 0;
+    int channel = handoff_connect();
+    if (channel < 0)
+    {
+        syslog(LOG_WARNING, "no running instance to take over from, starting normally");
+        return -1;
+    }
+
+    // the old instance passes its connections as they reach a packet
+    // boundary and closes the channel once it has no more of them
+    for (;;)
+    {
+        adopted_client_t client;
+        int fd;
+        int rc = handoff_recv(channel, &client.kind, &fd, client.store, sizeof(client.store), &client.pending,
+                              &client.pending_length);
+        if (rc <= 0)
+        {
+            break;
+        }
+
+        if (client.kind == HANDOFF_LISTENER)
+        {
+            if (listeners_adopt(fd) == 0)
+            {
+                listen_count++;
+            }
+            continue;
+        }
+
+        adopted_client_t *node = malloc(sizeof(adopted_client_t));
+        if (node == NULL)
+        {
+            close(fd);
+            free(client.pending);
+            continue;
+        }
+        *node = client;
+        node->sock = fd;
+        node->next = *adopted;
+        *adopted = node;
+    }
+    close(channel);
+
+    if (listen_count > 0)
+    {
+        syslog(LOG_INFO, "took over from the previous instance");
+    }
+    return listen_count;
+}
+
+/**
+ * @return the store of the listener connection @param sock came in on
+ */
+struct store *listener_store(int sock)
+{
+    union {
+        struct sockaddr_storage storage;
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+    } addr;
+    socklen_t addr_len = sizeof(addr);
+    uint16_t port = 0;
+
+    if (getsockname(sock, (struct sockaddr *) &addr, &addr_len) == 0)
+    {
+        if (addr.storage.ss_family == AF_INET)
+        {
+            port = ntohs(addr.in.sin_port);
+        } else if (addr.storage.ss_family == AF_INET6)
+        {
+            port = ntohs(addr.in6.sin6_port);
+        }
+    }
+    return stores_for_port(port);
+}
+
+int main(int argc, char *argv[])
+{
+    int daemonize = 0;
+    int reload = 0;
+    int metrics_port = METRICS_PORT;
+    size_t sched_quantum = SCHED_QUANTUM;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "drm:t:T:p:b:B:R:P:q:C:a:w:S:Ns:6u:o:O:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                daemonize = 1;
+                break;
+            case 'r':
+                // take over the listening socket and connections of a running instance
+                reload = 1;
+                break;
+            case 'm':
+                // metrics port, 0 disables the metrics endpoint
+                metrics_port = atoi(optarg);
+                break;
+            // connection limits, 0 disables the limit
+            case 't':
+                limits.idle_timeout_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'T':
+                limits.packet_timeout_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                limits.max_packet = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                limits.max_conn_buffer = strtoul(optarg, NULL, 0);
+                break;
+            case 'B':
+                limits.max_total_buffer = strtoul(optarg, NULL, 0);
+                break;
+            case 'R':
+                limits.rate_bytes = strtoull(optarg, NULL, 0);
+                break;
+            case 'P':
+                limits.rate_packets = strtoull(optarg, NULL, 0);
+                break;
+            // bytes each waiting client may commit per round, 0 lets them race for the store
+            case 'q':
+                sched_quantum = strtoul(optarg, NULL, 0);
+                break;
+            // a named store, on a port of its own if one is given
+            case 'C':
+                if (stores_parse(optarg) < 0 || stores_for_port(PORT) != stores_default())
+                {
+                    fprintf(stderr, "invalid store %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            // thread placement
+            case 'a':
+                if (threads_parse_cpus(optarg, &threads.acceptor_cpus) < 0)
+                {
+                    fprintf(stderr, "invalid CPU list %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                if (threads_parse_cpus(optarg, &threads.worker_cpus) < 0)
+                {
+                    fprintf(stderr, "invalid CPU list %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'S':
+                // thread stack size in KiB, 0 for the C library default
+                threads.stack_size = strtoul(optarg, NULL, 0) << 10;
+                if (threads.stack_size && threads.stack_size < PTHREAD_STACK_MIN)
+                {
+                    threads.stack_size = PTHREAD_STACK_MIN;
+                }
+                break;
+            case 'N':
+                threads.numa_local = true;
+                break;
+            case 's':
+                // what to do with followers that cannot keep up
+                if (strcmp(optarg, "drop") == 0)
+                {
+                    subscribe_policy = SUBSCRIBE_DROP;
+                } else if (strcmp(optarg, "disconnect") == 0)
+                {
+                    subscribe_policy = SUBSCRIBE_DISCONNECT;
+                } else
+                {
+                    fprintf(stderr, "invalid slow follower policy %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            // listeners besides IPv4, served like it
+            case '6':
+                listeners.ipv6 = true;
+                break;
+            case 'u':
+                listeners.unix_path = optarg;
+                break;
+            // socket options, a preset name or key=value pairs, applied in command line order
+            case 'o':
+                if (sockopts_parse(optarg) < 0)
+                {
+                    fprintf(stderr, "invalid socket options %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'O':
+                if (sockopts_load(optarg) < 0)
+                {
+                    fprintf(stderr, "cannot load socket options from %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-d] [-r] [-m metrics_port] [-t idle_timeout_s] [-T packet_timeout_s]\n"
+                        "          [-p max_packet] [-b max_conn_buffer] [-B max_total_buffer]\n"
+                        "          [-R bytes_per_s] [-P packets_per_s] [-q sched_quantum] [-C name[:port]]...\n"
+                        "          [-a acceptor_cpus] [-w worker_cpus] [-S stack_kib] [-N]\n"
+                        "          [-s drop|disconnect] [-6] [-u unix_socket_path]\n"
+                        "          [-o default|low-latency|high-throughput|key=value,...] [-O sockopts_file]\n",
+                        argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    // initialize syslog for logging
+    openlog("aesdsocket", LOG_PID | LOG_CONS, LOG_USER);
+
+    // set up SIGINT handler
+    struct sigaction sa;
+    sa.sa_handler = handle_signal;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(SIGINT, &sa, NULL) == -1)
+    {
+        syslog(LOG_ERR, "error: cannot handle SIGINT: %m");
+        return EXIT_FAILURE;
+    }
+
+    if (sigaction(SIGTERM, &sa, NULL) == -1)
+    {
+        syslog(LOG_ERR, "error: cannot handle SIGTERM: %m");
+        return EXIT_FAILURE;
+    }
+
+    // no SA_RESTART, so it interrupts blocking accept() and recv() calls
+    sa.sa_handler = handle_wakeup;
+    if (sigaction(HANDOFF_SIGNAL, &sa, NULL) == -1)
+    {
+        syslog(LOG_ERR, "error: cannot handle SIGUSR1: %m");
+        return EXIT_FAILURE;
+    }
+
+    // sendfile() has no MSG_NOSIGNAL, a client gone mid reply must only fail the send
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sa, NULL) == -1)
+    {
+        syslog(LOG_ERR, "error: cannot ignore SIGPIPE: %m");
+        return EXIT_FAILURE;
+    }
+
+    // daemonize if the -d flag was set
+    if (daemonize)
+    {
+        syslog(LOG_INFO, "starting sever in demon mode");
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            syslog(LOG_ERR, "failed to fork process for daemon mode: %m");
+            return EXIT_FAILURE;
+        }
+        if (pid > 0)
+        {
+            // parent process exits
+            exit(EXIT_SUCCESS);
+        }
+
+        // child process continues (daemon)
+        // create a new session and set the process group
+        if (setsid() < 0)
+        {
+            syslog(LOG_ERR, "failed to create new session: %m");
+            return EXIT_FAILURE;
+        }
+
+        // change the working directory to the root
+        if (chdir("/") < 0)
+        {
+            syslog(LOG_ERR, "failed to change directory to root: %m");
+            return EXIT_FAILURE;
+        }
+
+        // redirect standard file descriptors to /dev/null
+        close(STDIN_FILENO);
+        close(STDOUT_FILENO);
+        close(STDERR_FILENO);
+
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+
+        syslog(LOG_INFO, "effective UID: %d", geteuid());
+        write_pid();
+    }
+
+    // the threads created from here on inherit or override its placement
+    threads_setup_acceptor();
+
+    // the previous instance is done with the store once take_over() returns
+    adopted_client_t *adopted = NULL;
+    if (reload)
+    {
+        take_over(&adopted);
+    }
+
+    if (stores_open(sched_quantum) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    for (int i = 1; i < stores_count(); i++)
+    {
+        if (stores_get(i)->port)
+        {
+            listeners.ports[listeners.port_count++] = stores_get(i)->port;
+        }
+    }
+
+#if !(USE_AESD_CHAR_DEVICE)
+    pthread_t timestamp_tid;
+    if (threads_create(&timestamp_tid, THREAD_HELPER, "aesd-timestamp", timestamp_thread, NULL) != 0)
+    {
+        syslog(LOG_ERR, "failed to create timestamp thread: %m");
+        return EXIT_FAILURE;
+    }
+    add_thread(timestamp_tid);
+#endif
+
+    // opens whatever was not taken over
+    if (listeners_open(PORT) < 0)
+    {
+        listeners_close(false);
+        exit(EXIT_FAILURE);
+    }
+
+    if (metrics_port > 0 && metrics_start(metrics_port) < 0)
+    {
+        syslog(LOG_WARNING, "continuing without metrics endpoint");
+    }
+
+    if (limits_start() < 0)
+    {
+        listeners_close(false);
+        exit(EXIT_FAILURE);
+    }
+
+    while (adopted)
+    {
+        adopted_client_t *next = adopted->next;
+        struct store *store = adopted->store[0] ? stores_find(adopted->store, strlen(adopted->store))
+                                                : listener_store(adopted->sock);
+        if (store == NULL)
+        {
+            syslog(LOG_ERR, "client %d bound to store %s that is gone, closing it", adopted->sock, adopted->store);
+            free(adopted->pending);
+            close(adopted->sock);
+        } else if (start_client(adopted->sock, adopted->kind, store, adopted->store[0] != '\0', adopted->pending,
+                                adopted->pending_length) < 0)
+        {
+            close(adopted->sock);
+        }
+        free(adopted);
+        adopted = next;
+    }
+
+    const int *listen_fds;
+    int listen_count = listeners_get(&listen_fds);
+    if (handoff_start(listen_fds, listen_count) < 0)
+    {
+        syslog(LOG_WARNING, "continuing without hot restart support");
+    }
+
+    while (keep_running && !handoff_pending())
+    {
+        uint16_t port;
+        int client_sock = listeners_accept(&port);
+        if (client_sock < 0)
+        {
+            if (keep_running && errno != EINTR)
             {
                 syslog(LOG_ERR, "accept failed: %m");
             }
             continue;
         }
 
-        syslog(LOG_INFO, "client accepted with fd %d", client_sock);
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, handle_client, (void *) (intptr_t) client_sock) != 0)
+        // raced with the handoff, the new instance serves it
+        if (handoff_pending())
+        {
+            handoff_send_client(client_sock, HANDOFF_CLIENT_NEW, NULL, NULL, 0);
+            close(client_sock);
+            break;
+        }
+
+        LOG_DBG("client accepted with fd %d", client_sock);
+        if (start_client(client_sock, HANDOFF_CLIENT_NEW, stores_for_port(port), false, NULL, 0) < 0)
         {
-            syslog(LOG_ERR, "thread creation failed: %m");
             close(client_sock);
-            continue;
         }
+    }
 
-        add_thread(thread_id);
+    // a new instance took over, the store is left in place for it
+    bool handed_off = handoff_pending();
+    keep_running = 0;
+    if (handed_off)
+    {
+        syslog(LOG_INFO, "stopped accepting, waiting for connections to be handed over");
     }
 
 #if !(USE_AESD_CHAR_DEVICE)
@@ -557,13 +1842,15 @@ int main(int argc, char *argv[])
 #endif
 
     // clean up resources
+    metrics_stop();
+    stores_close_followers();
     clean_up_threads();
-    close(server_sock);
-
-#if !(USE_AESD_CHAR_DEVICE)
-    // remove out file
-    remove_test_file();
-#endif
+    // before the successor is let go, it loads the sidecars right after,
+    // without a successor the store files are removed
+    stores_close(handed_off);
+    limits_stop();
+    handoff_stop();
+    listeners_close(handed_off);
 
     syslog(LOG_INFO, "server exiting successfully");
     closelog();
@@ -0,0 +1,188 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_CONN_LIMITS_H
+#define AESDSOCKET_CONN_LIMITS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LIMITS_IDLE_TIMEOUT_S 300
+#define LIMITS_PACKET_TIMEOUT_S 30
+#define LIMITS_MAX_PACKET (1u << 20)
+#define LIMITS_MAX_CONN_BUFFER (4u << 20)
+#define LIMITS_MAX_TOTAL_BUFFER (256u << 20)
+/**
+ * a connection that kept below its rates may burst one second worth of them
+ */
+#define LIMITS_RATE_BURST_NS 1000000000ull
+
+/**
+ * resource limits applied to every client connection, 0 disables a limit
+ */
+struct limits_config {
+    /**
+     * drop connections that sent nothing for this many seconds
+     */
+    unsigned int idle_timeout_s;
+    /**
+     * drop connections that take longer than this to complete one packet
+     */
+    unsigned int packet_timeout_s;
+    /**
+     * largest packet (text line or binary payload) accepted
+     */
+    size_t max_packet;
+    /**
+     * receive buffer memory one connection may hold
+     */
+    size_t max_conn_buffer;
+    /**
+     * receive buffer memory all connections together may hold
+     */
+    size_t max_total_buffer;
+    /**
+     * bytes per second one connection may send, and receive, sustained
+     */
+    uint64_t rate_bytes;
+    /**
+     * packets (text lines or binary requests) per second one connection may send
+     */
+    uint64_t rate_packets;
+};
+
+extern struct limits_config limits;
+
+enum limits_drop_reason {
+    LIMITS_DROP_NONE = 0,
+    LIMITS_DROP_IDLE,
+    LIMITS_DROP_SLOW,
+    LIMITS_DROP_OVERSIZE,
+    LIMITS_DROP_MEMORY,
+    LIMITS_DROP_NR,
+};
+
+/**
+ * Per-connection timer state
+ *
+ * The connection thread stamps its activity with coarse clock reads, a single
+ * reaper thread sweeps all registered connections once a second and shuts
+ * down the expired ones.
+ */
+struct conn_timer {
+    int sock;
+    pthread_t thread;// connection thread, see limits_signal()
+    _Atomic uint64_t last_activity_s;
+    _Atomic uint64_t packet_start_s;// 0 when no packet is partially received
+    _Atomic int expired;            // enum limits_drop_reason set by the reaper
+    _Atomic bool idle_exempt;       // followers may stay silent forever
+    struct conn_timer *next;
+    struct conn_timer *prev;
+};
+
+/**
+ * Token bucket of one rate limit of a connection
+ *
+ * Kept as the time at which the bucket would be empty (GCRA), so a charge is
+ * one addition and no refill timer runs. The bucket is full, one second of
+ * tokens, when that time is LIMITS_RATE_BURST_NS or more in the past.
+ */
+struct token_bucket {
+    uint64_t empty_ns;
+};
+
+/**
+ * take @param amount tokens out of @param bucket refilling at @param rate
+ * per second, 0 for no limit. The bucket may go into debt.
+ * @return ns until the debt is paid off, 0 if the bucket is not in debt
+ */
+static inline uint64_t limits_rate_charge(struct token_bucket *bucket, uint64_t rate, uint64_t amount,
+                                          uint64_t now_ns)
+{
+    if (rate == 0 || amount == 0)
+    {
+        return 0;
+    }
+    if (bucket->empty_ns + LIMITS_RATE_BURST_NS < now_ns)
+    {
+        bucket->empty_ns = now_ns - LIMITS_RATE_BURST_NS;
+    }
+    bucket->empty_ns += amount / rate * 1000000000ull + amount % rate * 1000000000ull / rate;
+    return bucket->empty_ns > now_ns ? bucket->empty_ns - now_ns : 0;
+}
+
+/**
+ * sleep for @param ns, cut short by a signal
+ */
+void limits_rate_pause(uint64_t ns);
+
+static inline uint64_t limits_now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec + 1;// never 0, which means "not set"
+}
+
+/**
+ * record that data arrived on the connection, @param partial tells whether
+ * a packet is still incomplete after it
+ */
+static inline void limits_touch(struct conn_timer *timer, int partial)
+{
+    uint64_t now = limits_now_s();
+    atomic_store_explicit(&timer->last_activity_s, now, memory_order_relaxed);
+    if (!partial)
+    {
+        atomic_store_explicit(&timer->packet_start_s, 0, memory_order_relaxed);
+    } else if (atomic_load_explicit(&timer->packet_start_s, memory_order_relaxed) == 0)
+    {
+        atomic_store_explicit(&timer->packet_start_s, now, memory_order_relaxed);
+    }
+}
+
+/**
+ * start watching @param sock served by the calling thread, must be unregistered
+ * before the socket is closed
+ */
+void limits_register(struct conn_timer *timer, int sock);
+
+void limits_unregister(struct conn_timer *timer);
+
+/**
+ * account @param bytes of receive buffer growth against the global limit
+ * @return 0 on success, -1 if the global limit would be exceeded
+ */
+int limits_reserve(size_t bytes);
+
+void limits_release(size_t bytes);
+
+/**
+ * count a connection dropped for @param reason
+ */
+void limits_count_drop(enum limits_drop_reason reason);
+
+/**
+ * @return number of connections dropped for @param reason so far
+ */
+uint64_t limits_drops(enum limits_drop_reason reason);
+
+const char *limits_drop_name(enum limits_drop_reason reason);
+
+/**
+ * send @param signo to the thread of every registered connection
+ */
+void limits_signal(int signo);
+
+/**
+ * start/stop the reaper thread enforcing the timeouts
+ */
+int limits_start(void);
+
+void limits_stop(void);
+
+#endif// AESDSOCKET_CONN_LIMITS_H
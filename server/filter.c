@@ -0,0 +1,203 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+// memrchr is a GNU extension
+#define _GNU_SOURCE
+
+#include "filter.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * GCC vector extension, SSE2 on x86-64 and NEON on aarch64
+ */
+typedef uint8_t filter_vec __attribute__((vector_size(16)));
+#define FILTER_VEC_SIZE sizeof(filter_vec)
+
+static inline filter_vec load_vec(const char *p)
+{
+    filter_vec v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline bool any_set(filter_vec v)
+{
+    uint64_t half[2];
+    memcpy(half, &v, sizeof(half));
+    return (half[0] | half[1]) != 0;
+}
+
+/**
+ * first occurrence of the @param k bytes of @param needle in @param hay, like memmem()
+ *
+ * Compares 16 candidate positions at a time on the first and the last byte
+ * of the needle, only positions where both match are compared in full.
+ */
+static const char *find(const char *hay, size_t len, const char *needle, size_t k)
+{
+    size_t i = 0;
+
+    if (k == 0)
+    {
+        return hay;
+    }
+    if (k > len)
+    {
+        return NULL;
+    }
+    if (k == 1)
+    {
+        return memchr(hay, needle[0], len);
+    }
+
+    filter_vec first = (filter_vec){0} + (uint8_t) needle[0];
+    filter_vec last = (filter_vec){0} + (uint8_t) needle[k - 1];
+
+    for (; i + k - 1 + FILTER_VEC_SIZE <= len; i += FILTER_VEC_SIZE)
+    {
+        filter_vec candidates = (filter_vec) ((load_vec(hay + i) == first) & (load_vec(hay + i + k - 1) == last));
+        if (any_set(candidates))
+        {
+            uint8_t mask[FILTER_VEC_SIZE];
+            memcpy(mask, &candidates, sizeof(mask));
+            for (size_t j = 0; j < FILTER_VEC_SIZE; j++)
+            {
+                if (mask[j] && memcmp(hay + i + j + 1, needle + 1, k - 2) == 0)
+                {
+                    return hay + i + j;
+                }
+            }
+        }
+    }
+
+    // fewer than a vector of positions left
+    for (; i + k <= len; i++)
+    {
+        if (hay[i] == needle[0] && memcmp(hay + i + 1, needle + 1, k - 1) == 0)
+        {
+            return hay + i;
+        }
+    }
+    return NULL;
+}
+
+struct filter *filter_new(enum aesd_filter_mode mode, const char *pattern, size_t length)
+{
+    struct filter *filter;
+
+    if ((mode != AESD_FILTER_SUBSTRING && mode != AESD_FILTER_PREFIX) || memchr(pattern, '\n', length) != NULL)
+    {
+        return NULL;
+    }
+    filter = malloc(sizeof(*filter) + length + 1);
+    if (filter == NULL)
+    {
+        return NULL;
+    }
+    filter->mode = mode;
+    filter->length = length;
+    filter->pattern[0] = '\n';
+    memcpy(filter->pattern + 1, pattern, length);
+    return filter;
+}
+
+/**
+ * parse a decimal number at *@param p, which is advanced past it
+ */
+static int parse_u32(const char **p, const char *end, uint32_t *result)
+{
+    uint64_t n = 0;
+    const char *start = *p;
+
+    while (*p < end && **p >= '0' && **p <= '9' && n <= UINT32_MAX)
+    {
+        n = n * 10 + (**p - '0');
+        (*p)++;
+    }
+    if (*p == start || n > UINT32_MAX)
+    {
+        return -1;
+    }
+    *result = n;
+    return 0;
+}
+
+struct filter *filter_parse_command(const char *line, size_t line_len, uint32_t *first_cmd, uint32_t *last_cmd)
+{
+    size_t command_len = strlen(FILTER_TEXT_COMMAND);
+    const char *p = line + command_len, *end = line + line_len - 1;
+    enum aesd_filter_mode mode = AESD_FILTER_SUBSTRING;
+
+    *first_cmd = 0;
+    *last_cmd = 0;
+    if (line_len <= command_len || memcmp(line, FILTER_TEXT_COMMAND, command_len) != 0)
+    {
+        return NULL;
+    }
+
+    if (p < end && *p == '^')
+    {
+        mode = AESD_FILTER_PREFIX;
+        p++;
+    }
+    if (p < end && *p == '@')
+    {
+        p++;
+        if (parse_u32(&p, end, first_cmd) < 0 || p == end || *p++ != ',' || parse_u32(&p, end, last_cmd) < 0)
+        {
+            return NULL;
+        }
+    }
+    if (p == end || *p++ != ':')
+    {
+        return NULL;
+    }
+    return filter_new(mode, p, end - p);
+}
+
+const char *filter_next_line(const struct filter *filter, const char *data, const char *end, size_t *line_len)
+{
+    const char *line, *match, *newline;
+    size_t len = end - data;
+
+    if (data == end)
+    {
+        return NULL;
+    }
+
+    if (filter->mode == AESD_FILTER_PREFIX)
+    {
+        // the line at data, then every line that follows a newline
+        if (len >= filter->length && memcmp(data, filter->pattern + 1, filter->length) == 0)
+        {
+            line = data;
+        } else
+        {
+            match = find(data, len, filter->pattern, filter->length + 1);
+            if (match == NULL || match + 1 == end)
+            {
+                return NULL;
+            }
+            line = match + 1;
+        }
+        match = line;
+    } else
+    {
+        match = find(data, len, filter->pattern + 1, filter->length);
+        if (match == NULL)
+        {
+            return NULL;
+        }
+        line = memrchr(data, '\n', match - data);
+        line = line ? line + 1 : data;
+    }
+
+    newline = memchr(match, '\n', end - match);
+    *line_len = (newline ? newline + 1 : end) - line;
+    return line;
+}
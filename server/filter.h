@@ -0,0 +1,54 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_FILTER_H
+#define AESDSOCKET_FILTER_H
+
+#include "aesd_protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * text protocol command, AESDCHAR_FILTER[^][@X,Y]:pattern sends the lines of
+ * write commands X up to Y (0 for the end of the store) that contain pattern,
+ * or start with it with ^
+ */
+#define FILTER_TEXT_COMMAND "AESDCHAR_FILTER"
+
+/**
+ * what a reply sends of its store range
+ */
+struct filter {
+    enum aesd_filter_mode mode;
+    size_t length;
+    /**
+     * the pattern preceded by a newline, which prefix matches search for
+     */
+    char pattern[];
+};
+
+/**
+ * allocate a filter for the @param length bytes of @param pattern
+ * @return the filter, NULL if @param pattern contains a newline or on allocation failure
+ */
+struct filter *filter_new(enum aesd_filter_mode mode, const char *pattern, size_t length);
+
+/**
+ * parse the text command in the @param line_len bytes of @param line, which
+ * end with a newline, storing the write command range in @param first_cmd
+ * and @param last_cmd
+ * @return the filter, NULL if the command is malformed or on allocation failure
+ */
+struct filter *filter_parse_command(const char *line, size_t line_len, uint32_t *first_cmd, uint32_t *last_cmd);
+
+/**
+ * find the next line in [@param data, @param end) that matches @param filter
+ * @param data must be at the start of a line, the last line may lack its newline
+ * @return the start of the line, its length including the newline is stored in
+ *      @param line_len, NULL if no line matches
+ */
+const char *filter_next_line(const struct filter *filter, const char *data, const char *end, size_t *line_len);
+
+#endif// AESDSOCKET_FILTER_H
@@ -0,0 +1,348 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "handoff.h"
+#include "aesd_threads.h"
+#include "conn_limits.h"
+#include "listeners.h"
+#include "log.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * interval at which threads that did not notice the handoff yet are interrupted again
+ */
+#define HANDOFF_KICK_INTERVAL_NS 100000000
+
+atomic_bool handoff_requested = false;
+
+static int handoff_sock = -1;// listening for a successor
+static int channel = -1;     // connected successor
+static int listener_fds[LISTENERS_MAX];
+static int listener_count;
+static pthread_t accepting_thread;
+static pthread_t handoff_tid;
+static atomic_bool stopping = false;
+static pthread_mutex_t channel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int send_all(int fd, const void *data, size_t len)
+{
+    size_t total_sent = 0;
+    while (total_sent < len)
+    {
+        ssize_t sent = send(fd, (const char *) data + total_sent, len - total_sent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent < 0)
+        {
+            return -1;
+        }
+        total_sent += sent;
+    }
+    return 0;
+}
+
+static int send_fd(int fd, enum handoff_kind kind, const char *store, const void *pending, size_t length)
+{
+    size_t store_length = store ? strnlen(store, UINT8_MAX) : 0;
+    struct handoff_msg msg = {
+            .kind = kind,
+            .store_length = store_length,
+            .length = htonl(length)};
+    struct iovec iov = {
+            .iov_base = &msg,
+            .iov_len = sizeof(msg)};
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+
+    memset(&mh, 0, sizeof(mh));
+    memset(&control, 0, sizeof(control));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+
+    cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    pthread_mutex_lock(&channel_lock);
+    ssize_t sent;
+    do
+    {
+        sent = sendmsg(channel, &mh, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    int rc = sent < 0 ? -1 : 0;
+    if (rc == 0)
+    {
+        rc = send_all(channel, (const char *) &msg + sent, sizeof(msg) - sent);
+    }
+    if (rc == 0)
+    {
+        rc = send_all(channel, pending, length);
+    }
+    if (rc == 0)
+    {
+        rc = send_all(channel, store, store_length);
+    }
+    pthread_mutex_unlock(&channel_lock);
+    return rc;
+}
+
+static void *handoff_thread(void *arg)
+{
+    struct timespec interval = {
+            .tv_sec = 0,
+            .tv_nsec = HANDOFF_KICK_INTERVAL_NS};
+
+    // leave SIGINT/SIGTERM to the accepting thread
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, HANDOFF_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    channel = accept(handoff_sock, NULL, NULL);
+    if (channel < 0)
+    {
+        return NULL;// handoff_stop() without a successor
+    }
+
+    for (int i = 0; i < listener_count; i++)
+    {
+        if (send_fd(listener_fds[i], HANDOFF_LISTENER, NULL, NULL, 0) < 0)
+        {
+            syslog(LOG_ERR, "failed to pass the listening sockets to the new instance: %m");
+            close(channel);
+            channel = -1;
+            return NULL;
+        }
+    }
+    syslog(LOG_INFO, "new instance took over the listening sockets, handing over connections");
+    atomic_store(&handoff_requested, true);
+
+    // a signal can arrive just before a thread blocks, so keep interrupting
+    // the accepting and the connection threads until all of them are done
+    while (!atomic_load(&stopping))
+    {
+        pthread_kill(accepting_thread, HANDOFF_SIGNAL);
+        limits_signal(HANDOFF_SIGNAL);
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+int handoff_start(const int *listen_fds, int count)
+{
+    struct sockaddr_un addr;
+
+    handoff_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (handoff_sock < 0)
+    {
+        syslog(LOG_ERR, "handoff socket creation failed: %m");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, HANDOFF_PATH, sizeof(addr.sun_path) - 1);
+
+    // a previous instance that handed over to us leaves its path behind
+    unlink(HANDOFF_PATH);
+    if (bind(handoff_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(handoff_sock, 1) < 0)
+    {
+        syslog(LOG_ERR, "handoff bind/listen on %s failed: %m", HANDOFF_PATH);
+        goto error;
+    }
+
+    listener_count = count < LISTENERS_MAX ? count : LISTENERS_MAX;
+    memcpy(listener_fds, listen_fds, listener_count * sizeof(int));
+    accepting_thread = pthread_self();
+    if (threads_create(&handoff_tid, THREAD_HELPER, "aesd-handoff", handoff_thread, NULL) != 0)
+    {
+        syslog(LOG_ERR, "failed to create handoff thread: %m");
+        unlink(HANDOFF_PATH);
+        goto error;
+    }
+    return 0;
+
+error:
+    close(handoff_sock);
+    handoff_sock = -1;
+    return -1;
+}
+
+int handoff_send_client(int sock, enum handoff_kind kind, const char *store, const void *pending, size_t length)
+{
+    if (send_fd(sock, kind, store, pending, length) < 0)
+    {
+        LOG_RL(LOG_ERR, "failed to hand over client %d: %m", sock);
+        return -1;
+    }
+    return 0;
+}
+
+void handoff_stop(void)
+{
+    if (handoff_sock < 0)
+    {
+        return;
+    }
+
+    atomic_store(&stopping, true);
+    if (!handoff_pending())
+    {
+        // wakes up the blocking accept() in the handoff thread, the path is
+        // ours to remove as nobody took over
+        shutdown(handoff_sock, SHUT_RDWR);
+        unlink(HANDOFF_PATH);
+    }
+    pthread_join(handoff_tid, NULL);
+
+    // EOF tells the successor that every connection was handed over
+    if (channel >= 0)
+    {
+        close(channel);
+        channel = -1;
+    }
+    close(handoff_sock);
+    handoff_sock = -1;
+}
+
+int handoff_connect(void)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, HANDOFF_PATH, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int recv_all(int fd, void *data, size_t len)
+{
+    size_t total_received = 0;
+    while (total_received < len)
+    {
+        ssize_t received = recv(fd, (char *) data + total_received, len - total_received, 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return -1;
+        }
+        total_received += received;
+    }
+    return 0;
+}
+
+int handoff_recv(int fd_channel, enum handoff_kind *kind, int *fd, char *store, size_t store_size, char **pending,
+                 size_t *length)
+{
+    char name[UINT8_MAX];
+    struct handoff_msg msg;
+    struct iovec iov = {
+            .iov_base = &msg,
+            .iov_len = sizeof(msg)};
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+    ssize_t received;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+
+    do
+    {
+        received = recvmsg(fd_channel, &mh, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received == 0)
+    {
+        return 0;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&mh);
+    if (received < 0 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        syslog(LOG_ERR, "invalid handoff message");
+        return -1;
+    }
+    memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+
+    // the descriptor arrives with the first byte, the rest of the record may not
+    if (received < sizeof(msg) && recv_all(fd_channel, (char *) &msg + received, sizeof(msg) - received) < 0)
+    {
+        close(*fd);
+        return -1;
+    }
+
+    *kind = msg.kind;
+    *length = ntohl(msg.length);
+    *pending = NULL;
+    if (*length > 0)
+    {
+        *pending = malloc(*length);
+        if (*pending == NULL || recv_all(fd_channel, *pending, *length) < 0)
+        {
+            free(*pending);
+            close(*fd);
+            return -1;
+        }
+    }
+
+    // a name that does not fit is no store of ours, "?" matches none either
+    if (recv_all(fd_channel, name, msg.store_length) < 0)
+    {
+        free(*pending);
+        close(*fd);
+        return -1;
+    }
+    if (msg.store_length < store_size)
+    {
+        memcpy(store, name, msg.store_length);
+        store[msg.store_length] = '\0';
+    } else
+    {
+        snprintf(store, store_size, "?");
+    }
+    return 1;
+}
@@ -0,0 +1,93 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_HANDOFF_H
+#define AESDSOCKET_HANDOFF_H
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * UNIX socket a starting instance (-r) connects to, to take over from the
+ * running one
+ */
+#define HANDOFF_PATH "/var/run/aesdsocket.handoff"
+
+/**
+ * sent to the accepting and the connection threads to interrupt blocking calls
+ * once a handoff was requested
+ */
+#define HANDOFF_SIGNAL SIGUSR1
+
+enum handoff_kind {
+    HANDOFF_LISTENER = 1,
+    HANDOFF_CLIENT_NEW,   // accepted, nothing received yet
+    HANDOFF_CLIENT_TEXT,  // text protocol, pending data is the partial line
+    HANDOFF_CLIENT_BINARY,// binary protocol, negotiated and at a frame boundary
+};
+
+/**
+ * Handoff record, one per file descriptor passed with SCM_RIGHTS
+ * followed by length bytes of data already received on the connection and
+ * the store_length bytes of the name of the store it is bound to
+ */
+struct handoff_msg {
+    uint8_t kind;
+    uint8_t store_length;// 0 if the connection did not pick a store yet
+    uint8_t reserved[2];
+    uint32_t length;
+};
+
+extern atomic_bool handoff_requested;
+
+/**
+ * @return true once a successor took over the listening sockets, connections
+ * should then be handed over at their next packet boundary
+ */
+static inline bool handoff_pending(void)
+{
+    return atomic_load_explicit(&handoff_requested, memory_order_relaxed);
+}
+
+/**
+ * running instance: wait for a successor on HANDOFF_PATH and pass it the
+ * @param count listening sockets in @param listen_fds once one connects
+ * @return 0 on success, -1 if reloads are not possible
+ */
+int handoff_start(const int *listen_fds, int count);
+
+/**
+ * pass the client connection @param sock to the successor, together with the
+ * @param length bytes of @param pending data already received on it
+ * @param store name of the store the connection is bound to, NULL if none yet
+ * @return 0 on success, -1 on failure
+ */
+int handoff_send_client(int sock, enum handoff_kind kind, const char *store, const void *pending, size_t length);
+
+/**
+ * stop waiting for a successor, or once all connections were handed over,
+ * let the successor know it has everything
+ */
+void handoff_stop(void);
+
+/**
+ * starting instance: connect to the running one
+ * @return the handoff channel, -1 if there is no instance to take over from
+ */
+int handoff_connect(void);
+
+/**
+ * receive the next file descriptor on @param channel, @param pending is set
+ * to a malloc()ed copy of the data already received on it (NULL if none)
+ * @param store set to the name of the store the connection is bound to,
+ *      empty if none, @param store_size bytes at most including the NUL
+ * @return 1 on success, 0 once the old instance is done, -1 on error
+ */
+int handoff_recv(int channel, enum handoff_kind *kind, int *fd, char *store, size_t store_size, char **pending,
+                 size_t *length);
+
+#endif// AESDSOCKET_HANDOFF_H
@@ -0,0 +1,241 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+// Startup cost of indexing the file store: a full scan of the store against
+// loading the saved index and scanning only what was appended after it was
+// saved. The store and the index are dropped from the page cache before each
+// measurement, so both start cold. Random seeks are timed afterwards, they
+// read the entries between a checkpoint and the one asked for, once with the
+// store still mostly out of the page cache and once more for the same entries.
+// Seeks by ingest time are timed the same way, a binary search over the
+// stamp sidecar followed by a lookup of the entry found.
+//
+
+#include "store_index.h"
+#include "store_times.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WRITE_BLOCK (1 << 20)
+#define LOOKUPS 100000
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void drop_cache(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/**
+ * append @param bytes of @param line_bytes long lines to @param fd
+ */
+static int append_lines(int fd, uint64_t bytes, size_t line_bytes)
+{
+    size_t block = WRITE_BLOCK - WRITE_BLOCK % line_bytes;
+    char *data = malloc(block);
+    if (data == NULL)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < block; i++)
+    {
+        data[i] = i % line_bytes == line_bytes - 1 ? '\n' : 'a' + i % 26;
+    }
+
+    while (bytes > 0)
+    {
+        size_t len = bytes < block ? bytes - bytes % line_bytes : block;
+        if (len == 0 || write(fd, data, len) != (ssize_t) len)
+        {
+            break;
+        }
+        bytes -= len;
+    }
+    free(data);
+    return bytes < line_bytes ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t generate = 0, append = 64ull << 20;
+    size_t line_bytes = 100;
+    char index_path[4096], times_path[4096];
+    struct store_index full, loaded;
+    struct store_times times;
+    struct stat st;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "g:l:a:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'g':
+                generate = strtoull(optarg, NULL, 0) << 30;
+                break;
+            case 'l':
+                line_bytes = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                append = strtoull(optarg, NULL, 0) << 20;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-g store_gib] [-l line_bytes] [-a append_mib] store_path\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || line_bytes < 1)
+    {
+        fprintf(stderr, "Usage: %s [-g store_gib] [-l line_bytes] [-a append_mib] store_path\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(index_path, sizeof(index_path), "%s.idx", argv[optind]);
+    snprintf(times_path, sizeof(times_path), "%s.times", argv[optind]);
+    unlink(index_path);
+    unlink(times_path);
+
+    int fd = open(argv[optind], O_RDWR | O_CREAT | O_APPEND | (generate ? O_TRUNC : 0), 0644);
+    if (fd < 0 || (generate && append_lines(fd, generate, line_bytes) < 0) || fstat(fd, &st) < 0)
+    {
+        perror("indexbench");
+        exit(EXIT_FAILURE);
+    }
+
+    // restart without a saved index
+    drop_cache(argv[optind]);
+    double start = now_ms();
+    if (store_index_init(&full) < 0 || store_index_scan(&full, fd) < 0)
+    {
+        perror("indexbench: scan");
+        exit(EXIT_FAILURE);
+    }
+    double scan_ms = now_ms() - start;
+
+    start = now_ms();
+    if (store_index_save(&full, index_path, fd) < 0)
+    {
+        perror("indexbench: save");
+        exit(EXIT_FAILURE);
+    }
+    double save_ms = now_ms() - start;
+
+    // what a crashed instance wrote after its last save
+    if (append_lines(fd, append, line_bytes) < 0)
+    {
+        perror("indexbench: append");
+        exit(EXIT_FAILURE);
+    }
+
+    // restart with the saved index
+    drop_cache(argv[optind]);
+    drop_cache(index_path);
+    start = now_ms();
+    if (store_index_init(&loaded) < 0 || store_index_load(&loaded, index_path, fd) < 0)
+    {
+        fprintf(stderr, "indexbench: saved index rejected\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t saved_size = loaded.size;
+    if (store_index_scan(&loaded, fd) < 0)
+    {
+        perror("indexbench: scan");
+        exit(EXIT_FAILURE);
+    }
+    double load_ms = now_ms() - start;
+
+    if (loaded.count != full.count + (loaded.size - saved_size) / line_bytes)
+    {
+        fprintf(stderr, "indexbench: %llu entries after loading, expected %llu\n", (unsigned long long) loaded.count,
+                (unsigned long long) (full.count + (loaded.size - saved_size) / line_bytes));
+        exit(EXIT_FAILURE);
+    }
+
+    double lookup_us[2];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        srand(1);
+        start = now_ms();
+        for (int i = 0; i < LOOKUPS; i++)
+        {
+            uint32_t entry = ((uint64_t) rand() * RAND_MAX + rand()) % loaded.count;
+            if (store_index_lookup(&loaded, fd, entry, 0) < 0)
+            {
+                fprintf(stderr, "indexbench: entry %u not found\n", entry);
+                exit(EXIT_FAILURE);
+            }
+        }
+        lookup_us[pass] = (now_ms() - start) * 1e3 / LOOKUPS;
+    }
+
+    // one entry per us
+    if (store_times_open(&times, times_path, 0, 0) < 0)
+    {
+        perror("indexbench: times");
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t i = 0; i < loaded.count; i++)
+    {
+        if (store_times_stamp(&times, i + 1, (i + 1) * 1000) < 0)
+        {
+            perror("indexbench: times");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (store_times_save(&times) < 0)
+    {
+        perror("indexbench: times");
+        exit(EXIT_FAILURE);
+    }
+    drop_cache(argv[optind]);
+    drop_cache(times_path);
+
+    double seek_time_us[2];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        srand(2);
+        start = now_ms();
+        for (int i = 0; i < LOOKUPS; i++)
+        {
+            uint64_t entry = ((uint64_t) rand() * RAND_MAX + rand()) % loaded.count;
+            int64_t found = store_times_find(&times, (entry + 1) * 1000);
+            if (found != (int64_t) entry || store_index_lookup(&loaded, fd, entry, 0) < 0)
+            {
+                fprintf(stderr, "indexbench: entry %llu not found by time\n", (unsigned long long) entry);
+                exit(EXIT_FAILURE);
+            }
+        }
+        seek_time_us[pass] = (now_ms() - start) * 1e3 / LOOKUPS;
+    }
+
+    printf("store %.2f GiB, %llu entries of %zu bytes, index %zu KiB\n", st.st_size / (double) (1 << 30),
+           (unsigned long long) full.count, line_bytes, (sizeof(struct store_index_header) +
+           full.checkpoint_count * sizeof(uint64_t)) >> 10);
+    printf("full scan %.1f ms, save %.1f ms, load + scan of %.1f MiB tail %.1f ms\n", scan_ms, save_ms,
+           (loaded.size - saved_size) / (double) (1 << 20), load_ms);
+    printf("lookup %.1f us cold, %.2f us warm\n", lookup_us[0], lookup_us[1]);
+    printf("seek by time %.1f us cold, %.2f us warm\n", seek_time_us[0], seek_time_us[1]);
+
+    store_index_free(&full);
+    store_index_free(&loaded);
+    store_times_close(&times);
+    unlink(times_path);
+    close(fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,217 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "conn_limits.h"
+#include "aesd_threads.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+struct limits_config limits = {
+        .idle_timeout_s = LIMITS_IDLE_TIMEOUT_S,
+        .packet_timeout_s = LIMITS_PACKET_TIMEOUT_S,
+        .max_packet = LIMITS_MAX_PACKET,
+        .max_conn_buffer = LIMITS_MAX_CONN_BUFFER,
+        .max_total_buffer = LIMITS_MAX_TOTAL_BUFFER};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct conn_timer *timers = NULL;
+
+static _Atomic size_t total_buffered = 0;
+static _Atomic uint64_t drops[LIMITS_DROP_NR];
+
+static pthread_mutex_t reaper_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reaper_cond = PTHREAD_COND_INITIALIZER;
+static bool reaper_running = false;
+static pthread_t reaper_tid;
+
+static const char *drop_names[LIMITS_DROP_NR] = {
+        [LIMITS_DROP_NONE] = "none",
+        [LIMITS_DROP_IDLE] = "idle",
+        [LIMITS_DROP_SLOW] = "slow",
+        [LIMITS_DROP_OVERSIZE] = "oversize",
+        [LIMITS_DROP_MEMORY] = "memory"};
+
+void limits_register(struct conn_timer *timer, int sock)
+{
+    timer->sock = sock;
+    timer->thread = pthread_self();
+    timer->packet_start_s = 0;
+    timer->expired = LIMITS_DROP_NONE;
+    timer->idle_exempt = false;
+    timer->last_activity_s = limits_now_s();
+    timer->prev = NULL;
+
+    pthread_mutex_lock(&registry_lock);
+    timer->next = timers;
+    if (timers)
+    {
+        timers->prev = timer;
+    }
+    timers = timer;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void limits_unregister(struct conn_timer *timer)
+{
+    pthread_mutex_lock(&registry_lock);
+    if (timer->prev)
+    {
+        timer->prev->next = timer->next;
+    } else
+    {
+        timers = timer->next;
+    }
+    if (timer->next)
+    {
+        timer->next->prev = timer->prev;
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+int limits_reserve(size_t bytes)
+{
+    size_t total = atomic_fetch_add_explicit(&total_buffered, bytes, memory_order_relaxed) + bytes;
+    if (limits.max_total_buffer && total > limits.max_total_buffer)
+    {
+        atomic_fetch_sub_explicit(&total_buffered, bytes, memory_order_relaxed);
+        return -1;
+    }
+    return 0;
+}
+
+void limits_release(size_t bytes)
+{
+    atomic_fetch_sub_explicit(&total_buffered, bytes, memory_order_relaxed);
+}
+
+void limits_rate_pause(uint64_t ns)
+{
+    // a handoff or shutdown signal ends the pause, the caller then finds out why
+    struct timespec ts = {.tv_sec = ns / 1000000000ull, .tv_nsec = ns % 1000000000ull};
+    nanosleep(&ts, NULL);
+}
+
+void limits_count_drop(enum limits_drop_reason reason)
+{
+    atomic_fetch_add_explicit(&drops[reason], 1, memory_order_relaxed);
+}
+
+uint64_t limits_drops(enum limits_drop_reason reason)
+{
+    return atomic_load_explicit(&drops[reason], memory_order_relaxed);
+}
+
+const char *limits_drop_name(enum limits_drop_reason reason)
+{
+    return drop_names[reason];
+}
+
+void limits_signal(int signo)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (struct conn_timer *timer = timers; timer; timer = timer->next)
+    {
+        pthread_kill(timer->thread, signo);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void sweep(uint64_t now)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (struct conn_timer *timer = timers; timer; timer = timer->next)
+    {
+        uint64_t last_activity = atomic_load_explicit(&timer->last_activity_s, memory_order_relaxed);
+        uint64_t packet_start = atomic_load_explicit(&timer->packet_start_s, memory_order_relaxed);
+        int reason = LIMITS_DROP_NONE;
+
+        if (atomic_load_explicit(&timer->expired, memory_order_relaxed) != LIMITS_DROP_NONE)
+        {
+            continue;
+        }
+
+        // stamps can be newer than now, never subtract them from it
+        if (limits.idle_timeout_s && last_activity + limits.idle_timeout_s <= now &&
+            !atomic_load_explicit(&timer->idle_exempt, memory_order_relaxed))
+        {
+            reason = LIMITS_DROP_IDLE;
+        } else if (limits.packet_timeout_s && packet_start && packet_start + limits.packet_timeout_s <= now)
+        {
+            reason = LIMITS_DROP_SLOW;
+        }
+
+        if (reason != LIMITS_DROP_NONE)
+        {
+            atomic_store_explicit(&timer->expired, reason, memory_order_relaxed);
+            // the connection thread sees EOF and tears the connection down,
+            // it cannot close the socket before unregistering under registry_lock
+            shutdown(timer->sock, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void *reaper_thread(void *arg)
+{
+    struct timespec ts;
+
+    // leave SIGINT/SIGTERM to the accepting thread
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&reaper_lock);
+    while (reaper_running)
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        pthread_cond_timedwait(&reaper_cond, &reaper_lock, &ts);
+        if (!reaper_running)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&reaper_lock);
+        sweep(limits_now_s());
+        pthread_mutex_lock(&reaper_lock);
+    }
+    pthread_mutex_unlock(&reaper_lock);
+    return NULL;
+}
+
+int limits_start(void)
+{
+    if (!limits.idle_timeout_s && !limits.packet_timeout_s)
+    {
+        return 0;
+    }
+
+    reaper_running = true;
+    if (threads_create(&reaper_tid, THREAD_HELPER, "aesd-reaper", reaper_thread, NULL) != 0)
+    {
+        syslog(LOG_ERR, "failed to create reaper thread: %m");
+        reaper_running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void limits_stop(void)
+{
+    pthread_mutex_lock(&reaper_lock);
+    if (!reaper_running)
+    {
+        pthread_mutex_unlock(&reaper_lock);
+        return;
+    }
+    reaper_running = false;
+    pthread_cond_signal(&reaper_cond);
+    pthread_mutex_unlock(&reaper_lock);
+    pthread_join(reaper_tid, NULL);
+}
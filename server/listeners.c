@@ -0,0 +1,350 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "listeners.h"
+#include "log.h"
+#include "sockopts.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct listeners_config listeners = {
+        .ipv6 = false,
+        .unix_path = NULL,
+        .port_count = 0,
+};
+
+struct listener {
+    int family;
+    uint16_t port;// 0 for AF_UNIX
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];// AF_UNIX only
+};
+
+static struct listener listener[LISTENERS_MAX];
+static int listener_fds[LISTENERS_MAX];
+static int listener_count;
+static int next_listener;// first one polled for the next connection
+
+/**
+ * listeners are non-blocking, a connection reset between poll() and accept()
+ * must not block the accepting thread
+ */
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void add_listener(int fd, int family, uint16_t port, const char *path)
+{
+    listener[listener_count].family = family;
+    listener[listener_count].port = port;
+    snprintf(listener[listener_count].path, sizeof(listener[listener_count].path), "%s", path ? path : "");
+    listener_fds[listener_count++] = fd;
+}
+
+static void remove_listener(int i)
+{
+    close(listener_fds[i]);
+    listener_count--;
+    listener[i] = listener[listener_count];
+    listener_fds[i] = listener_fds[listener_count];
+}
+
+/**
+ * @param port 0 for any port
+ */
+static int find_listener(int family, uint16_t port)
+{
+    for (int i = 0; i < listener_count; i++)
+    {
+        if (listener[i].family == family && (port == 0 || listener[i].port == port))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int listeners_adopt(int fd)
+{
+    union {
+        struct sockaddr_storage storage;
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+        struct sockaddr_un un;
+    } addr;
+    socklen_t addr_len = sizeof(addr);
+
+    uint16_t port = 0;
+
+    // the storage is larger than sockaddr_un, so the path stays terminated
+    memset(&addr, 0, sizeof(addr));
+    if (listener_count == LISTENERS_MAX || getsockname(fd, (struct sockaddr *) &addr, &addr_len) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (addr.storage.ss_family == AF_INET)
+    {
+        port = ntohs(addr.in.sin_port);
+    } else if (addr.storage.ss_family == AF_INET6)
+    {
+        port = ntohs(addr.in6.sin6_port);
+    }
+    if (find_listener(addr.storage.ss_family, port) >= 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    add_listener(fd, addr.storage.ss_family, port, addr.storage.ss_family == AF_UNIX ? addr.un.sun_path : NULL);
+    // the options of this instance apply to it from now on
+    sockopts_apply_listener(fd, addr.storage.ss_family);
+    return set_nonblocking(fd);
+}
+
+static int open_inet(int family, uint16_t port)
+{
+    struct sockaddr_in addr4;
+    struct sockaddr_in6 addr6;
+    struct sockaddr *addr;
+    socklen_t addr_len;
+    int one = 1;
+
+    int fd = socket(family, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (family == AF_INET6)
+    {
+        // IPv4 has a socket of its own, mapped addresses would collide with it
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one));
+        memset(&addr6, 0, sizeof(addr6));
+        addr6.sin6_family = AF_INET6;
+        addr6.sin6_addr = in6addr_any;
+        addr6.sin6_port = htons(port);
+        addr = (struct sockaddr *) &addr6;
+        addr_len = sizeof(addr6);
+    } else
+    {
+        memset(&addr4, 0, sizeof(addr4));
+        addr4.sin_family = AF_INET;
+        addr4.sin_addr.s_addr = INADDR_ANY;
+        addr4.sin_port = htons(port);
+        addr = (struct sockaddr *) &addr4;
+        addr_len = sizeof(addr4);
+    }
+    sockopts_apply_listener(fd, family);
+
+    if (bind(fd, addr, addr_len) < 0 || listen(fd, LISTENERS_BACKLOG) < 0 || set_nonblocking(fd) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int open_unix(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    sockopts_apply_listener(fd, AF_UNIX);
+
+    // left behind by an instance that did not exit cleanly, a running one
+    // already kept us from binding the TCP port
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, LISTENERS_BACKLOG) < 0 ||
+        set_nonblocking(fd) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool wanted_port(uint16_t port, uint16_t server_port)
+{
+    if (port == server_port)
+    {
+        return true;
+    }
+    for (int i = 0; i < listeners.port_count; i++)
+    {
+        if (listeners.ports[i] == port)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int listeners_open(uint16_t port)
+{
+    int i, fd;
+
+    // the options of this instance win over the ones of the previous instance
+    for (i = listener_count - 1; i >= 0; i--)
+    {
+        if ((listener[i].family == AF_INET && !wanted_port(listener[i].port, port)) ||
+            (listener[i].family == AF_INET6 && (!listeners.ipv6 || listener[i].port != port)))
+        {
+            remove_listener(i);
+        }
+    }
+    if ((i = find_listener(AF_UNIX, 0)) >= 0 &&
+        (listeners.unix_path == NULL || strcmp(listener[i].path, listeners.unix_path) != 0))
+    {
+        unlink(listener[i].path);
+        remove_listener(i);
+    }
+
+    if (find_listener(AF_INET, port) < 0)
+    {
+        if ((fd = open_inet(AF_INET, port)) < 0)
+        {
+            syslog(LOG_ERR, "IPv4 listener on port %u failed: %m", port);
+            return -1;
+        }
+        add_listener(fd, AF_INET, port, NULL);
+    }
+    syslog(LOG_INFO, "server listening on port %u", port);
+
+    for (int n = 0; n < listeners.port_count; n++)
+    {
+        uint16_t extra = listeners.ports[n];
+        if (find_listener(AF_INET, extra) < 0)
+        {
+            if ((fd = open_inet(AF_INET, extra)) < 0)
+            {
+                syslog(LOG_ERR, "IPv4 listener on port %u failed: %m", extra);
+                return -1;
+            }
+            add_listener(fd, AF_INET, extra, NULL);
+        }
+        syslog(LOG_INFO, "server listening on port %u", extra);
+    }
+
+    if (listeners.ipv6 && find_listener(AF_INET6, port) < 0)
+    {
+        // hosts without IPv6 still serve IPv4 and UNIX clients
+        if ((fd = open_inet(AF_INET6, port)) < 0)
+        {
+            syslog(LOG_WARNING, "IPv6 listener on port %u failed, continuing without: %m", port);
+        } else
+        {
+            add_listener(fd, AF_INET6, port, NULL);
+        }
+    }
+    if (listeners.ipv6 && find_listener(AF_INET6, port) >= 0)
+    {
+        syslog(LOG_INFO, "server listening on IPv6 port %u", port);
+    }
+
+    if (listeners.unix_path != NULL)
+    {
+        if (find_listener(AF_UNIX, 0) < 0)
+        {
+            if ((fd = open_unix(listeners.unix_path)) < 0)
+            {
+                syslog(LOG_ERR, "UNIX listener on %s failed: %m", listeners.unix_path);
+                return -1;
+            }
+            add_listener(fd, AF_UNIX, 0, listeners.unix_path);
+        }
+        syslog(LOG_INFO, "server listening on %s", listeners.unix_path);
+    }
+    return 0;
+}
+
+int listeners_accept(uint16_t *port)
+{
+    struct pollfd pfd[LISTENERS_MAX];
+
+    for (;;)
+    {
+        for (int i = 0; i < listener_count; i++)
+        {
+            pfd[i].fd = listener_fds[i];
+            pfd[i].events = POLLIN;
+            pfd[i].revents = 0;
+        }
+        // signals interrupt poll() whatever SA_RESTART says
+        if (poll(pfd, listener_count, -1) < 0)
+        {
+            return -1;
+        }
+
+        for (int n = 0; n < listener_count; n++)
+        {
+            int i = (next_listener + n) % listener_count;
+            if (!(pfd[i].revents & POLLIN))
+            {
+                continue;
+            }
+
+            int client_sock = accept(listener_fds[i], NULL, NULL);
+            if (client_sock >= 0)
+            {
+                sockopts_apply_client(client_sock, listener[i].family);
+                *port = listener[i].port;
+                next_listener = (i + 1) % listener_count;
+                return client_sock;
+            }
+            // reset by the peer before it was accepted
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+            {
+                return -1;
+            }
+        }
+    }
+}
+
+int listeners_get(const int **fds)
+{
+    *fds = listener_fds;
+    return listener_count;
+}
+
+void listeners_close(bool handed_off)
+{
+    while (listener_count > 0)
+    {
+        if (listener[0].family == AF_UNIX && !handed_off)
+        {
+            unlink(listener[0].path);
+        }
+        remove_listener(0);
+    }
+}
@@ -0,0 +1,76 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_LISTENERS_H
+#define AESDSOCKET_LISTENERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * IPv4 ports listened on besides the server port, e.g. for named stores
+ */
+#define LISTENERS_PORTS_MAX 8
+/**
+ * IPv4, IPv6 and UNIX stream listeners, and one per extra port
+ */
+#define LISTENERS_MAX (3 + LISTENERS_PORTS_MAX)
+#define LISTENERS_BACKLOG 10
+
+/**
+ * sockets the server accepts connections on besides IPv4 on every address,
+ * all of them speak the same protocols and are served the same way
+ */
+struct listeners_config {
+    /**
+     * also listen on every IPv6 address, IPv4 stays on its own socket
+     */
+    bool ipv6;
+    /**
+     * path of a UNIX stream socket to listen on, NULL for none
+     */
+    const char *unix_path;
+    /**
+     * further IPv4 ports, connections know which one they came in on
+     */
+    uint16_t ports[LISTENERS_PORTS_MAX];
+    int port_count;
+};
+
+extern struct listeners_config listeners;
+
+/**
+ * keep the listening socket @param fd taken over from the previous instance,
+ * listeners_open() decides whether it is still wanted
+ * @return 0 on success, -1 if there is no room left (@param fd is closed)
+ */
+int listeners_adopt(int fd);
+
+/**
+ * open the configured listeners on @param port that were not adopted and
+ * close adopted ones that are no longer configured
+ * @return 0 on success, -1 if the IPv4 or UNIX socket could not be opened
+ */
+int listeners_open(uint16_t port);
+
+/**
+ * wait for a connection on any listener, they take turns when several have one
+ * @param port set to the port of the listener it came in on, 0 for the UNIX socket
+ * @return the connected socket, -1 with errno set if interrupted or on error
+ */
+int listeners_accept(uint16_t *port);
+
+/**
+ * @param fds set to the listening sockets, to pass them to a successor
+ * @return the number of listening sockets
+ */
+int listeners_get(const int **fds);
+
+/**
+ * close every listener, the UNIX socket path is removed unless @param handed_off
+ * as the successor goes on listening on it
+ */
+void listeners_close(bool handed_off);
+
+#endif// AESDSOCKET_LISTENERS_H
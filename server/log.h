@@ -0,0 +1,60 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_LOG_H
+#define AESDSOCKET_LOG_H
+
+#include <stdatomic.h>
+#include <syslog.h>
+#include <time.h>
+
+/**
+ * debug logging is only compiled in when building with DEBUG=y, so release
+ * builds do not pay for a syslog() call on every accept/thread add/remove
+ */
+#ifdef AESD_DEBUG
+#define LOG_DBG(fmt, ...) syslog(LOG_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DBG(fmt, ...) do {} while (0)
+#endif
+
+#define LOG_RATELIMIT_INTERVAL_S 5
+#define LOG_RATELIMIT_BURST 10
+
+/**
+ * per call site rate limit state: at most LOG_RATELIMIT_BURST messages
+ * every LOG_RATELIMIT_INTERVAL_S seconds
+ */
+struct log_ratelimit {
+    _Atomic long window;
+    _Atomic unsigned int count;
+};
+
+static inline int log_ratelimit_ok(struct log_ratelimit *rl)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    long window = now.tv_sec / LOG_RATELIMIT_INTERVAL_S;
+    if (atomic_load_explicit(&rl->window, memory_order_relaxed) != window)
+    {
+        atomic_store_explicit(&rl->window, window, memory_order_relaxed);
+        atomic_store_explicit(&rl->count, 0, memory_order_relaxed);
+    }
+
+    return atomic_fetch_add_explicit(&rl->count, 1, memory_order_relaxed) < LOG_RATELIMIT_BURST;
+}
+
+/**
+ * rate limited syslog() for messages that can be triggered by clients
+ */
+#define LOG_RL(level, fmt, ...)                       \
+    do                                                \
+    {                                                 \
+        static struct log_ratelimit _rl;              \
+        if (log_ratelimit_ok(&_rl))                   \
+            syslog(level, fmt, ##__VA_ARGS__);        \
+    } while (0)
+
+#endif// AESDSOCKET_LOG_H
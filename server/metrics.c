@@ -0,0 +1,307 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "metrics.h"
+#include "aesd_threads.h"
+#include "conn_limits.h"
+#include "log.h"
+#include "sockopts.h"
+#include "subscribe.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define METRICS_BUF_SIZE 4096
+/**
+ * room for the per-client lines of one connection
+ */
+#define METRICS_CLIENT_SIZE 512
+
+/**
+ * slot registry, only touched when a connection starts or ends and on scrape
+ */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct metrics_slot *live_slots = NULL;
+static struct metrics_slot retired;// counters of connections that already ended
+static uint64_t connections_total = 0;
+static uint64_t connections_active = 0;
+
+static int metrics_sock = -1;
+static pthread_t metrics_tid;
+
+struct metrics_slot *metrics_slot_acquire(int client)
+{
+    struct metrics_slot *slot = calloc(1, sizeof(*slot));
+    if (slot == NULL)
+    {
+        return NULL;
+    }
+    slot->client = client;
+
+    pthread_mutex_lock(&registry_lock);
+    slot->next = live_slots;
+    live_slots = slot;
+    connections_total++;
+    connections_active++;
+    pthread_mutex_unlock(&registry_lock);
+    return slot;
+}
+
+static void fold_slot(struct metrics_slot *dst, struct metrics_slot *src)
+{
+    metrics_add(&dst->packets, atomic_load_explicit(&src->packets, memory_order_relaxed));
+    metrics_add(&dst->bytes_in, atomic_load_explicit(&src->bytes_in, memory_order_relaxed));
+    metrics_add(&dst->bytes_out, atomic_load_explicit(&src->bytes_out, memory_order_relaxed));
+    metrics_add(&dst->lock_wait_ns, atomic_load_explicit(&src->lock_wait_ns, memory_order_relaxed));
+    metrics_add(&dst->sched_wait_ns, atomic_load_explicit(&src->sched_wait_ns, memory_order_relaxed));
+    metrics_add(&dst->throttled_ns, atomic_load_explicit(&src->throttled_ns, memory_order_relaxed));
+    metrics_add(&dst->send_throttled_ns, atomic_load_explicit(&src->send_throttled_ns, memory_order_relaxed));
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+    {
+        metrics_add(&dst->latency_us[i], atomic_load_explicit(&src->latency_us[i], memory_order_relaxed));
+    }
+}
+
+void metrics_slot_release(struct metrics_slot *slot)
+{
+    if (slot == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&registry_lock);
+    struct metrics_slot **current = &live_slots;
+    while (*current && *current != slot)
+    {
+        current = &(*current)->next;
+    }
+    if (*current)
+    {
+        *current = slot->next;
+    }
+    fold_slot(&retired, slot);
+    connections_active--;
+    pthread_mutex_unlock(&registry_lock);
+
+    free(slot);
+}
+
+void metrics_lock(pthread_mutex_t *lock, struct metrics_slot *slot)
+{
+    // uncontended case does not pay for reading the clock
+    if (pthread_mutex_trylock(lock) == 0)
+    {
+        return;
+    }
+
+    uint64_t start = metrics_now_ns();
+    pthread_mutex_lock(lock);
+    metrics_add(&slot->lock_wait_ns, metrics_now_ns() - start);
+}
+
+static size_t format_metrics(char *out, size_t size)
+{
+    struct metrics_slot total;
+    uint64_t total_connections, active_connections;
+
+    memset(&total, 0, sizeof(total));
+
+    pthread_mutex_lock(&registry_lock);
+    fold_slot(&total, &retired);
+    for (struct metrics_slot *slot = live_slots; slot; slot = slot->next)
+    {
+        fold_slot(&total, slot);
+    }
+    total_connections = connections_total;
+    active_connections = connections_active;
+    pthread_mutex_unlock(&registry_lock);
+
+    struct subscribe_stats followers;
+    subscribe_get_stats(&followers);
+
+    size_t len = 0;
+#define EMIT(...)                                                        \
+    do                                                                   \
+    {                                                                    \
+        if (len < size)                                                  \
+            len += snprintf(out + len, size - len, __VA_ARGS__);         \
+    } while (0)
+
+    EMIT("aesdsocket_connections_active %lu\n", (unsigned long) active_connections);
+    EMIT("aesdsocket_connections_total %lu\n", (unsigned long) total_connections);
+    EMIT("aesdsocket_packets_total %lu\n", (unsigned long) total.packets);
+    EMIT("aesdsocket_bytes_in_total %lu\n", (unsigned long) total.bytes_in);
+    EMIT("aesdsocket_bytes_out_total %lu\n", (unsigned long) total.bytes_out);
+    EMIT("aesdsocket_lock_wait_ns_total %lu\n", (unsigned long) total.lock_wait_ns);
+    EMIT("aesdsocket_sched_wait_ns_total %lu\n", (unsigned long) total.sched_wait_ns);
+    EMIT("aesdsocket_throttled_ns_total{direction=\"in\"} %lu\n", (unsigned long) total.throttled_ns);
+    EMIT("aesdsocket_throttled_ns_total{direction=\"out\"} %lu\n", (unsigned long) total.send_throttled_ns);
+    EMIT("aesdsocket_followers %lu\n", (unsigned long) followers.followers);
+    EMIT("aesdsocket_published_packets_total %lu\n", (unsigned long) followers.published);
+    EMIT("aesdsocket_follower_packets_dropped_total %lu\n", (unsigned long) followers.dropped);
+    EMIT("aesdsocket_followers_disconnected_total %lu\n", (unsigned long) followers.disconnected);
+    for (int reason = LIMITS_DROP_NONE + 1; reason < LIMITS_DROP_NR; reason++)
+    {
+        EMIT("aesdsocket_connections_dropped_total{reason=\"%s\"} %lu\n", limits_drop_name(reason),
+             (unsigned long) limits_drops(reason));
+    }
+
+    // cumulative buckets so the output can be scraped as a histogram
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+    {
+        cumulative += total.latency_us[i];
+        if (i < METRICS_LATENCY_BUCKETS - 1)
+        {
+            EMIT("aesdsocket_reply_latency_us_bucket{le=\"%lu\"} %lu\n", 1ul << i, (unsigned long) cumulative);
+        } else
+        {
+            EMIT("aesdsocket_reply_latency_us_bucket{le=\"+Inf\"} %lu\n", (unsigned long) cumulative);
+        }
+    }
+    EMIT("aesdsocket_reply_latency_us_count %lu\n", (unsigned long) cumulative);
+
+    // connections that come and go in between are only part of the totals
+    pthread_mutex_lock(&registry_lock);
+    for (struct metrics_slot *slot = live_slots; slot; slot = slot->next)
+    {
+        int client = slot->client;
+        EMIT("aesdsocket_client_packets_total{client=\"%d\"} %lu\n", client,
+             (unsigned long) atomic_load_explicit(&slot->packets, memory_order_relaxed));
+        EMIT("aesdsocket_client_bytes_in_total{client=\"%d\"} %lu\n", client,
+             (unsigned long) atomic_load_explicit(&slot->bytes_in, memory_order_relaxed));
+        EMIT("aesdsocket_client_bytes_out_total{client=\"%d\"} %lu\n", client,
+             (unsigned long) atomic_load_explicit(&slot->bytes_out, memory_order_relaxed));
+        EMIT("aesdsocket_client_sched_wait_ns_total{client=\"%d\"} %lu\n", client,
+             (unsigned long) atomic_load_explicit(&slot->sched_wait_ns, memory_order_relaxed));
+        EMIT("aesdsocket_client_throttled_ns_total{client=\"%d\",direction=\"in\"} %lu\n", client,
+             (unsigned long) atomic_load_explicit(&slot->throttled_ns, memory_order_relaxed));
+        EMIT("aesdsocket_client_throttled_ns_total{client=\"%d\",direction=\"out\"} %lu\n", client,
+             (unsigned long) atomic_load_explicit(&slot->send_throttled_ns, memory_order_relaxed));
+    }
+    pthread_mutex_unlock(&registry_lock);
+#undef EMIT
+
+    return len < size ? len : size - 1;
+}
+
+/**
+ * @return how large the output of format_metrics() is going to be at most
+ */
+static size_t metrics_size(void)
+{
+    pthread_mutex_lock(&registry_lock);
+    size_t size = METRICS_BUF_SIZE + connections_active * METRICS_CLIENT_SIZE;
+    pthread_mutex_unlock(&registry_lock);
+    return size;
+}
+
+static void *metrics_thread(void *arg)
+{
+
+    // leave SIGINT/SIGTERM to the other threads, metrics_stop() wakes us up
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;)
+    {
+        int client_sock = accept(metrics_sock, NULL, NULL);
+        if (client_sock < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break;// listener was shut down
+        }
+
+        // connections accepted in between may not make it into the output
+        size_t size = metrics_size();
+        char *out = malloc(size);
+        if (out == NULL)
+        {
+            close(client_sock);
+            continue;
+        }
+
+        size_t len = format_metrics(out, size);
+        size_t total_sent = 0;
+        while (total_sent < len)
+        {
+            ssize_t bytes_sent = send(client_sock, out + total_sent, len - total_sent, MSG_NOSIGNAL);
+            if (bytes_sent < 0)
+            {
+                LOG_RL(LOG_ERR, "metrics send failed: %m");
+                break;
+            }
+            total_sent += bytes_sent;
+        }
+        free(out);
+        close(client_sock);
+    }
+
+    return NULL;
+}
+
+int metrics_start(uint16_t port)
+{
+    struct sockaddr_in addr;
+
+    metrics_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (metrics_sock < 0)
+    {
+        syslog(LOG_ERR, "metrics socket creation failed: %m");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    // SO_REUSEADDR like the other listeners, or a restart after a scrape finds the port in TIME_WAIT
+    sockopts_apply_listener(metrics_sock, AF_INET);
+
+    if (bind(metrics_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(metrics_sock, 4) < 0)
+    {
+        syslog(LOG_ERR, "metrics bind/listen on port %d failed: %m", port);
+        goto error;
+    }
+
+    if (threads_create(&metrics_tid, THREAD_HELPER, "aesd-metrics", metrics_thread, NULL) != 0)
+    {
+        syslog(LOG_ERR, "failed to create metrics thread: %m");
+        goto error;
+    }
+
+    syslog(LOG_INFO, "metrics listening on 127.0.0.1:%d", port);
+    return 0;
+
+error:
+    close(metrics_sock);
+    metrics_sock = -1;
+    return -1;
+}
+
+void metrics_stop(void)
+{
+    if (metrics_sock < 0)
+    {
+        return;
+    }
+
+    // wakes up the blocking accept() in the metrics thread
+    shutdown(metrics_sock, SHUT_RDWR);
+    pthread_join(metrics_tid, NULL);
+    close(metrics_sock);
+    metrics_sock = -1;
+}
@@ -0,0 +1,92 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_METRICS_H
+#define AESDSOCKET_METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#define METRICS_PORT 9001
+/**
+ * reply latency histogram buckets, bucket i counts replies that took
+ * less than 2^i microseconds, the last bucket is +Inf
+ */
+#define METRICS_LATENCY_BUCKETS 22
+
+/**
+ * Per-thread counters
+ *
+ * Each slot is written only by the thread that owns it, so updates are plain
+ * relaxed load/store pairs with no lock and no read-modify-write. Readers
+ * aggregate all live slots on demand.
+ */
+struct metrics_slot {
+    int client;// socket of the connection, labels its own counters
+    _Atomic uint64_t packets;
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t bytes_out;
+    _Atomic uint64_t lock_wait_ns;
+    _Atomic uint64_t sched_wait_ns;    // waiting for the turn on the store
+    _Atomic uint64_t throttled_ns;     // receiving paused by the rate limits
+    _Atomic uint64_t send_throttled_ns;// sending paused by the rate limits, written by the sender
+    _Atomic uint64_t latency_us[METRICS_LATENCY_BUCKETS];
+    struct metrics_slot *next;
+};
+
+static inline uint64_t metrics_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void metrics_add(_Atomic uint64_t *counter, uint64_t value)
+{
+    // single writer, no need for an atomic read-modify-write
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+static inline void metrics_record_latency(struct metrics_slot *slot, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS - 1 && us >= (1ull << bucket))
+    {
+        bucket++;
+    }
+    metrics_add(&slot->latency_us[bucket], 1);
+}
+
+/**
+ * register the connection on @param client and return its counter slot, NULL
+ * on allocation failure
+ */
+struct metrics_slot *metrics_slot_acquire(int client);
+
+/**
+ * fold the counters of @param slot into the totals and free it
+ */
+void metrics_slot_release(struct metrics_slot *slot);
+
+/**
+ * lock @param lock, accounting the time spent waiting for it to @param slot
+ */
+void metrics_lock(pthread_mutex_t *lock, struct metrics_slot *slot);
+
+/**
+ * start serving the plain-text metrics on 127.0.0.1:@param port
+ * @return 0 on success, -1 on failure
+ */
+int metrics_start(uint16_t port);
+
+/**
+ * stop the metrics thread and wait for it to exit
+ */
+void metrics_stop(void);
+
+#endif// AESDSOCKET_METRICS_H
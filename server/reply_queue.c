@@ -0,0 +1,543 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+// memrchr is a GNU extension
+#define _GNU_SOURCE
+
+#include "reply_queue.h"
+#include "aesd_threads.h"
+#include "log.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define SEND_CHUNK_SIZE 65536
+/**
+ * longest line a filtered store range is read into memory for, longer lines
+ * are searched in pieces
+ */
+#define FILTER_LINE_MAX (16 << 20)
+
+/**
+ * matches of a filtered reply collected into the sender chunk
+ */
+struct filter_output {
+    int sock;
+    const struct reply *reply;
+    char *data;
+    size_t length;
+    size_t sent;
+};
+
+struct reply *reply_new(uint64_t start_ns)
+{
+    struct reply *reply = calloc(1, sizeof(*reply));
+    if (reply)
+    {
+        reply->store_fd = -1;
+        reply->start_ns = start_ns;
+    }
+    return reply;
+}
+
+void reply_free(struct reply *reply)
+{
+    if (reply->shared)
+    {
+        shared_payload_put(reply->shared);
+    } else
+    {
+        free(reply->data);
+    }
+    free(reply->filter);
+    free(reply);
+}
+
+struct shared_payload *shared_payload_new(size_t length)
+{
+    struct shared_payload *payload = malloc(sizeof(*payload) + length);
+    if (payload)
+    {
+        atomic_init(&payload->refs, 1);
+        payload->length = length;
+    }
+    return payload;
+}
+
+void shared_payload_put(struct shared_payload *payload)
+{
+    if (atomic_fetch_sub_explicit(&payload->refs, 1, memory_order_acq_rel) == 1)
+    {
+        free(payload);
+    }
+}
+
+static int send_all(int sock, const char *data, size_t len, int flags)
+{
+    while (len > 0)
+    {
+        ssize_t bytes_sent = send(sock, data, len, MSG_NOSIGNAL | flags);
+        if (bytes_sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += bytes_sent;
+        len -= bytes_sent;
+    }
+    return 0;
+}
+
+static int send_gathered(int sock, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+
+    while (msg.msg_iovlen > 0)
+    {
+        ssize_t bytes_sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (bytes_sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        // skip what was sent, resume from the middle of a partially sent iovec
+        while (msg.msg_iovlen > 0 && (size_t) bytes_sent >= msg.msg_iov->iov_len)
+        {
+            bytes_sent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + bytes_sent;
+            msg.msg_iov->iov_len -= bytes_sent;
+        }
+    }
+    return 0;
+}
+
+static int send_store_range(int sock, int store_fd, off_t offset, size_t len, char *chunk)
+{
+    // zero copy from the page cache where the store supports it
+    while (len > 0)
+    {
+        ssize_t bytes_sent = sendfile(sock, store_fd, &offset, len);
+        if (bytes_sent > 0)
+        {
+            len -= bytes_sent;
+            continue;
+        }
+        if (bytes_sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_sent < 0 && (errno == EINVAL || errno == ENOSYS))
+        {
+            break;
+        }
+        return -1;
+    }
+
+    while (len > 0)
+    {
+        ssize_t bytes_read = pread(store_fd, chunk, len < SEND_CHUNK_SIZE ? len : SEND_CHUNK_SIZE, offset);
+        if (bytes_read <= 0 || send_all(sock, chunk, bytes_read, 0) < 0)
+        {
+            return -1;
+        }
+        offset += bytes_read;
+        len -= bytes_read;
+    }
+    return 0;
+}
+
+/**
+ * send @param len bytes of matches, framed when the reply is binary
+ */
+static int flush_matches(struct filter_output *out, const char *data, size_t len)
+{
+    if (out->reply->has_hdr)
+    {
+        struct aesd_bin_hdr hdr = out->reply->hdr;
+        struct iovec iov[2] = {
+                {.iov_base = &hdr, .iov_len = sizeof(hdr)},
+                {.iov_base = (char *) data, .iov_len = len}};
+        hdr.length = htonl(len);
+        out->sent += sizeof(hdr);
+        if (send_gathered(out->sock, iov, len > 0 ? 2 : 1) < 0)
+        {
+            return -1;
+        }
+    } else if (send_all(out->sock, data, len, 0) < 0)
+    {
+        return -1;
+    }
+    out->sent += len;
+    return 0;
+}
+
+/**
+ * collect one matching line, adjacent matches leave in the same send
+ */
+static int emit_match(struct filter_output *out, const char *line, size_t len)
+{
+    if (out->length + len > SEND_CHUNK_SIZE)
+    {
+        if (out->length > 0 && flush_matches(out, out->data, out->length) < 0)
+        {
+            return -1;
+        }
+        out->length = 0;
+        if (len > SEND_CHUNK_SIZE)
+        {
+            return flush_matches(out, line, len);
+        }
+    }
+    memcpy(out->data + out->length, line, len);
+    out->length += len;
+    return 0;
+}
+
+/**
+ * collect the matching lines of [@param data, @param end), which starts at a line
+ */
+static int filter_block(struct filter_output *out, const char *data, const char *end)
+{
+    const char *line;
+    size_t line_len;
+
+    while ((line = filter_next_line(out->reply->filter, data, end, &line_len)) != NULL)
+    {
+        if (emit_match(out, line, line_len) < 0)
+        {
+            return -1;
+        }
+        data = line + line_len;
+    }
+    return 0;
+}
+
+/**
+ * read the store range in blocks of whole lines and collect the matching ones
+ */
+static int filter_store_range(struct filter_output *out, int store_fd, off_t offset, size_t len)
+{
+    size_t capacity = SEND_CHUNK_SIZE, have = 0;
+    char *block = malloc(capacity);
+    int rc = 0;
+
+    if (block == NULL)
+    {
+        return -1;
+    }
+
+    while (rc == 0 && (len > 0 || have > 0))
+    {
+        if (have == capacity && capacity < FILTER_LINE_MAX)
+        {
+            // a line longer than the block
+            char *larger = realloc(block, capacity * 2);
+            if (larger == NULL)
+            {
+                rc = -1;
+                break;
+            }
+            block = larger;
+            capacity *= 2;
+        }
+        if (have < capacity && len > 0)
+        {
+            ssize_t bytes_read = pread(store_fd, block + have, len < capacity - have ? len : capacity - have, offset);
+            if (bytes_read <= 0)
+            {
+                rc = -1;
+                break;
+            }
+            have += bytes_read;
+            offset += bytes_read;
+            len -= bytes_read;
+        }
+
+        // search complete lines, everything once the range is read or the line too long
+        char *last = len > 0 && have < FILTER_LINE_MAX ? memrchr(block, '\n', have) : block + have - 1;
+        if (last == NULL)
+        {
+            continue;
+        }
+        size_t searched = last + 1 - block;
+        rc = filter_block(out, block, block + searched);
+        memmove(block, block + searched, have - searched);
+        have -= searched;
+    }
+
+    free(block);
+    return rc;
+}
+
+/**
+ * send the lines of the reply payload that match its filter
+ * @return the number of bytes sent, -1 on failure
+ */
+static ssize_t send_filtered(struct reply_queue *queue, struct reply *reply, char *chunk)
+{
+    struct filter_output out = {.sock = queue->sock, .reply = reply, .data = chunk};
+    int rc;
+
+    if (reply->store_fd >= 0)
+    {
+        rc = filter_store_range(&out, reply->store_fd, reply->offset, reply->length);
+    } else
+    {
+        rc = filter_block(&out, reply->data, reply->data + reply->length);
+    }
+    if (rc == 0 && out.length > 0)
+    {
+        rc = flush_matches(&out, out.data, out.length);
+    }
+    // binary replies end with an empty frame
+    if (rc == 0 && reply->has_hdr)
+    {
+        rc = flush_matches(&out, NULL, 0);
+    }
+    return rc < 0 ? -1 : (ssize_t) out.sent;
+}
+
+/**
+ * @return the number of bytes sent, -1 on failure
+ */
+static ssize_t send_reply(struct reply_queue *queue, struct reply *reply, char *chunk)
+{
+    ssize_t total = reply->length + (reply->has_hdr ? sizeof(reply->hdr) : 0);
+
+    if (reply->filter)
+    {
+        return send_filtered(queue, reply, chunk);
+    }
+
+    if (reply->data || reply->length == 0)
+    {
+        // header and snapshot leave in a single system call
+        struct iovec iov[2];
+        int iovcnt = 0;
+        if (reply->has_hdr)
+        {
+            iov[iovcnt++] = (struct iovec){.iov_base = &reply->hdr, .iov_len = sizeof(reply->hdr)};
+        }
+        if (reply->length > 0)
+        {
+            iov[iovcnt++] = (struct iovec){.iov_base = reply->data, .iov_len = reply->length};
+        }
+        return send_gathered(queue->sock, iov, iovcnt) < 0 ? -1 : total;
+    }
+
+    // MSG_MORE lets the header share a segment with the sendfile() payload
+    if (reply->has_hdr && send_all(queue->sock, (char *) &reply->hdr, sizeof(reply->hdr), MSG_MORE) < 0)
+    {
+        return -1;
+    }
+    return send_store_range(queue->sock, reply->store_fd, reply->offset, reply->length, chunk) < 0 ? -1 : total;
+}
+
+/**
+ * hold the next reply back until the connection is within its byte rate
+ * again, replies still queued once the connection closes are not held back
+ */
+static void pace_sender(struct reply_queue *queue, size_t bytes_sent)
+{
+    uint64_t now = metrics_now_ns();
+    uint64_t until = now + limits_rate_charge(&queue->rate, limits.rate_bytes, bytes_sent, now);
+    struct timespec deadline = {.tv_sec = until / 1000000000ull, .tv_nsec = until % 1000000000ull};
+
+    if (until == now)
+    {
+        return;
+    }
+
+    // woken up by every queued reply, only closing ends the wait early
+    int rc = 0;
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->closing && rc != ETIMEDOUT)
+    {
+        rc = pthread_cond_timedwait(&queue->not_empty, &queue->lock, &deadline);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    metrics_add(&queue->slot->send_throttled_ns, metrics_now_ns() - now);
+}
+
+static void *sender_thread(void *arg)
+{
+    struct reply_queue *queue = arg;
+    char *chunk = malloc(SEND_CHUNK_SIZE);
+
+    // leave SIGINT/SIGTERM to the accepting thread
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->head == NULL && !queue->closing)
+        {
+            pthread_cond_wait(&queue->not_empty, &queue->lock);
+        }
+        struct reply *reply = queue->head;
+        if (reply == NULL)
+        {
+            // closing and drained
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        queue->head = reply->next;
+        if (queue->head == NULL)
+        {
+            queue->tail = NULL;
+        }
+        queue->depth--;
+        bool failed = queue->failed;
+        pthread_cond_signal(&queue->not_full);
+        pthread_mutex_unlock(&queue->lock);
+
+        if (!failed)
+        {
+            ssize_t bytes_sent = chunk ? send_reply(queue, reply, chunk) : -1;
+            if (bytes_sent < 0)
+            {
+                LOG_RL(LOG_ERR, "send failed: %m");
+                pthread_mutex_lock(&queue->lock);
+                queue->failed = true;
+                pthread_cond_broadcast(&queue->not_full);
+                pthread_mutex_unlock(&queue->lock);
+                // wake up the reader so the connection is torn down
+                shutdown(queue->sock, SHUT_RD);
+            } else
+            {
+                metrics_add(&queue->slot->bytes_out, bytes_sent);
+                metrics_record_latency(queue->slot, metrics_now_ns() - reply->start_ns);
+                pace_sender(queue, bytes_sent);
+            }
+        }
+        reply_free(reply);
+    }
+
+    free(chunk);
+    return NULL;
+}
+
+int reply_queue_start(struct reply_queue *queue, int sock, struct metrics_slot *slot)
+{
+    pthread_condattr_t attr;
+
+    // pace_sender() waits with deadlines on the clock of the rate limits
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, &attr);
+    pthread_cond_init(&queue->not_full, NULL);
+    pthread_condattr_destroy(&attr);
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->depth = 0;
+    queue->closing = false;
+    queue->failed = false;
+    queue->sock = sock;
+    queue->slot = slot;
+    queue->rate.empty_ns = 0;
+
+    // created by the connection thread, so it runs on the same CPU
+    char name[16];
+    snprintf(name, sizeof(name), "aesd-send-%d", sock);
+    if (threads_create(&queue->sender, THREAD_HELPER, name, sender_thread, queue) != 0)
+    {
+        pthread_cond_destroy(&queue->not_full);
+        pthread_cond_destroy(&queue->not_empty);
+        pthread_mutex_destroy(&queue->lock);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * must be called with queue->lock held
+ */
+static void enqueue(struct reply_queue *queue, struct reply *reply)
+{
+    reply->next = NULL;
+    if (queue->tail)
+    {
+        queue->tail->next = reply;
+    } else
+    {
+        queue->head = reply;
+    }
+    queue->tail = reply;
+    queue->depth++;
+    pthread_cond_signal(&queue->not_empty);
+}
+
+int reply_queue_push(struct reply_queue *queue, struct reply *reply)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->depth >= REPLY_QUEUE_DEPTH && !queue->failed)
+    {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    if (queue->failed)
+    {
+        pthread_mutex_unlock(&queue->lock);
+        reply_free(reply);
+        return -1;
+    }
+
+    enqueue(queue, reply);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+int reply_queue_try_push(struct reply_queue *queue, struct reply *reply, bool overcommit)
+{
+    pthread_mutex_lock(&queue->lock);
+    if (queue->failed || (!overcommit && queue->depth >= REPLY_QUEUE_DEPTH))
+    {
+        int err = queue->failed ? EPIPE : EAGAIN;
+        pthread_mutex_unlock(&queue->lock);
+        reply_free(reply);
+        errno = err;
+        return -1;
+    }
+
+    enqueue(queue, reply);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+void reply_queue_finish(struct reply_queue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closing = true;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_join(queue->sender, NULL);
+
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+}
@@ -0,0 +1,132 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_REPLY_QUEUE_H
+#define AESDSOCKET_REPLY_QUEUE_H
+
+#include "aesd_protocol.h"
+#include "conn_limits.h"
+#include "filter.h"
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * maximum number of replies waiting to be sent on one connection before the
+ * reader stops receiving (and TCP flow control throttles the client)
+ */
+#define REPLY_QUEUE_DEPTH 64
+
+/**
+ * Reference counted payload queued on several connections at once, see
+ * subscribe.c
+ */
+struct shared_payload {
+    _Atomic unsigned int refs;
+    size_t length;
+    char data[];
+};
+
+/**
+ * One reply, sent in the order it was queued
+ *
+ * The payload is either a snapshot in @data taken while the store lock was
+ * held, or a byte range of @store_fd that is still valid after the lock is
+ * dropped (the append-only file store) and is read at send time. A snapshot
+ * can also point into a @shared payload, which it holds a reference on.
+ * With a @filter only the lines of the payload that match it are sent.
+ */
+struct reply {
+    struct reply *next;
+    /**
+     * binary protocol header sent before the payload when has_hdr is set
+     */
+    struct aesd_bin_hdr hdr;
+    bool has_hdr;
+    char *data;
+    struct shared_payload *shared;
+    int store_fd;
+    off_t offset;
+    size_t length;
+    /**
+     * owned by the reply, binary replies then send the matches in frames of
+     * whole lines followed by an empty frame
+     */
+    struct filter *filter;
+    /**
+     * when the request was parsed, for the reply latency histogram
+     */
+    uint64_t start_ns;
+};
+
+struct reply_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct reply *head;
+    struct reply *tail;
+    size_t depth;
+    bool closing;// no more replies will be queued
+    bool failed; // a send failed, the connection is going away
+    int sock;
+    struct metrics_slot *slot;
+    struct token_bucket rate;// paces the replies to limits.rate_bytes
+    pthread_t sender;
+};
+
+/**
+ * allocate a zeroed reply, NULL on allocation failure
+ */
+struct reply *reply_new(uint64_t start_ns);
+
+/**
+ * release a reply that was not queued
+ */
+void reply_free(struct reply *reply);
+
+/**
+ * allocate a shared payload of @param length bytes holding one reference,
+ * NULL on allocation failure
+ */
+struct shared_payload *shared_payload_new(size_t length);
+
+static inline struct shared_payload *shared_payload_get(struct shared_payload *payload)
+{
+    atomic_fetch_add_explicit(&payload->refs, 1, memory_order_relaxed);
+    return payload;
+}
+
+void shared_payload_put(struct shared_payload *payload);
+
+/**
+ * start the sender thread for @param sock
+ * @return 0 on success, -1 on failure
+ */
+int reply_queue_start(struct reply_queue *queue, int sock, struct metrics_slot *slot);
+
+/**
+ * queue @param reply for sending, blocking while the queue is full.
+ * Takes ownership of @param reply.
+ * @return 0 on success, -1 if the connection failed
+ */
+int reply_queue_push(struct reply_queue *queue, struct reply *reply);
+
+/**
+ * queue @param reply without blocking. Takes ownership of @param reply.
+ * @param overcommit queue it even if the queue is full
+ * @return 0 on success, -1 with errno EAGAIN if the queue is full or EPIPE
+ *      if the connection failed
+ */
+int reply_queue_try_push(struct reply_queue *queue, struct reply *reply, bool overcommit);
+
+/**
+ * send everything still queued, stop the sender thread and release the queue
+ */
+void reply_queue_finish(struct reply_queue *queue);
+
+#endif// AESDSOCKET_REPLY_QUEUE_H
@@ -0,0 +1,266 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "sockopts.h"
+#include "log.h"
+
+#include <ctype.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#define SOCKOPTS_SPEC_MAX 256
+
+struct sockopts_preset {
+    const char *name;
+    struct sockopts_config config;
+};
+
+static const struct sockopts_preset presets[] = {
+        {"default", {.reuseaddr = true}},
+        // replies leave as soon as they are queued. busy_poll is left to be
+        // asked for: it needs a NIC with busy polling support and a spare
+        // CPU, a spinning receiver otherwise delays the thread it waits for
+        {"low-latency", {.reuseaddr = true, .nodelay = true}},
+        // fewer wakeups and larger windows, small replies may be coalesced
+        {"high-throughput", {.reuseaddr = true, .defer_accept_s = 5, .sndbuf = 1 << 20, .rcvbuf = 1 << 20}},
+};
+
+struct sockopts_config sockopts = {
+        .reuseaddr = true};
+
+/**
+ * non-negative integer with an optional k or m suffix
+ */
+static int parse_int(const char *value, int *result)
+{
+    char *end;
+    long n = strtol(value, &end, 0);
+    if (end == value || n < 0)
+    {
+        return -1;
+    }
+    if (*end == 'k' || *end == 'K')
+    {
+        n <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M')
+    {
+        n <<= 20;
+        end++;
+    }
+    if (*end != '\0' || n > (1 << 30))
+    {
+        return -1;
+    }
+    *result = n;
+    return 0;
+}
+
+static int parse_bool(const char *value, bool *result)
+{
+    if (strcmp(value, "1") == 0 || strcmp(value, "on") == 0 || strcmp(value, "yes") == 0)
+    {
+        *result = true;
+    } else if (strcmp(value, "0") == 0 || strcmp(value, "off") == 0 || strcmp(value, "no") == 0)
+    {
+        *result = false;
+    } else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int sockopts_set(const char *key, const char *value)
+{
+    if (strcmp(key, "preset") == 0)
+    {
+        for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++)
+        {
+            if (strcmp(value, presets[i].name) == 0)
+            {
+                sockopts = presets[i].config;
+                return 0;
+            }
+        }
+        return -1;
+    }
+    if (strcmp(key, "reuseaddr") == 0)
+    {
+        return parse_bool(value, &sockopts.reuseaddr);
+    }
+    if (strcmp(key, "nodelay") == 0)
+    {
+        return parse_bool(value, &sockopts.nodelay);
+    }
+    if (strcmp(key, "defer_accept") == 0)
+    {
+        return parse_int(value, &sockopts.defer_accept_s);
+    }
+    if (strcmp(key, "busy_poll") == 0)
+    {
+        return parse_int(value, &sockopts.busy_poll_us);
+    }
+    if (strcmp(key, "sndbuf") == 0)
+    {
+        return parse_int(value, &sockopts.sndbuf);
+    }
+    if (strcmp(key, "rcvbuf") == 0)
+    {
+        return parse_int(value, &sockopts.rcvbuf);
+    }
+    return -1;
+}
+
+int sockopts_parse(const char *spec)
+{
+    char copy[SOCKOPTS_SPEC_MAX];
+    char *saveptr, *item;
+
+    if (strlen(spec) >= sizeof(copy))
+    {
+        return -1;
+    }
+    strcpy(copy, spec);
+
+    for (item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr))
+    {
+        char *value = strchr(item, '=');
+        if (value == NULL)
+        {
+            // a bare name is a preset
+            if (sockopts_set("preset", item) < 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+        *value++ = '\0';
+        if (sockopts_set(item, value) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return @param s without leading and trailing white space, modified in place
+ */
+static char *trim(char *s)
+{
+    char *end;
+    while (isspace((unsigned char) *s))
+    {
+        s++;
+    }
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1]))
+    {
+        *--end = '\0';
+    }
+    return s;
+}
+
+int sockopts_load(const char *path)
+{
+    char line[SOCKOPTS_SPEC_MAX];
+    int line_number = 0, rc = 0;
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    while (rc == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        char *comment = strchr(line, '#');
+        char *key, *value;
+
+        line_number++;
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+        key = trim(line);
+        if (*key == '\0')
+        {
+            continue;
+        }
+
+        value = strchr(key, '=');
+        if (value == NULL)
+        {
+            rc = -1;
+        } else
+        {
+            *value++ = '\0';
+            rc = sockopts_set(trim(key), trim(value));
+        }
+        if (rc < 0)
+        {
+            fprintf(stderr, "%s:%d: invalid socket option\n", path, line_number);
+        }
+    }
+    fclose(file);
+    return rc;
+}
+
+static void set_int(int fd, int level, int name, const char *option, int value)
+{
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0)
+    {
+        LOG_RL(LOG_WARNING, "setting %s on socket %d failed: %m", option, fd);
+    }
+}
+
+/**
+ * options both kinds of socket take, accepted connections inherit most of
+ * them from the listener but not on every kernel
+ */
+static void apply_common(int fd, int family)
+{
+    bool tcp = family == AF_INET || family == AF_INET6;
+
+    if (sockopts.sndbuf > 0)
+    {
+        set_int(fd, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", sockopts.sndbuf);
+    }
+    if (sockopts.rcvbuf > 0)
+    {
+        set_int(fd, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", sockopts.rcvbuf);
+    }
+    if (tcp && sockopts.busy_poll_us > 0)
+    {
+        set_int(fd, SOL_SOCKET, SO_BUSY_POLL, "SO_BUSY_POLL", sockopts.busy_poll_us);
+    }
+}
+
+void sockopts_apply_listener(int fd, int family)
+{
+    if (family == AF_INET || family == AF_INET6)
+    {
+        if (sockopts.reuseaddr)
+        {
+            set_int(fd, SOL_SOCKET, SO_REUSEADDR, "SO_REUSEADDR", 1);
+        }
+        // also set when off, a listener taken over may still have them from the previous instance
+        set_int(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, "TCP_DEFER_ACCEPT", sockopts.defer_accept_s);
+        set_int(fd, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", sockopts.nodelay);
+    }
+    apply_common(fd, family);
+}
+
+void sockopts_apply_client(int fd, int family)
+{
+    if (sockopts.nodelay && (family == AF_INET || family == AF_INET6))
+    {
+        set_int(fd, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", 1);
+    }
+    apply_common(fd, family);
+}
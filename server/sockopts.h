@@ -0,0 +1,74 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_SOCKOPTS_H
+#define AESDSOCKET_SOCKOPTS_H
+
+#include <stdbool.h>
+
+/**
+ * socket options applied to the listeners and the connections accepted on
+ * them, 0 leaves an option at the kernel default
+ */
+struct sockopts_config {
+    /**
+     * SO_REUSEADDR, a restart can bind while connections of the previous
+     * instance are in TIME_WAIT
+     */
+    bool reuseaddr;
+    /**
+     * TCP_NODELAY, replies go out without waiting for the ACK of the previous one
+     */
+    bool nodelay;
+    /**
+     * TCP_DEFER_ACCEPT, connections are only accepted once data arrived or
+     * after this many seconds
+     */
+    int defer_accept_s;
+    /**
+     * SO_BUSY_POLL, microseconds a blocking receive busy polls the device queue
+     */
+    int busy_poll_us;
+    /**
+     * SO_SNDBUF and SO_RCVBUF in bytes
+     */
+    int sndbuf;
+    int rcvbuf;
+};
+
+extern struct sockopts_config sockopts;
+
+/**
+ * set one option by name, "preset" resets all of them to the named preset
+ * (default, low-latency or high-throughput)
+ * @return 0 on success, -1 if @param key or @param value is invalid
+ */
+int sockopts_set(const char *key, const char *value);
+
+/**
+ * apply a preset name or a comma separated list of key=value pairs, later
+ * entries override earlier ones
+ * @return 0 on success, -1 if @param spec is invalid
+ */
+int sockopts_parse(const char *spec);
+
+/**
+ * read key = value lines from @param path, # starts a comment
+ * @return 0 on success, -1 if the file cannot be read or has an invalid line
+ */
+int sockopts_load(const char *path);
+
+/**
+ * apply the options to listening socket @param fd of address family
+ * @param family, before bind() so that SO_REUSEADDR takes effect
+ */
+void sockopts_apply_listener(int fd, int family);
+
+/**
+ * apply the options to connection @param fd of address family @param family,
+ * TCP options are skipped for UNIX sockets
+ */
+void sockopts_apply_client(int fd, int family);
+
+#endif// AESDSOCKET_SOCKOPTS_H
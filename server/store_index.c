@@ -0,0 +1,373 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "store_index.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_INITIAL_CAPACITY 1024
+#define INDEX_SCAN_SIZE 65536
+#define INDEX_LOOKUP_CHUNK 4096
+
+static uint32_t crc_table[256];
+
+static void crc32_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+        crc_table[i] = crc;
+    }
+}
+
+/**
+ * crc32 of @param len bytes at @param data continuing from @param crc, 0 to start
+ */
+static uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    crc = ~crc;
+    while (len--)
+    {
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static int reserve_checkpoints(struct store_index *index, size_t count)
+{
+    size_t capacity = index->capacity;
+    uint64_t *checkpoints;
+
+    if (count <= capacity)
+    {
+        return 0;
+    }
+    while (capacity < count)
+    {
+        capacity *= 2;
+    }
+    checkpoints = realloc(index->checkpoints, capacity * sizeof(*checkpoints));
+    if (checkpoints == NULL)
+    {
+        return -1;
+    }
+    index->checkpoints = checkpoints;
+    index->capacity = capacity;
+    return 0;
+}
+
+/**
+ * account one more complete entry, the store is index->size bytes long
+ */
+static int push_entry(struct store_index *index)
+{
+    if (++index->count % STORE_INDEX_STRIDE != 0)
+    {
+        return 0;
+    }
+    if (reserve_checkpoints(index, index->checkpoint_count + 1) < 0)
+    {
+        index->count--;
+        return -1;
+    }
+    index->checkpoints[index->checkpoint_count++] = index->size;
+    return 0;
+}
+
+int store_index_init(struct store_index *index)
+{
+    crc32_init();
+    index->checkpoints = malloc(INDEX_INITIAL_CAPACITY * sizeof(*index->checkpoints));
+    if (index->checkpoints == NULL)
+    {
+        return -1;
+    }
+    index->checkpoints[0] = 0;
+    index->checkpoint_count = 1;
+    index->capacity = INDEX_INITIAL_CAPACITY;
+    index->count = 0;
+    index->size = 0;
+    index->saved_checkpoints = 0;
+    index->saved_crc = 0;
+    return 0;
+}
+
+void store_index_free(struct store_index *index)
+{
+    free(index->checkpoints);
+    index->checkpoints = NULL;
+    index->checkpoint_count = 0;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+int store_index_append(struct store_index *index, const char *data, size_t len)
+{
+    const char *end = data + len;
+    const char *newline;
+
+    while ((newline = memchr(data, '\n', end - data)) != NULL)
+    {
+        index->size += newline + 1 - data;
+        if (push_entry(index) < 0)
+        {
+            return -1;
+        }
+        data = newline + 1;
+    }
+    index->size += end - data;
+    return 0;
+}
+
+int store_index_scan(struct store_index *index, int fd)
+{
+    char *chunk = malloc(INDEX_SCAN_SIZE);
+    ssize_t bytes_read;
+    int rc = 0;
+
+    if (chunk == NULL)
+    {
+        return -1;
+    }
+
+    while ((bytes_read = pread(fd, chunk, INDEX_SCAN_SIZE, index->size)) > 0)
+    {
+        if (store_index_append(index, chunk, bytes_read) < 0)
+        {
+            rc = -1;
+            break;
+        }
+    }
+    if (bytes_read < 0)
+    {
+        rc = -1;
+    }
+
+    free(chunk);
+    return rc;
+}
+
+int64_t store_index_lookup(const struct store_index *index, int fd, uint32_t write_cmd, uint32_t write_cmd_offset)
+{
+    char chunk[INDEX_LOOKUP_CHUNK];
+    uint64_t pos, start;
+    uint32_t skip;
+
+    if (write_cmd >= index->count)
+    {
+        return -1;
+    }
+
+    // newlines to skip from the checkpoint to the start of the entry
+    pos = start = index->checkpoints[write_cmd / STORE_INDEX_STRIDE];
+    skip = write_cmd % STORE_INDEX_STRIDE;
+
+    while (pos < index->size)
+    {
+        size_t want = index->size - pos < sizeof(chunk) ? index->size - pos : sizeof(chunk);
+        ssize_t bytes_read = pread(fd, chunk, want, pos);
+        const char *p = chunk, *end;
+
+        if (bytes_read <= 0)
+        {
+            return -1;
+        }
+        end = chunk + bytes_read;
+
+        while (skip > 0)
+        {
+            const char *newline = memchr(p, '\n', end - p);
+            if (newline == NULL)
+            {
+                break;
+            }
+            p = newline + 1;
+            if (--skip == 0)
+            {
+                start = pos + (p - chunk);
+            }
+        }
+
+        if (skip == 0)
+        {
+            // the offset is inside the entry if no newline comes before it
+            uint64_t target = start + write_cmd_offset;
+            uint64_t from = pos + (p - chunk);
+            size_t len = target - from < (uint64_t) (end - p) ? target - from : end - p;
+
+            if (memchr(p, '\n', len) != NULL)
+            {
+                return -1;
+            }
+            if (from + len == target)
+            {
+                return target;
+            }
+        }
+        pos += bytes_read;
+    }
+    return -1;
+}
+
+/**
+ * crc32 of the STORE_INDEX_TAIL bytes (or fewer) of the store @param fd before @param size
+ */
+static int tail_crc(int fd, uint64_t size, uint32_t *crc)
+{
+    char tail[STORE_INDEX_TAIL];
+    size_t len = size < sizeof(tail) ? size : sizeof(tail);
+
+    if (pread(fd, tail, len, size - len) != (ssize_t) len)
+    {
+        return -1;
+    }
+    *crc = crc32(0, tail, len);
+    return 0;
+}
+
+static bool header_valid(const struct store_index_header *hdr, off_t file_size)
+{
+    return memcmp(hdr->magic, STORE_INDEX_MAGIC, sizeof(hdr->magic)) == 0 && hdr->version == STORE_INDEX_VERSION &&
+           hdr->stride == STORE_INDEX_STRIDE &&
+           hdr->header_crc == crc32(0, hdr, offsetof(struct store_index_header, header_crc)) &&
+           hdr->checkpoints == hdr->count / STORE_INDEX_STRIDE + 1 &&
+           hdr->checkpoints <= (file_size - sizeof(*hdr)) / sizeof(uint64_t);
+}
+
+int store_index_load(struct store_index *index, const char *path, int fd)
+{
+    struct stat st, store_st;
+    const struct store_index_header *hdr;
+    const uint64_t *checkpoints;
+    uint32_t crc;
+    void *map;
+    int rc = -1;
+
+    int sidecar = open(path, O_RDONLY);
+    if (sidecar < 0)
+    {
+        return -1;
+    }
+    if (fstat(sidecar, &st) < 0 || st.st_size < (off_t) sizeof(*hdr) || fstat(fd, &store_st) < 0)
+    {
+        close(sidecar);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, sidecar, 0);
+    close(sidecar);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    hdr = map;
+    checkpoints = (const uint64_t *) (hdr + 1);
+    if (header_valid(hdr, st.st_size) && hdr->store_ino == store_st.st_ino &&
+        hdr->size <= (uint64_t) store_st.st_size &&
+        hdr->checkpoints_crc == crc32(0, checkpoints, hdr->checkpoints * sizeof(uint64_t)) &&
+        tail_crc(fd, hdr->size, &crc) == 0 && crc == hdr->tail_crc &&
+        reserve_checkpoints(index, hdr->checkpoints) == 0)
+    {
+        memcpy(index->checkpoints, checkpoints, hdr->checkpoints * sizeof(uint64_t));
+        index->checkpoint_count = hdr->checkpoints;
+        index->count = hdr->count;
+        index->size = hdr->size;
+        index->saved_checkpoints = hdr->checkpoints;
+        index->saved_crc = hdr->checkpoints_crc;
+        rc = 0;
+    }
+
+    munmap(map, st.st_size);
+    return rc;
+}
+
+static int pwrite_all(int fd, const void *data, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t written = pwrite(fd, data, len, offset);
+        if (written < 0)
+        {
+            return -1;
+        }
+        data = (const char *) data + written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+int store_index_save(struct store_index *index, const char *path, int fd)
+{
+    struct store_index_header hdr;
+    struct stat st, store_st;
+    size_t first;
+    uint32_t crc;
+
+    int sidecar = open(path, O_RDWR | O_CREAT, 0644);
+    if (sidecar < 0)
+    {
+        return -1;
+    }
+    if (fstat(sidecar, &st) < 0 || fstat(fd, &store_st) < 0 || tail_crc(fd, index->size, &hdr.tail_crc) < 0)
+    {
+        close(sidecar);
+        return -1;
+    }
+
+    // a sidecar written by someone else or cut short is written from scratch
+    first = index->saved_checkpoints;
+    crc = index->saved_crc;
+    if ((uint64_t) st.st_size < sizeof(hdr) + first * sizeof(uint64_t))
+    {
+        first = 0;
+        crc = 0;
+    }
+
+    // checkpoints first, the header makes them count
+    if (pwrite_all(sidecar, index->checkpoints + first, (index->checkpoint_count - first) * sizeof(uint64_t),
+                   sizeof(hdr) + first * sizeof(uint64_t)) < 0)
+    {
+        close(sidecar);
+        return -1;
+    }
+    crc = crc32(crc, index->checkpoints + first, (index->checkpoint_count - first) * sizeof(uint64_t));
+
+    memset(hdr.magic, 0, sizeof(hdr.magic));
+    memcpy(hdr.magic, STORE_INDEX_MAGIC, sizeof(STORE_INDEX_MAGIC));
+    hdr.version = STORE_INDEX_VERSION;
+    hdr.stride = STORE_INDEX_STRIDE;
+    hdr.size = index->size;
+    hdr.count = index->count;
+    hdr.checkpoints = index->checkpoint_count;
+    hdr.store_ino = store_st.st_ino;
+    hdr.checkpoints_crc = crc;
+    hdr.header_crc = crc32(0, &hdr, offsetof(struct store_index_header, header_crc));
+    hdr.reserved = 0;
+
+    if (pwrite_all(sidecar, &hdr, sizeof(hdr), 0) < 0 ||
+        ftruncate(sidecar, sizeof(hdr) + index->checkpoint_count * sizeof(uint64_t)) < 0)
+    {
+        close(sidecar);
+        return -1;
+    }
+    close(sidecar);
+
+    index->saved_checkpoints = index->checkpoint_count;
+    index->saved_crc = crc;
+    return 0;
+}
@@ -0,0 +1,109 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_STORE_INDEX_H
+#define AESDSOCKET_STORE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * entries between two checkpoints, a lookup reads at most this many entries
+ * of the store
+ */
+#define STORE_INDEX_STRIDE 64
+
+/**
+ * In-process index of the entry (line) boundaries of the append-only store
+ *
+ * checkpoints[i] is the offset where entry i * STORE_INDEX_STRIDE starts, the
+ * entries in between are found by reading the store from there. Bytes after
+ * the last newline belong to a partial entry that is not indexed yet.
+ * Any necessary locking must be performed by the caller.
+ */
+struct store_index {
+    uint64_t *checkpoints;
+    size_t checkpoint_count;
+    size_t capacity;
+    uint64_t count;// number of complete entries
+    uint64_t size; // number of store bytes covered by the index
+    /**
+     * checkpoints already in the sidecar file and their crc32, later saves
+     * only append what was added since
+     */
+    size_t saved_checkpoints;
+    uint32_t saved_crc;
+};
+
+/**
+ * Sidecar file header, followed by the checkpoints, all in host byte order
+ *
+ * The sidecar is only used if both crc32s match and the store is the same
+ * file (inode) with the same bytes just before size (tail_crc), anything
+ * appended to the store after the last save is scanned again.
+ */
+struct store_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t stride;
+    uint64_t size;
+    uint64_t count;
+    uint64_t checkpoints;
+    uint64_t store_ino;
+    uint32_t tail_crc;
+    uint32_t checkpoints_crc;
+    uint32_t header_crc;// of everything before it
+    uint32_t reserved;
+};
+
+#define STORE_INDEX_MAGIC "AESDIDX"
+#define STORE_INDEX_VERSION 1
+/**
+ * store bytes before the covered size that have to match the sidecar
+ */
+#define STORE_INDEX_TAIL 4096
+
+/**
+ * initialize @param index to an empty store
+ * @return 0 on success, -1 on allocation failure
+ */
+int store_index_init(struct store_index *index);
+
+void store_index_free(struct store_index *index);
+
+/**
+ * index everything in @param fd from index->size to the end of the file
+ * @return 0 on success, -1 on failure
+ */
+int store_index_scan(struct store_index *index, int fd);
+
+/**
+ * account @param len bytes of @param data appended to the store
+ * @return 0 on success, -1 on allocation failure
+ */
+int store_index_append(struct store_index *index, const char *data, size_t len);
+
+/**
+ * find the store offset of byte @param write_cmd_offset of entry @param write_cmd,
+ * with the same validation as the AESDCHAR_IOCSEEKTO ioctl, reading the
+ * entries after the closest checkpoint from the store @param fd
+ * @return the offset, -1 if the position does not exist
+ */
+int64_t store_index_lookup(const struct store_index *index, int fd, uint32_t write_cmd, uint32_t write_cmd_offset);
+
+/**
+ * replace the empty @param index with the sidecar at @param path if it is
+ * valid for the store @param fd, store_index_scan() then indexes the rest
+ * @return 0 if the sidecar was loaded, -1 if it is missing or does not match
+ */
+int store_index_load(struct store_index *index, const char *path, int fd);
+
+/**
+ * bring the sidecar at @param path up to date with @param index of the store
+ * @param fd, only the checkpoints added since the last save are written
+ * @return 0 on success, -1 on failure
+ */
+int store_index_save(struct store_index *index, const char *path, int fd);
+
+#endif// AESDSOCKET_STORE_INDEX_H
@@ -0,0 +1,140 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "store_sched.h"
+#include "metrics.h"
+
+void sched_init(struct sched *sched, size_t quantum)
+{
+    pthread_mutex_init(&sched->lock, NULL);
+    sched->quantum = quantum;
+    sched->busy = false;
+    sched->waiting = NULL;
+}
+
+void sched_destroy(struct sched *sched)
+{
+    pthread_mutex_destroy(&sched->lock);
+}
+
+void sched_flow_init(struct sched_flow *flow)
+{
+    flow->next = NULL;
+    flow->cost = 0;
+    flow->deficit = 0;
+    flow->granted = false;
+    pthread_cond_init(&flow->granted_cond, NULL);
+}
+
+void sched_flow_destroy(struct sched_flow *flow)
+{
+    pthread_cond_destroy(&flow->granted_cond);
+}
+
+/**
+ * rounds of credit @param flow still needs before its request can be served
+ */
+static uint64_t rounds_needed(const struct sched *sched, const struct sched_flow *flow)
+{
+    return (flow->cost - flow->deficit + sched->quantum - 1) / sched->quantum;
+}
+
+uint64_t sched_enter(struct sched *sched, struct sched_flow *flow, size_t cost)
+{
+    if (sched->quantum == 0)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&sched->lock);
+    if (!sched->busy)
+    {
+        // nobody waits while the resource is idle
+        sched->busy = true;
+        pthread_mutex_unlock(&sched->lock);
+        return 0;
+    }
+
+    uint64_t start = metrics_now_ns();
+    flow->cost = cost ? cost : 1;
+    flow->deficit = 0;
+    flow->granted = false;
+
+    // joins at the end of the current round, sched->waiting is the last one
+    if (sched->waiting)
+    {
+        flow->next = sched->waiting->next;
+        sched->waiting->next = flow;
+    } else
+    {
+        flow->next = flow;
+    }
+    sched->waiting = flow;
+
+    while (!flow->granted)
+    {
+        pthread_cond_wait(&flow->granted_cond, &sched->lock);
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return metrics_now_ns() - start;
+}
+
+void sched_exit(struct sched *sched)
+{
+    if (sched->quantum == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&sched->lock);
+    struct sched_flow *last = sched->waiting;
+    if (last == NULL)
+    {
+        sched->busy = false;
+        pthread_mutex_unlock(&sched->lock);
+        return;
+    }
+
+    // skip the rounds in which nobody could be served instead of running them
+    uint64_t rounds = UINT64_MAX;
+    struct sched_flow *flow = last;
+    do
+    {
+        flow = flow->next;
+        uint64_t needed = rounds_needed(sched, flow);
+        rounds = needed < rounds ? needed : rounds;
+    } while (flow != last);
+
+    // the first one served in the last round wins, the ones after it in the
+    // ring are not visited in that round yet
+    struct sched_flow *prev = last, *winner = NULL, *winner_prev = NULL;
+    do
+    {
+        flow = prev->next;
+        if (winner == NULL && rounds_needed(sched, flow) == rounds)
+        {
+            winner = flow;
+            winner_prev = prev;
+        } else
+        {
+            flow->deficit += (winner ? rounds - 1 : rounds) * sched->quantum;
+        }
+        prev = flow;
+    } while (flow != last);
+
+    // the round carries on after the winner, which leaves with no credit
+    if (winner_prev == winner)
+    {
+        sched->waiting = NULL;
+    } else
+    {
+        winner_prev->next = winner->next;
+        sched->waiting = winner_prev;
+    }
+    winner->next = NULL;
+    winner->deficit = 0;
+    winner->granted = true;
+    pthread_cond_signal(&winner->granted_cond);
+    pthread_mutex_unlock(&sched->lock);
+}
@@ -0,0 +1,66 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_STORE_SCHED_H
+#define AESDSOCKET_STORE_SCHED_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * default bytes of credit a waiting connection earns per round
+ */
+#define SCHED_QUANTUM 65536
+
+/**
+ * One connection taking turns on a struct sched, owned by its thread
+ */
+struct sched_flow {
+    struct sched_flow *next;
+    pthread_cond_t granted_cond;
+    size_t cost;     // bytes the waiting request is going to write
+    uint64_t deficit;// credit earned while waiting
+    bool granted;
+};
+
+/**
+ * Deficit round-robin turns on a resource that serves one request at a time
+ *
+ * A request taking its turn while others wait joins a ring of waiting
+ * connections. Whenever the turn is given up, each waiting connection earns
+ * @quantum bytes of credit per round, and the first whose credit covers its
+ * request gets the turn next. A client writing large batches therefore gets
+ * about the same bytes per round as every other client, instead of holding
+ * the resource for as long as it keeps winning the race for it. With nobody
+ * waiting a request takes its turn right away.
+ */
+struct sched {
+    pthread_mutex_t lock;
+    size_t quantum;// 0 lets requests run in whatever order they get the lock
+    bool busy;
+    struct sched_flow *waiting;// ring, points to the next one to earn credit
+};
+
+void sched_init(struct sched *sched, size_t quantum);
+
+void sched_destroy(struct sched *sched);
+
+void sched_flow_init(struct sched_flow *flow);
+
+void sched_flow_destroy(struct sched_flow *flow);
+
+/**
+ * wait for the turn of @param flow to run a request of @param cost bytes
+ * @return ns spent waiting
+ */
+uint64_t sched_enter(struct sched *sched, struct sched_flow *flow, size_t cost);
+
+/**
+ * give up the turn taken with sched_enter()
+ */
+void sched_exit(struct sched *sched);
+
+#endif// AESDSOCKET_STORE_SCHED_H
@@ -0,0 +1,212 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "store_times.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TIMES_INITIAL_CAPACITY 1024
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+
+static void read_boot_id(char *boot_id, size_t len)
+{
+    int fd = open(BOOT_ID_PATH, O_RDONLY);
+
+    memset(boot_id, 0, len);
+    if (fd >= 0)
+    {
+        ssize_t bytes_read = read(fd, boot_id, len - 1);
+        if (bytes_read > 0 && boot_id[bytes_read - 1] == '\n')
+        {
+            boot_id[bytes_read - 1] = '\0';
+        }
+        close(fd);
+    }
+}
+
+static int pwrite_all(int fd, const void *data, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t written = pwrite(fd, data, len, offset);
+        if (written < 0)
+        {
+            return -1;
+        }
+        data = (const char *) data + written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+static int reserve_pending(struct store_times *times, size_t count)
+{
+    size_t capacity = times->capacity ? times->capacity : TIMES_INITIAL_CAPACITY;
+    uint64_t *pending;
+
+    if (count <= times->capacity)
+    {
+        return 0;
+    }
+    while (capacity < count)
+    {
+        capacity *= 2;
+    }
+    pending = realloc(times->pending, capacity * sizeof(*pending));
+    if (pending == NULL)
+    {
+        return -1;
+    }
+    times->pending = pending;
+    times->capacity = capacity;
+    return 0;
+}
+
+int store_times_open(struct store_times *times, const char *path, uint64_t count, uint64_t now_ns)
+{
+    struct store_times_header hdr, current;
+    uint64_t stamps = 0;
+    struct stat st;
+
+    memset(times, 0, sizeof(*times));
+    times->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (times->fd < 0)
+    {
+        return -1;
+    }
+
+    memset(&current, 0, sizeof(current));
+    memcpy(current.magic, STORE_TIMES_MAGIC, sizeof(STORE_TIMES_MAGIC));
+    current.version = STORE_TIMES_VERSION;
+    read_boot_id(current.boot_id, sizeof(current.boot_id));
+
+    if (fstat(times->fd, &st) == 0 && (size_t) st.st_size >= sizeof(hdr) &&
+        pread(times->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && memcmp(hdr.magic, current.magic, sizeof(hdr.magic)) == 0 &&
+        hdr.version == STORE_TIMES_VERSION && memcmp(hdr.boot_id, current.boot_id, sizeof(hdr.boot_id)) == 0)
+    {
+        current.first = hdr.first;
+        stamps = (st.st_size - sizeof(hdr)) / sizeof(uint64_t);
+    } else
+    {
+        // another boot or no sidecar yet, what is already in the store counts as time 0
+        current.first = count;
+    }
+
+    // a store shorter than its stamps was cut or replaced
+    if (current.first > count)
+    {
+        current.first = count;
+        stamps = 0;
+    }
+    if (current.first + stamps > count)
+    {
+        stamps = count - current.first;
+    }
+
+    if (pwrite_all(times->fd, &current, sizeof(current), 0) < 0 ||
+        ftruncate(times->fd, sizeof(current) + stamps * sizeof(uint64_t)) < 0)
+    {
+        store_times_close(times);
+        return -1;
+    }
+    times->first = current.first;
+    times->saved = stamps;
+    return store_times_stamp(times, count, now_ns);
+}
+
+void store_times_close(struct store_times *times)
+{
+    if (times->fd >= 0)
+    {
+        close(times->fd);
+    }
+    free(times->pending);
+    memset(times, 0, sizeof(*times));
+    times->fd = -1;
+}
+
+int store_times_stamp(struct store_times *times, uint64_t count, uint64_t now_ns)
+{
+    uint64_t stamped = times->first + times->saved + times->pending_count;
+
+    if (count <= stamped)
+    {
+        return 0;
+    }
+    if (reserve_pending(times, times->pending_count + (count - stamped)) < 0)
+    {
+        return -1;
+    }
+    while (stamped++ < count)
+    {
+        times->pending[times->pending_count++] = now_ns;
+    }
+    return 0;
+}
+
+int store_times_save(struct store_times *times)
+{
+    if (times->pending_count == 0)
+    {
+        return 0;
+    }
+    if (pwrite_all(times->fd, times->pending, times->pending_count * sizeof(uint64_t),
+                   sizeof(struct store_times_header) + times->saved * sizeof(uint64_t)) < 0)
+    {
+        return -1;
+    }
+    times->saved += times->pending_count;
+    times->pending_count = 0;
+    return 0;
+}
+
+/**
+ * stamp @param i of the sidecar followed by the stamps kept in memory
+ */
+static int stamp_at(const struct store_times *times, uint64_t i, uint64_t *stamp)
+{
+    if (i >= times->saved)
+    {
+        *stamp = times->pending[i - times->saved];
+        return 0;
+    }
+    if (pread(times->fd, stamp, sizeof(*stamp), sizeof(struct store_times_header) + i * sizeof(*stamp)) !=
+        sizeof(*stamp))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int64_t store_times_find(const struct store_times *times, uint64_t time_ns)
+{
+    uint64_t low = 0, high = times->saved + times->pending_count;
+
+    if (time_ns == 0)
+    {
+        return 0;
+    }
+
+    while (low < high)
+    {
+        uint64_t mid = low + (high - low) / 2, stamp;
+        if (stamp_at(times, mid, &stamp) < 0)
+        {
+            return -1;
+        }
+        if (stamp < time_ns)
+        {
+            low = mid + 1;
+        } else
+        {
+            high = mid;
+        }
+    }
+    return times->first + low;
+}
@@ -0,0 +1,75 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_STORE_TIMES_H
+#define AESDSOCKET_STORE_TIMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Ingest time of every entry of the append-only store, in ns of
+ * CLOCK_MONOTONIC
+ *
+ * The stamps live in a sidecar file, one uint64_t per entry in host byte
+ * order after a struct store_times_header, and are never decreasing. Stamps
+ * of entries committed since the last save are kept in memory. Monotonic
+ * time starts over on every boot, so entries stamped during an earlier boot
+ * are not kept, entries before @first count as ingested at time 0.
+ * Any necessary locking must be performed by the caller.
+ */
+struct store_times {
+    int fd;
+    uint64_t first;// entry the first stamp in the sidecar belongs to
+    uint64_t saved;// stamps in the sidecar
+    uint64_t *pending;
+    size_t pending_count;
+    size_t capacity;
+};
+
+struct store_times_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t first;
+    /**
+     * /proc/sys/kernel/random/boot_id of the boot the stamps were taken in
+     */
+    char boot_id[40];
+};
+
+#define STORE_TIMES_MAGIC "AESDTIM"
+#define STORE_TIMES_VERSION 1
+
+/**
+ * open the sidecar at @param path for a store of @param count entries,
+ * starting it over if it was written during another boot. Entries without a
+ * stamp, committed after the last save of a crashed instance, are stamped
+ * @param now_ns.
+ * @return 0 on success, -1 on failure
+ */
+int store_times_open(struct store_times *times, const char *path, uint64_t count, uint64_t now_ns);
+
+void store_times_close(struct store_times *times);
+
+/**
+ * stamp the entries committed since the last call, up to @param count, with @param now_ns
+ * @return 0 on success, -1 on allocation failure
+ */
+int store_times_stamp(struct store_times *times, uint64_t count, uint64_t now_ns);
+
+/**
+ * append the stamps kept in memory to the sidecar
+ * @return 0 on success, -1 on failure
+ */
+int store_times_save(struct store_times *times);
+
+/**
+ * binary search for the first entry ingested at or after @param time_ns
+ * @return the entry, the number of stamped entries if all are older, -1 if
+ *      the sidecar could not be read
+ */
+int64_t store_times_find(const struct store_times *times, uint64_t time_ns);
+
+#endif// AESDSOCKET_STORE_TIMES_H
@@ -0,0 +1,226 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "stores.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct store stores[STORES_MAX] = {
+        [0] = {.name = STORE_DEFAULT_NAME, .path = STORE_PATH}};
+static int store_count = 1;
+
+static bool valid_name(const char *name, size_t len)
+{
+    if (len == 0 || len >= STORE_NAME_MAX)
+    {
+        return false;
+    }
+    // the name ends up in a file name
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-'))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int stores_parse(const char *arg)
+{
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t) (colon - arg) : strlen(arg);
+    unsigned long port = 0;
+    char *end;
+
+    if (store_count == STORES_MAX || !valid_name(arg, len) || stores_find(arg, len) != NULL)
+    {
+        return -1;
+    }
+    if (colon)
+    {
+        port = strtoul(colon + 1, &end, 0);
+        if (*end != '\0' || port == 0 || port > UINT16_MAX || stores_for_port(port) != stores_default())
+        {
+            return -1;
+        }
+    }
+
+    struct store *store = &stores[store_count++];
+    memcpy(store->name, arg, len);
+    store->name[len] = '\0';
+    snprintf(store->path, sizeof(store->path), "%s-%.*s", STORE_PATH, (int) len, arg);
+    store->port = port;
+    return 0;
+}
+
+#if !(USE_AESD_CHAR_DEVICE)
+/**
+ * index whatever is already in @param store so seeks never have to scan it,
+ * the saved index covers all of it but what was appended after the last save
+ */
+static int index_store(struct store *store)
+{
+    int index_fd = open(store->path, O_RDWR | O_CREAT, 0644);
+    if (index_fd < 0 || store_index_init(&store->index) < 0)
+    {
+        syslog(LOG_ERR, "failed to index %s: %m", store->path);
+        return -1;
+    }
+    uint64_t saved_size =
+            store_index_load(&store->index, store->index_path, index_fd) == 0 ? store->index.size : 0;
+    if (store_index_scan(&store->index, index_fd) < 0)
+    {
+        syslog(LOG_ERR, "failed to index %s: %m", store->path);
+        close(index_fd);
+        return -1;
+    }
+    syslog(LOG_INFO, "indexed %llu entries of %s, %llu bytes from %s and %llu bytes scanned",
+           (unsigned long long) store->index.count, store->path, (unsigned long long) saved_size,
+           store->index_path, (unsigned long long) (store->index.size - saved_size));
+    close(index_fd);
+
+    if (store_times_open(&store->times, store->times_path, store->index.count, metrics_now_ns()) < 0)
+    {
+        syslog(LOG_ERR, "failed to open %s: %m", store->times_path);
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+int stores_open(size_t quantum)
+{
+    for (int i = 0; i < store_count; i++)
+    {
+        struct store *store = &stores[i];
+
+        pthread_mutex_init(&store->lock, NULL);
+        sched_init(&store->sched, quantum);
+        subscribe_init(&store->followers);
+#if !(USE_AESD_CHAR_DEVICE)
+        snprintf(store->index_path, sizeof(store->index_path), "%s.idx", store->path);
+        snprintf(store->times_path, sizeof(store->times_path), "%s.times", store->path);
+        if (index_store(store) < 0)
+        {
+            return -1;
+        }
+#endif
+        if (store->port)
+        {
+            syslog(LOG_INFO, "store %s at %s served on port %u", store->name, store->path, store->port);
+        }
+    }
+    return 0;
+}
+
+int stores_save(struct store *store)
+{
+#if !(USE_AESD_CHAR_DEVICE)
+    int rc = 0;
+    int fd = open(store->path, O_RDONLY);
+    if (fd < 0 || store_index_save(&store->index, store->index_path, fd) < 0)
+    {
+        syslog(LOG_WARNING, "failed to save the index to %s: %m", store->index_path);
+        rc = -1;
+    }
+    if (store_times_save(&store->times) < 0)
+    {
+        syslog(LOG_WARNING, "failed to save ingest times to %s: %m", store->times_path);
+        rc = -1;
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return rc;
+#else
+    return 0;
+#endif
+}
+
+void stores_close_followers(void)
+{
+    for (int i = 0; i < store_count; i++)
+    {
+        subscribe_close(&stores[i].followers);
+    }
+}
+
+void stores_close(bool handed_off)
+{
+    for (int i = 0; i < store_count; i++)
+    {
+        struct store *store = &stores[i];
+
+#if !(USE_AESD_CHAR_DEVICE)
+        // before the successor is let go, it loads the sidecars right after
+        if (handed_off)
+        {
+            pthread_mutex_lock(&store->lock);
+            stores_save(store);
+            pthread_mutex_unlock(&store->lock);
+        } else
+        {
+            if (remove(store->path) != 0)
+            {
+                syslog(LOG_ERR, "failed to remove file %s: %m", store->path);
+            }
+            unlink(store->index_path);
+            unlink(store->times_path);
+        }
+        store_index_free(&store->index);
+        store_times_close(&store->times);
+#endif
+        subscribe_destroy(&store->followers);
+        sched_destroy(&store->sched);
+        pthread_mutex_destroy(&store->lock);
+    }
+}
+
+struct store *stores_default(void)
+{
+    return &stores[0];
+}
+
+struct store *stores_find(const char *name, size_t len)
+{
+    for (int i = 0; i < store_count; i++)
+    {
+        if (strlen(stores[i].name) == len && memcmp(stores[i].name, name, len) == 0)
+        {
+            return &stores[i];
+        }
+    }
+    return NULL;
+}
+
+struct store *stores_for_port(uint16_t port)
+{
+    for (int i = 1; i < store_count; i++)
+    {
+        if (port != 0 && stores[i].port == port)
+        {
+            return &stores[i];
+        }
+    }
+    return &stores[0];
+}
+
+int stores_count(void)
+{
+    return store_count;
+}
+
+struct store *stores_get(int i)
+{
+    return &stores[i];
+}
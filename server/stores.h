@@ -0,0 +1,119 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_STORES_H
+#define AESDSOCKET_STORES_H
+
+#include "store_index.h"
+#include "store_sched.h"
+#include "store_times.h"
+#include "subscribe.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if USE_AESD_CHAR_DEVICE
+#define STORE_PATH "/dev/aesdchar"
+#else
+#define STORE_PATH "/var/tmp/aesdsocketdata"
+#endif
+
+#define STORES_MAX 8
+#define STORE_NAME_MAX 32
+/**
+ * room for STORE_PATH-name and the sidecar suffixes
+ */
+#define STORE_PATH_MAX (sizeof(STORE_PATH) + STORE_NAME_MAX + 8)
+/**
+ * name of the store served when no other one is selected, at STORE_PATH
+ */
+#define STORE_DEFAULT_NAME "default"
+
+/**
+ * text protocol line selecting the store of the connection, it must be the
+ * first line the client sends: AESDCHAR_STORE:name. A later one drops the
+ * connection once the lines before it are answered, the text protocol has no
+ * error reply. The binary protocol uses an AESD_BIN_STORE request.
+ */
+#define STORE_TEXT_COMMAND "AESDCHAR_STORE:"
+
+/**
+ * One named store and everything that serializes on it
+ *
+ * Named stores live next to the default one at STORE_PATH-name, with their
+ * own sidecars in file mode. A connection is bound to a single store, picked
+ * by the port it was accepted on or by a STORE_TEXT_COMMAND / AESD_BIN_STORE
+ * request, and its replies and followers only ever see that store.
+ */
+struct store {
+    char name[STORE_NAME_MAX];
+    char path[STORE_PATH_MAX];
+    /**
+     * IPv4 port whose connections are bound to the store, 0 for none
+     */
+    uint16_t port;
+    pthread_mutex_t lock;// mutex for the file operations on the store
+    struct sched sched;  // turns of the clients on lock
+    struct subscribe_list followers;
+#if !(USE_AESD_CHAR_DEVICE)
+    char index_path[STORE_PATH_MAX];// entry index saved next to the store
+    char times_path[STORE_PATH_MAX];// ingest time of every entry, for seeks by time
+    struct store_index index;       // entry boundaries of path, protected by lock
+    struct store_times times;       // entry ingest times of path, protected by lock
+#endif
+};
+
+/**
+ * add the store described by @param arg, name[:port], to the configuration
+ * @return 0 on success, -1 if it is malformed, taken or there are too many
+ */
+int stores_parse(const char *arg);
+
+/**
+ * set up every configured store, indexing what is already in it
+ * @param quantum deficit round-robin quantum of the store turns, see struct sched
+ * @return 0 on success, -1 on failure
+ */
+int stores_open(size_t quantum);
+
+/**
+ * save the index and ingest times of @param store
+ * must be called with store->lock held
+ * @return 0 on success, -1 on failure
+ */
+int stores_save(struct store *store);
+
+/**
+ * disconnect the followers of every store, before the connections are waited for
+ */
+void stores_close_followers(void);
+
+/**
+ * release every store, saving its sidecars for a successor if @param handed_off
+ * and removing its files otherwise
+ */
+void stores_close(bool handed_off);
+
+struct store *stores_default(void);
+
+/**
+ * @return the store named @param name (@param len bytes), NULL if there is none
+ */
+struct store *stores_find(const char *name, size_t len);
+
+/**
+ * @return the store connections accepted on @param port are bound to
+ */
+struct store *stores_for_port(uint16_t port);
+
+/**
+ * @return the number of stores, the default one is store 0
+ */
+int stores_count(void);
+
+struct store *stores_get(int i);
+
+#endif// AESDSOCKET_STORES_H
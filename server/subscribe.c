@@ -0,0 +1,172 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#include "subscribe.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/socket.h>
+
+enum subscribe_policy subscribe_policy = SUBSCRIBE_DISCONNECT;
+
+// totals over every store
+static _Atomic uint64_t followers = 0;
+static _Atomic uint64_t published = 0;
+static _Atomic uint64_t dropped = 0;
+static _Atomic uint64_t disconnected = 0;
+
+void subscribe_init(struct subscribe_list *list)
+{
+    pthread_mutex_init(&list->lock, NULL);
+    list->head = NULL;
+    list->closed = false;
+    atomic_init(&list->followers, 0);
+}
+
+void subscribe_destroy(struct subscribe_list *list)
+{
+    pthread_mutex_destroy(&list->lock);
+}
+
+int subscribe_add(struct subscribe_list *list, struct subscriber *sub, struct reply_queue *replies, int sock,
+                  bool binary)
+{
+    sub->replies = replies;
+    sub->sock = sock;
+    sub->binary = binary;
+    sub->disconnected = false;
+    sub->prev = NULL;
+
+    pthread_mutex_lock(&list->lock);
+    if (list->closed)
+    {
+        pthread_mutex_unlock(&list->lock);
+        return -1;
+    }
+    sub->next = list->head;
+    if (list->head)
+    {
+        list->head->prev = sub;
+    }
+    list->head = sub;
+    atomic_fetch_add_explicit(&list->followers, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&followers, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&list->lock);
+    return 0;
+}
+
+void subscribe_remove(struct subscribe_list *list, struct subscriber *sub)
+{
+    pthread_mutex_lock(&list->lock);
+    if (sub->prev)
+    {
+        sub->prev->next = sub->next;
+    } else
+    {
+        list->head = sub->next;
+    }
+    if (sub->next)
+    {
+        sub->next->prev = sub->prev;
+    }
+    atomic_fetch_sub_explicit(&list->followers, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&followers, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&list->lock);
+}
+
+/**
+ * apply subscribe_policy to @param sub, which could not take another packet
+ * must be called with the list lock held
+ */
+static void handle_slow(struct subscriber *sub)
+{
+    if (subscribe_policy == SUBSCRIBE_DROP)
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    LOG_RL(LOG_INFO, "follower %d disconnected: too slow", sub->sock);
+    atomic_fetch_add_explicit(&disconnected, 1, memory_order_relaxed);
+    sub->disconnected = true;
+    // the connection thread sees EOF and unsubscribes
+    shutdown(sub->sock, SHUT_RDWR);
+}
+
+void subscribe_publish(struct subscribe_list *list, const char *data, size_t length)
+{
+    if (atomic_load_explicit(&list->followers, memory_order_relaxed) == 0)
+    {
+        return;
+    }
+
+    // encoded once, whatever the number of followers
+    struct aesd_bin_hdr hdr = {
+            .type = AESD_BIN_PUBLISH,
+            .status = AESD_BIN_OK,
+            .length = htonl(length)};
+    struct shared_payload *payload = shared_payload_new(sizeof(hdr) + length);
+    if (payload == NULL)
+    {
+        LOG_RL(LOG_ERR, "failed to allocate published packet");
+        return;
+    }
+    memcpy(payload->data, &hdr, sizeof(hdr));
+    memcpy(payload->data + sizeof(hdr), data, length);
+    atomic_fetch_add_explicit(&published, 1, memory_order_relaxed);
+
+    uint64_t start_ns = metrics_now_ns();
+    pthread_mutex_lock(&list->lock);
+    for (struct subscriber *sub = list->head; sub; sub = sub->next)
+    {
+        if (sub->disconnected)
+        {
+            continue;
+        }
+
+        struct reply *reply = reply_new(start_ns);
+        if (reply == NULL)
+        {
+            handle_slow(sub);
+            continue;
+        }
+        reply->shared = shared_payload_get(payload);
+        reply->data = sub->binary ? payload->data : payload->data + sizeof(hdr);
+        reply->length = sub->binary ? payload->length : length;
+
+        // never wait for a follower while the store is locked
+        if (reply_queue_try_push(sub->replies, reply, false) < 0 && errno == EAGAIN)
+        {
+            handle_slow(sub);
+        }
+    }
+    pthread_mutex_unlock(&list->lock);
+
+    shared_payload_put(payload);
+}
+
+void subscribe_close(struct subscribe_list *list)
+{
+    pthread_mutex_lock(&list->lock);
+    list->closed = true;
+    for (struct subscriber *sub = list->head; sub; sub = sub->next)
+    {
+        sub->disconnected = true;
+        shutdown(sub->sock, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&list->lock);
+}
+
+void subscribe_get_stats(struct subscribe_stats *stats)
+{
+    stats->followers = atomic_load_explicit(&followers, memory_order_relaxed);
+    stats->published = atomic_load_explicit(&published, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&dropped, memory_order_relaxed);
+    stats->disconnected = atomic_load_explicit(&disconnected, memory_order_relaxed);
+}
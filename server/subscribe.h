@@ -0,0 +1,102 @@
+//
+// Created by Fleming on 2026-10-19.
+//
+
+#ifndef AESDSOCKET_SUBSCRIBE_H
+#define AESDSOCKET_SUBSCRIBE_H
+
+#include "reply_queue.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * text protocol line that turns the connection into a follower, the binary
+ * protocol uses an AESD_BIN_SUBSCRIBE request
+ */
+#define SUBSCRIBE_TEXT_COMMAND "AESDSOCKET_SUBSCRIBE\n"
+
+/**
+ * what to do with a follower whose reply queue is full when a packet is published
+ */
+enum subscribe_policy {
+    /**
+     * disconnect it, it can subscribe again and start over from a new snapshot
+     */
+    SUBSCRIBE_DISCONNECT = 0,
+    /**
+     * skip the packet for this follower only
+     */
+    SUBSCRIBE_DROP,
+};
+
+extern enum subscribe_policy subscribe_policy;
+
+/**
+ * A connection following one store
+ *
+ * Every packet appended to the store is encoded once into a shared payload
+ * (binary frame header followed by the packet) and queued by reference on
+ * every follower. Binary followers are sent the whole frame, text followers
+ * only the packet.
+ */
+struct subscriber {
+    struct reply_queue *replies;
+    int sock;
+    bool binary;
+    bool disconnected;// set by the slow follower policy
+    struct subscriber *next;
+    struct subscriber *prev;
+};
+
+/**
+ * Followers of one store, packets are only published to the followers of
+ * the store they were appended to
+ */
+struct subscribe_list {
+    pthread_mutex_t lock;
+    struct subscriber *head;
+    bool closed;
+    // read without the lock so publishing costs nothing without followers
+    _Atomic uint64_t followers;
+};
+
+void subscribe_init(struct subscribe_list *list);
+
+void subscribe_destroy(struct subscribe_list *list);
+
+/**
+ * start publishing to the follower served on @param sock, after its snapshot
+ * of the store was queued on @param replies
+ * must be called with the store lock held so no packet is missed or sent twice
+ * @return 0 on success, -1 if the server is shutting down
+ */
+int subscribe_add(struct subscribe_list *list, struct subscriber *sub, struct reply_queue *replies, int sock,
+                  bool binary);
+
+void subscribe_remove(struct subscribe_list *list, struct subscriber *sub);
+
+/**
+ * queue @param length bytes just appended to the store on every follower of it
+ * must be called with the store lock held
+ */
+void subscribe_publish(struct subscribe_list *list, const char *data, size_t length);
+
+/**
+ * disconnect every follower of the store and refuse new ones, on shutdown and handoff
+ */
+void subscribe_close(struct subscribe_list *list);
+
+struct subscribe_stats {
+    uint64_t followers;
+    uint64_t published;   // packets published
+    uint64_t dropped;     // packets skipped for slow followers
+    uint64_t disconnected;// followers disconnected for being slow
+};
+
+void subscribe_get_stats(struct subscribe_stats *stats);
+
+#endif// AESDSOCKET_SUBSCRIBE_H
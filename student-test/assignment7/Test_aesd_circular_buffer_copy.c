@@ -0,0 +1,277 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/* longest entry the tests add, a few of them fill the smallest byte ring */
+#define COPY_TEST_MAX_SIZE 400
+
+static struct aesd_circular_buffer buffer;
+
+/**
+* What the buffer should hold, oldest first, each entry its own copy
+*/
+static struct {
+    char data[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED][COPY_TEST_MAX_SIZE];
+    size_t size[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t first;
+    size_t count;
+} reference;
+
+/* callers' memory of the entries added with aesd_circular_buffer_add_entry() */
+static char external[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED][COPY_TEST_MAX_SIZE];
+
+static uint32_t random_state;
+
+static uint32_t next_random(void)
+{
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 16;
+}
+
+static void copy_test_init(void)
+{
+    aesd_circular_buffer_init(&buffer);
+    memset(&reference, 0, sizeof(reference));
+    random_state = 1;
+}
+
+/**
+* Bytes of the @param number th entry added, different for every entry and position
+*/
+static void fill_entry(char *data, size_t number, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (char) ('a' + (number * 7 + i) % 26);
+    }
+}
+
+static char *reference_add(size_t size)
+{
+    size_t slot;
+
+    if (reference.count < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+        slot = (reference.first + reference.count++) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    } else {
+        slot = reference.first;
+        reference.first = (reference.first + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    reference.size[slot] = size;
+    return reference.data[slot];
+}
+
+/**
+* Adds a copy of a @param size byte entry numbered @param number
+*/
+static void add_copy(size_t number, size_t size)
+{
+    static char scratch[COPY_TEST_MAX_SIZE];
+
+    fill_entry(scratch, number, size);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_circular_buffer_add_copy(&buffer, scratch, size),
+                                  "Adding a copy should succeed");
+    memcpy(reference_add(size), scratch, size);
+    // the buffer has to keep its own copy
+    memset(scratch, 0, size);
+}
+
+/**
+* Adds a @param size byte entry numbered @param number that stays in the caller's memory
+*/
+static void add_external(size_t number, size_t size)
+{
+    char *data = reference_add(size);
+    char *owned = external[buffer.in_offs];
+    struct aesd_buffer_entry entry = {.buffptr = owned, .size = size};
+
+    fill_entry(data, number, size);
+    memcpy(owned, data, size);
+    aesd_circular_buffer_add_entry(&buffer, &entry);
+}
+
+/**
+* Every byte of the buffer should be found at its position, as in the reference, and nothing after them
+*/
+static void check_contents(void)
+{
+    size_t position = 0, offset;
+
+    for (size_t i = 0; i < reference.count; i++) {
+        size_t slot = (reference.first + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        for (size_t j = 0; j < reference.size[slot]; j++, position++) {
+            struct aesd_buffer_entry *entry =
+                    aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, position, &offset);
+            TEST_ASSERT_NOT_NULL_MESSAGE(entry, "Every position written should be found");
+            TEST_ASSERT_EQUAL_UINT(reference.size[slot], entry->size);
+            TEST_ASSERT_EQUAL_UINT(j, offset);
+            TEST_ASSERT_EQUAL_INT_MESSAGE(reference.data[slot][j], entry->buffptr[offset],
+                                          "Should read back the byte written at the position");
+        }
+    }
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, position, &offset),
+                             "Nothing should be found past the end of the data");
+}
+
+/**
+* Entries up to AESD_INLINE_ENTRY_SIZE bytes are kept in their slot, one byte more goes to the ring
+*/
+void test_add_copy_inline_boundary()
+{
+    copy_test_init();
+    add_copy(0, AESD_INLINE_ENTRY_SIZE - 1);
+    add_copy(1, AESD_INLINE_ENTRY_SIZE);
+    add_copy(2, AESD_INLINE_ENTRY_SIZE + 1);
+    add_copy(3, 1);
+
+    TEST_ASSERT_EQUAL_UINT8(AESD_ENTRY_INLINE, buffer.storage[0]);
+    TEST_ASSERT_EQUAL_UINT8(AESD_ENTRY_INLINE, buffer.storage[1]);
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(AESD_ENTRY_RING, buffer.storage[2], "A longer entry should go to the ring");
+    TEST_ASSERT_EQUAL_PTR(buffer.inline_data[1], buffer.entry[1].buffptr);
+    TEST_ASSERT_EQUAL_PTR(buffer.ring, buffer.entry[2].buffptr);
+    TEST_ASSERT_EQUAL_UINT8(1, buffer.ring_entries);
+    check_contents();
+
+    // the ring entry is overwritten by an inline one and gives its space back
+    for (size_t i = 4; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3; i++) {
+        add_copy(i, AESD_INLINE_ENTRY_SIZE);
+    }
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(0, buffer.ring_entries, "Overwritten entries should leave the ring");
+    check_contents();
+    aesd_circular_buffer_free(&buffer);
+}
+
+/**
+* Entries of the same size overwriting each other keep going around the ring
+* without it growing, the ring wraps and unwraps as the oldest ones are released
+*/
+void test_add_copy_ring_wraps()
+{
+    size_t capacity;
+    bool wrapped = false;
+
+    copy_test_init();
+    for (size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        add_copy(i, 100);
+    }
+    capacity = buffer.ring_capacity;
+    for (size_t i = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i < 20 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        add_copy(i, 100);
+        wrapped |= buffer.ring_wrapped;
+        check_contents();
+    }
+    TEST_ASSERT_TRUE_MESSAGE(wrapped, "The ring should have wrapped around");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(capacity, buffer.ring_capacity,
+                                   "Space released by the oldest entries should be reused");
+    TEST_ASSERT_EQUAL_UINT8(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, buffer.ring_entries);
+    aesd_circular_buffer_free(&buffer);
+}
+
+/**
+* Ten 96 byte entries leave less than one entry of the smallest ring free, every
+* new one only fits in the space the oldest entry gives back, first in first out
+*/
+void test_add_copy_fifo_release()
+{
+    copy_test_init();
+    for (size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        add_copy(i, 96);
+    }
+    TEST_ASSERT_EQUAL_UINT(1024, buffer.ring_capacity);
+
+    for (size_t i = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i < 10 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        uint8_t slot = buffer.in_offs;
+        const char *oldest = buffer.entry[slot].buffptr;
+
+        add_copy(i, 96);
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(oldest, buffer.entry[slot].buffptr,
+                                      "An entry should take the place of the oldest one");
+        check_contents();
+    }
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(1024, buffer.ring_capacity, "The released space should be enough");
+    aesd_circular_buffer_free(&buffer);
+}
+
+/**
+* Ever longer entries make the ring grow while it is wrapped, the entries are
+* packed oldest first into the new allocation and keep leaving it in order
+*/
+void test_add_copy_grow_and_pack()
+{
+    size_t number = 0;
+
+    copy_test_init();
+    // wrap the smallest ring with short ring entries
+    while (!buffer.ring_wrapped) {
+        add_copy(number++, AESD_INLINE_ENTRY_SIZE + 16);
+        TEST_ASSERT_TRUE_MESSAGE(number < 100, "The ring should wrap");
+    }
+    for (size_t size = 100; size <= COPY_TEST_MAX_SIZE; size += 50) {
+        char *old_ring = buffer.ring;
+
+        add_copy(number++, size);
+        check_contents();
+        if (buffer.ring != old_ring) {
+            TEST_ASSERT_FALSE_MESSAGE(buffer.ring_wrapped, "A grown ring should start packed");
+        }
+    }
+    TEST_ASSERT_TRUE_MESSAGE(buffer.ring_capacity > 1024, "The ring should have grown");
+
+    // the packed entries leave in order and are replaced without growing again
+    size_t capacity = buffer.ring_capacity;
+    for (size_t i = 0; i < 3 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        add_copy(number++, AESD_INLINE_ENTRY_SIZE + 1 + i % 2 * 150);
+        check_contents();
+    }
+    TEST_ASSERT_EQUAL_UINT(capacity, buffer.ring_capacity);
+    aesd_circular_buffer_free(&buffer);
+}
+
+/**
+* Entries of random sizes on both sides of the inline limit, checked after every add
+*/
+void test_add_copy_random_sizes()
+{
+    copy_test_init();
+    for (size_t i = 0; i < 2000; i++) {
+        add_copy(i, 1 + next_random() % COPY_TEST_MAX_SIZE);
+        check_contents();
+    }
+    // with at most all entries in the ring, doubling leaves it at most about four times that
+    TEST_ASSERT_TRUE_MESSAGE(buffer.ring_capacity <= 4 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * (COPY_TEST_MAX_SIZE + 16),
+                             "The ring should not keep growing");
+    aesd_circular_buffer_free(&buffer);
+    TEST_ASSERT_NULL(buffer.ring);
+    TEST_ASSERT_EQUAL_UINT8(0, buffer.ring_entries);
+}
+
+/**
+* Entries added with aesd_circular_buffer_add_entry() and copies replace each
+* other in the same slots, only the copies are taken from or given back to the ring
+*/
+void test_add_copy_mixed_with_add_entry()
+{
+    copy_test_init();
+    for (size_t i = 0; i < 2000; i++) {
+        size_t size = 1 + next_random() % COPY_TEST_MAX_SIZE;
+        uint8_t slot = buffer.in_offs;
+
+        if (next_random() % 3 == 0) {
+            add_external(i, size);
+            TEST_ASSERT_EQUAL_UINT8(AESD_ENTRY_EXTERNAL, buffer.storage[slot]);
+            TEST_ASSERT_EQUAL_PTR_MESSAGE(external[slot], buffer.entry[slot].buffptr,
+                                          "An added entry should not be copied");
+        } else {
+            add_copy(i, size);
+        }
+
+        uint8_t ring_entries = 0;
+        for (size_t j = 0; j < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; j++) {
+            ring_entries += buffer.storage[j] == AESD_ENTRY_RING;
+        }
+        TEST_ASSERT_EQUAL_UINT8_MESSAGE(ring_entries, buffer.ring_entries,
+                                        "Only the copies in the ring should be counted");
+        check_contents();
+    }
+    aesd_circular_buffer_free(&buffer);
+}
@@ -0,0 +1,78 @@
+#include "unity.h"
+#include <stdint.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+* Adds a line stamped @param ingest_ns, the way the driver stamps its writes
+*/
+static void add_stamped(struct aesd_circular_buffer *buffer, uint64_t ingest_ns)
+{
+    uint8_t slot = buffer->in_offs;
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_add_copy(buffer, "line\n", 5));
+    buffer->ingest_ns[slot] = ingest_ns;
+}
+
+/**
+* An empty buffer has no entry to seek to, the search ends past all of them
+*/
+void test_find_entry_for_time_empty()
+{
+    struct aesd_circular_buffer buffer;
+
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_circular_buffer_find_entry_for_time(&buffer, 0),
+                                  "An empty buffer should have no entries to skip");
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_find_entry_for_time(&buffer, 1000));
+    aesd_circular_buffer_free(&buffer);
+}
+
+/**
+* Entry i is stamped 100 + 10 * i, each time should find the oldest entry
+* stamped at or after it, also once the oldest entries have been overwritten
+* and the entries wrap around the end of the array
+*/
+void test_find_entry_for_time_wraps()
+{
+    struct aesd_circular_buffer buffer;
+    const uint64_t added = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 2 + 3;
+
+    aesd_circular_buffer_init(&buffer);
+    for (uint64_t i = 0; i < added; i++) {
+        add_stamped(&buffer, 100 + 10 * i);
+
+        uint64_t entries = i + 1 < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ? i + 1 : AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        uint64_t oldest = i + 1 - entries;
+        for (uint64_t time_ns = 0; time_ns < 100 + 10 * (i + 2); time_ns++) {
+            uint64_t expected;
+            if (time_ns <= 100 + 10 * oldest) {
+                expected = 0;
+            } else if (time_ns > 100 + 10 * i) {
+                expected = entries;
+            } else {
+                expected = (time_ns - 100 + 9) / 10 - oldest;
+            }
+            TEST_ASSERT_EQUAL_INT_MESSAGE((int) expected, aesd_circular_buffer_find_entry_for_time(&buffer, time_ns),
+                                          "Should find the oldest entry stamped at or after the time");
+        }
+    }
+    aesd_circular_buffer_free(&buffer);
+}
+
+/**
+* Lines of one write share a stamp, the search should stop at the first of them
+*/
+void test_find_entry_for_time_equal_stamps()
+{
+    struct aesd_circular_buffer buffer;
+
+    aesd_circular_buffer_init(&buffer);
+    add_stamped(&buffer, 100);
+    add_stamped(&buffer, 200);
+    add_stamped(&buffer, 200);
+    add_stamped(&buffer, 200);
+    add_stamped(&buffer, 300);
+    TEST_ASSERT_EQUAL_INT(1, aesd_circular_buffer_find_entry_for_time(&buffer, 200));
+    TEST_ASSERT_EQUAL_INT(1, aesd_circular_buffer_find_entry_for_time(&buffer, 101));
+    TEST_ASSERT_EQUAL_INT(4, aesd_circular_buffer_find_entry_for_time(&buffer, 201));
+    aesd_circular_buffer_free(&buffer);
+}
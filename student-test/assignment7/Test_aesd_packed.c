@@ -0,0 +1,80 @@
+#include "unity.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesdchar.h"
+
+/* enough lines to fill and seal a few blocks */
+#define PACKED_TEST_LINES (3 * AESD_BLOCK_SIZE / 16)
+
+static struct aesd_dev dev;
+
+static void packed_init(void)
+{
+    memset(&dev, 0, sizeof(dev));
+    dev.stats = alloc_percpu(struct aesd_stats);
+    TEST_ASSERT_NOT_NULL(dev.stats);
+    TEST_ASSERT_EQUAL_INT(0, aesd_packed_init(&dev));
+}
+
+static void packed_free(void)
+{
+    aesd_packed_cleanup(&dev);
+    free_percpu(dev.stats);
+}
+
+/**
+* Line @param i of the test, 16 bytes like a short log line
+*/
+static size_t numbered_line(char *line, size_t i)
+{
+    return snprintf(line, 17, "line %010zu\n", i);
+}
+
+static void check_entry(uint8_t slot, size_t i)
+{
+    char expected[17];
+    size_t size = numbered_line(expected, i);
+    const char *entry = aesd_packed_entry(&dev, slot);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(entry, "A stored entry should be readable");
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, entry, size, "Should read back the line stored in the slot");
+}
+
+/**
+* With a history of one entry (HISTORY=1) every line replaces the only
+* entry pointing into the open block, the block has to stay open for the
+* new line instead of being freed under it
+*/
+void test_packed_history_of_one()
+{
+    char line[17];
+
+    packed_init();
+    for (size_t i = 0; i < PACKED_TEST_LINES; i++) {
+        TEST_ASSERT_EQUAL_INT(0, aesd_packed_add(&dev, 0, line, numbered_line(line, i)));
+        check_entry(0, i);
+    }
+    packed_free();
+}
+
+/**
+* Lines added slot after slot the way the device does read back unchanged,
+* from the open block as well as from sealed ones that are evicted in turn
+*/
+void test_packed_round_trip()
+{
+    char line[17];
+
+    packed_init();
+    for (size_t i = 0; i < PACKED_TEST_LINES; i++) {
+        TEST_ASSERT_EQUAL_INT(0, aesd_packed_add(&dev, i % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, line,
+                                                 numbered_line(line, i)));
+
+        size_t entries = i + 1 < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ? i + 1 : AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        for (size_t j = i + 1 - entries; j <= i; j++) {
+            check_entry(j % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, j);
+        }
+    }
+    packed_free();
+}
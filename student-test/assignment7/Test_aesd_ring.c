@@ -0,0 +1,139 @@
+#include "unity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../../aesd-char-driver/aesd-ring.h"
+
+#define RING_TEST_PRODUCERS 4
+#define RING_TEST_ENTRIES_PER_PRODUCER 100000
+
+static struct aesd_spsc_ring spsc;
+static struct aesd_mpsc_ring mpsc;
+
+static struct aesd_buffer_entry numbered_entry(uintptr_t producer, size_t number)
+{
+    struct aesd_buffer_entry entry = {.buffptr = (const char *) producer, .size = number};
+    return entry;
+}
+
+/**
+* Fill the single producer ring, check that it refuses one more entry and
+* hands back everything in order
+*/
+void test_spsc_ring_fifo_and_full()
+{
+    struct aesd_buffer_entry entry;
+
+    aesd_spsc_ring_init(&spsc);
+    TEST_ASSERT_FALSE_MESSAGE(aesd_spsc_ring_pop(&spsc, &entry), "A new ring should be empty");
+    for (size_t i = 0; i < AESD_RING_ENTRIES; i++) {
+        entry = numbered_entry(0, i);
+        TEST_ASSERT_TRUE_MESSAGE(aesd_spsc_ring_push(&spsc, &entry), "Push should succeed until the ring is full");
+    }
+    entry = numbered_entry(0, AESD_RING_ENTRIES);
+    TEST_ASSERT_FALSE_MESSAGE(aesd_spsc_ring_push(&spsc, &entry), "Push into a full ring should fail");
+
+    for (size_t i = 0; i < AESD_RING_ENTRIES; i++) {
+        TEST_ASSERT_TRUE(aesd_spsc_ring_pop(&spsc, &entry));
+        TEST_ASSERT_EQUAL_INT_MESSAGE((int) i, (int) entry.size, "Entries should come out in the order pushed");
+    }
+    TEST_ASSERT_FALSE_MESSAGE(aesd_spsc_ring_pop(&spsc, &entry), "A drained ring should be empty");
+}
+
+/**
+* Batches across the end of the entry array, partial batches when the ring
+* fills up
+*/
+void test_spsc_ring_batch_wraps()
+{
+    struct aesd_buffer_entry in[AESD_RING_ENTRIES], out[AESD_RING_ENTRIES];
+    size_t next_in = 0, next_out = 0;
+
+    aesd_spsc_ring_init(&spsc);
+    for (int round = 0; round < 10; round++) {
+        for (size_t i = 0; i < AESD_RING_ENTRIES; i++) {
+            in[i] = numbered_entry(0, next_in + i);
+        }
+        size_t pushed = aesd_spsc_ring_push_batch(&spsc, in, AESD_RING_ENTRIES * 3 / 4);
+        next_in += pushed;
+        TEST_ASSERT_TRUE_MESSAGE(pushed > 0, "A batch should push into a ring that has space");
+
+        size_t popped = aesd_spsc_ring_pop_batch(&spsc, out, AESD_RING_ENTRIES / 2);
+        for (size_t i = 0; i < popped; i++, next_out++) {
+            TEST_ASSERT_EQUAL_INT_MESSAGE((int) next_out, (int) out[i].size, "Batches should keep the order");
+        }
+    }
+    for (size_t i = 0; i < AESD_RING_ENTRIES; i++) {
+        in[i] = numbered_entry(0, next_in + i);
+    }
+    next_in += aesd_spsc_ring_push_batch(&spsc, in, AESD_RING_ENTRIES);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(AESD_RING_ENTRIES, (int) (next_in - next_out),
+                                  "Batches should stop at the capacity of the ring");
+}
+
+void test_mpsc_ring_fifo_and_full()
+{
+    struct aesd_buffer_entry in[AESD_RING_ENTRIES + 1], out[AESD_RING_ENTRIES + 1];
+
+    aesd_mpsc_ring_init(&mpsc);
+    for (size_t i = 0; i <= AESD_RING_ENTRIES; i++) {
+        in[i] = numbered_entry(1, i);
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(AESD_RING_ENTRIES, (int) aesd_mpsc_ring_push_batch(&mpsc, in, AESD_RING_ENTRIES + 1),
+                                  "A batch should be cut at the capacity of the ring");
+    TEST_ASSERT_FALSE_MESSAGE(aesd_mpsc_ring_push(&mpsc, &in[AESD_RING_ENTRIES]), "Push into a full ring should fail");
+    TEST_ASSERT_EQUAL_INT(AESD_RING_ENTRIES, (int) aesd_mpsc_ring_pop_batch(&mpsc, out, AESD_RING_ENTRIES + 1));
+    for (size_t i = 0; i < AESD_RING_ENTRIES; i++) {
+        TEST_ASSERT_EQUAL_PTR(in[i].buffptr, out[i].buffptr);
+        TEST_ASSERT_EQUAL_INT_MESSAGE((int) i, (int) out[i].size, "Entries should come out in the order pushed");
+    }
+    TEST_ASSERT_FALSE_MESSAGE(aesd_mpsc_ring_pop(&mpsc, &out[0]), "A drained ring should be empty");
+    TEST_ASSERT_TRUE_MESSAGE(aesd_mpsc_ring_push(&mpsc, &in[0]), "A drained ring should accept entries again");
+}
+
+static void *mpsc_producer(void *arg)
+{
+    for (size_t i = 1; i <= RING_TEST_ENTRIES_PER_PRODUCER; i++) {
+        struct aesd_buffer_entry entry = numbered_entry((uintptr_t) arg, i);
+        while (!aesd_mpsc_ring_push(&mpsc, &entry)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/**
+* Every producer's entries should arrive complete and in the order it pushed
+* them, interleaved in any way with the other producers
+*/
+void test_mpsc_ring_concurrent_producers()
+{
+    pthread_t producers[RING_TEST_PRODUCERS];
+    size_t last[RING_TEST_PRODUCERS] = {0};
+    struct aesd_buffer_entry out[32];
+    size_t remaining = RING_TEST_PRODUCERS * RING_TEST_ENTRIES_PER_PRODUCER;
+
+    aesd_mpsc_ring_init(&mpsc);
+    for (uintptr_t p = 0; p < RING_TEST_PRODUCERS; p++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&producers[p], NULL, mpsc_producer, (void *) p));
+    }
+    while (remaining > 0) {
+        size_t popped = aesd_mpsc_ring_pop_batch(&mpsc, out, 32);
+        if (popped == 0) {
+            sched_yield();
+        }
+        for (size_t i = 0; i < popped; i++) {
+            uintptr_t p = (uintptr_t) out[i].buffptr;
+            TEST_ASSERT_TRUE_MESSAGE(p < RING_TEST_PRODUCERS, "Entry from an unknown producer");
+            TEST_ASSERT_EQUAL_INT_MESSAGE((int) last[p] + 1, (int) out[i].size,
+                                          "A producer's entries should arrive in order without gaps");
+            last[p] = out[i].size;
+        }
+        remaining -= popped;
+    }
+    for (int p = 0; p < RING_TEST_PRODUCERS; p++) {
+        pthread_join(producers[p], NULL);
+    }
+    TEST_ASSERT_FALSE_MESSAGE(aesd_mpsc_ring_pop(&mpsc, &out[0]), "No entries should be left over");
+}